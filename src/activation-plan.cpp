@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "activation-plan.hpp"
+#include "yolo-network.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+// Memory shared by one or more outputs for the same lifetime: a layer's
+// own output, or the inputs of a route laid out one after the other.
+struct Block {
+  uint64_t size;
+  uint32_t first;
+  uint32_t last;
+  uint64_t offset;
+  // Holds the inputs of a route.
+  bool route;
+};
+
+}
+
+// Floats per 64 bytes.
+static uint64_t const planAlignment = 16;
+
+static uint64_t alignPlan(uint64_t size)
+{
+  return (size + planAlignment - 1) / planAlignment * planAlignment;
+}
+
+ActivationPlan planActivations(std::vector<Layer> const &layers)
+{
+  uint32_t const count = static_cast<uint32_t>(layers.size());
+  uint32_t const none = std::numeric_limits<uint32_t>::max();
+  ActivationPlan plan;
+  plan.offsets.resize(count, 0);
+  plan.views.resize(count, false);
+
+  // The block of every output and its offset in the block.
+  std::vector<uint32_t> blockOf(count, none);
+  std::vector<uint64_t> offsetInBlock(count, 0);
+  std::vector<Block> blocks;
+  for (uint32_t i = 0; i < count; ++i) {
+    Layer const &l = layers[i];
+    plan.unplannedSize += alignPlan(l.outputSize());
+    if (l.type == LayerType::Route && l.inputs.size() == 1) {
+      blockOf[i] = blockOf[l.inputs[0]];
+      offsetInBlock[i] = offsetInBlock[l.inputs[0]];
+      plan.views[i] = true;
+      continue;
+    }
+    if (l.type == LayerType::Route) {
+      // Only inputs with a block of their own, used once, can be moved
+      // into the route's block.
+      bool placeable{true};
+      for (uint32_t input : l.inputs) {
+        placeable = placeable && layers[input].type != LayerType::Route
+          && !blocks[blockOf[input]].route
+          && std::count(l.inputs.begin(), l.inputs.end(), input) == 1;
+      }
+      if (placeable) {
+        uint32_t const block = static_cast<uint32_t>(blocks.size());
+        blocks.push_back(Block{alignPlan(l.outputSize()), i, i, 0, true});
+        uint64_t offset{0};
+        for (uint32_t input : l.inputs) {
+          uint32_t const old = blockOf[input];
+          blocks[block].first = std::min(blocks[block].first,
+              blocks[old].first);
+          // Left empty rather than removed, so block indices hold. Views
+          // of the input move with it.
+          blocks[old].size = 0;
+          for (uint32_t j = 0; j < i; ++j) {
+            if (blockOf[j] == old) {
+              blockOf[j] = block;
+              offsetInBlock[j] += offset;
+            }
+          }
+          offset += layers[input].outputSize();
+        }
+        blockOf[i] = block;
+        plan.views[i] = true;
+        continue;
+      }
+    }
+    blockOf[i] = static_cast<uint32_t>(blocks.size());
+    blocks.push_back(Block{alignPlan(l.outputSize()), i, i, 0, false});
+  }
+
+  // Extend every block to its last reader: a route copying or viewing its
+  // inputs reads them, every other layer the output of the one before.
+  for (uint32_t i = 0; i < count; ++i) {
+    Layer const &l = layers[i];
+    if (l.type == LayerType::Route) {
+      for (uint32_t input : l.inputs) {
+        Block &block = blocks[blockOf[input]];
+        block.last = std::max(block.last, i);
+      }
+    } else if (i > 0) {
+      Block &block = blocks[blockOf[i - 1]];
+      block.last = std::max(block.last, i);
+    }
+    if (l.type == LayerType::Yolo) {
+      blocks[blockOf[i]].last = count;
+    }
+  }
+
+  // Largest first, each at the lowest offset free of the blocks placed so
+  // far that are live at the same time.
+  std::vector<uint32_t> order;
+  for (uint32_t b = 0; b < blocks.size(); ++b) {
+    if (blocks[b].size > 0) {
+      order.push_back(b);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(), [&blocks](uint32_t a,
+        uint32_t b) { return blocks[a].size > blocks[b].size; });
+  std::vector<uint32_t> placed;
+  for (uint32_t b : order) {
+    Block &block = blocks[b];
+    std::vector<Block const *> live;
+    for (uint32_t p : placed) {
+      if (blocks[p].first <= block.last && block.first <= blocks[p].last) {
+        live.push_back(&blocks[p]);
+      }
+    }
+    std::sort(live.begin(), live.end(), [](Block const *x, Block const *y) {
+        return x->offset < y->offset; });
+    uint64_t offset{0};
+    for (Block const *other : live) {
+      if (offset + block.size <= other->offset) {
+        break;
+      }
+      offset = std::max(offset, other->offset + other->size);
+    }
+    block.offset = offset;
+    plan.size = std::max(plan.size, offset + block.size);
+    placed.push_back(b);
+  }
+
+  for (uint32_t i = 0; i < count; ++i) {
+    plan.offsets[i] = blocks[blockOf[i]].offset + offsetInBlock[i];
+  }
+  return plan;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ACTIVATION_PLAN
+#define ACTIVATION_PLAN
+
+#include <cstdint>
+#include <vector>
+
+struct Layer;
+
+// Where the output of every layer lives in one arena shared by the whole
+// network. Outputs that are never needed at the same time share memory,
+// and a route whose inputs can be placed one after the other in the order
+// it concatenates them is a view of them instead of a copy.
+struct ActivationPlan {
+  // Per layer, in floats from the start of the arena, 64-byte aligned.
+  std::vector<uint64_t> offsets{};
+  // Per layer, whether it is a route that is a view of its inputs.
+  std::vector<bool> views{};
+  // Floats of the arena, and of one buffer per layer for comparison.
+  uint64_t size = 0;
+  uint64_t unplannedSize = 0;
+};
+
+// Plan from the liveness of every output: from the layer writing it to the
+// last layer reading it, which for the yolo layers is the end of the
+// network as the detections are decoded from them afterwards.
+ActivationPlan planActivations(std::vector<Layer> const &layers);
+#endif
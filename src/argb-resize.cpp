@@ -0,0 +1,1146 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "argb-resize.hpp"
+#include "thread-pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ARGB_RESIZE_X86
+#endif
+
+// First output value of row j of the image area in the red plane.
+static inline float *outputRow(float *imgDst, ResizePlan const &plan,
+    uint32_t j)
+{
+  return imgDst + (plan.yPad + j) * plan.netWidth + plan.xPad;
+}
+
+// Scale from the integer bilinear sum (two weighted passes over 8-bit
+// values) to a normalized float.
+static float const bilinearScale =
+  1.0f / (255.0f * resizeWeightOne * resizeWeightOne);
+
+// Split a source coordinate into its neighbour indices and fixed-point
+// weights. A neighbour beyond the frame keeps weight zero and reuses the
+// first index so that no lookup ever leaves the frame.
+static void planAxis(float pos, uint32_t size, int32_t &i0, int32_t &i1,
+    int32_t &w0, int32_t &w1)
+{
+  float const fl = floorf(pos);
+  int32_t const w = static_cast<int32_t>(
+      lrintf((pos - fl) * resizeWeightOne));
+  i0 = static_cast<int32_t>(fl);
+  w0 = resizeWeightOne - w;
+  w1 = w;
+  if (i0 >= static_cast<int32_t>(size)) {
+    i0 = static_cast<int32_t>(size) - 1;
+    w0 = 0;
+    w1 = 0;
+  }
+  i1 = i0 + 1;
+  if (i1 >= static_cast<int32_t>(size)) {
+    i1 = i0;
+    w1 = 0;
+  }
+}
+
+// The area block is the scale ratio rounded to whole pixels, so blocks of
+// neighbouring output pixels neither overlap much nor leave gaps. At most
+// 16 x 16 pixels are summed so that the sums fit in 16 bits.
+static uint32_t areaBlockSize(float ratio, uint32_t size)
+{
+  uint32_t n = static_cast<uint32_t>(lrintf(ratio));
+  n = n < 1 ? 1 : (n > 16 ? 16 : n);
+  return n > size ? size : n;
+}
+
+// First source index of the block centred on the span of output pixel i.
+static int32_t areaBlockStart(uint32_t i, float ratio, uint32_t block,
+    uint32_t size)
+{
+  int32_t const start = static_cast<int32_t>(
+      lrintf(i * ratio + (ratio - block) / 2.0f));
+  int32_t const last = static_cast<int32_t>(size - block);
+  return start < 0 ? 0 : (start > last ? last : start);
+}
+
+ResizePlan makeResizePlan(uint32_t wSrc, uint32_t hSrc, uint32_t wDst,
+    uint32_t hDst)
+{
+  return makeResizePlan(wSrc, hSrc, SourceRect{0, 0, wSrc, hSrc}, wDst,
+      hDst);
+}
+
+ResizePlan makeResizePlan(uint32_t wSrc, uint32_t hSrc,
+    SourceRect const &roi, uint32_t wDst, uint32_t hDst)
+{
+  ResizePlan plan;
+  plan.wSrc = wSrc;
+  plan.hSrc = hSrc;
+  plan.roi = roi;
+  plan.wDst = wDst;
+  plan.hDst = hDst;
+  plan.netWidth = wDst;
+  plan.netHeight = hDst;
+
+  // Neighbours are looked up inside the region of interest and then moved
+  // to its position in the frame.
+  float const wRatio = static_cast<float>(roi.w) / wDst;
+  float const hRatio = static_cast<float>(roi.h) / hDst;
+  int32_t const x0 = static_cast<int32_t>(roi.x);
+  int32_t const y0 = static_cast<int32_t>(roi.y);
+
+  plan.xOffset0.resize(wDst);
+  plan.xOffset1.resize(wDst);
+  plan.xWeights.resize(wDst);
+  for (uint32_t i = 0; i < wDst; ++i) {
+    int32_t w0;
+    int32_t w1;
+    planAxis(i * wRatio, roi.w, plan.xOffset0[i], plan.xOffset1[i], w0, w1);
+    plan.xOffset0[i] += x0;
+    plan.xOffset1[i] += x0;
+    plan.xWeights[i] = w0 | (w1 << 16);
+  }
+
+  plan.yOffset0.resize(hDst);
+  plan.yOffset1.resize(hDst);
+  plan.yWeight0.resize(hDst);
+  plan.yWeight1.resize(hDst);
+  for (uint32_t j = 0; j < hDst; ++j) {
+    int32_t i0;
+    int32_t i1;
+    int32_t w0;
+    int32_t w1;
+    planAxis(j * hRatio, roi.h, i0, i1, w0, w1);
+    plan.yOffset0[j] = (y0 + i0) * static_cast<int32_t>(wSrc);
+    plan.yOffset1[j] = (y0 + i1) * static_cast<int32_t>(wSrc);
+    plan.yWeight0[j] = static_cast<int16_t>(w0);
+    plan.yWeight1[j] = static_cast<int16_t>(w1);
+  }
+
+  plan.areaWidth = areaBlockSize(wRatio, roi.w);
+  plan.areaHeight = areaBlockSize(hRatio, roi.h);
+  plan.xAreaOffset.resize(wDst);
+  for (uint32_t i = 0; i < wDst; ++i) {
+    plan.xAreaOffset[i] = x0
+      + areaBlockStart(i, wRatio, plan.areaWidth, roi.w);
+  }
+  plan.yAreaOffset.resize(hDst);
+  for (uint32_t j = 0; j < hDst; ++j) {
+    plan.yAreaOffset[j] = (y0
+        + areaBlockStart(j, hRatio, plan.areaHeight, roi.h))
+      * static_cast<int32_t>(wSrc);
+  }
+  return plan;
+}
+
+ResizePlan makeLetterboxPlan(uint32_t wSrc, uint32_t hSrc,
+    uint32_t netWidth, uint32_t netHeight)
+{
+  return makeLetterboxPlan(wSrc, hSrc, SourceRect{0, 0, wSrc, hSrc},
+      netWidth, netHeight);
+}
+
+ResizePlan makeLetterboxPlan(uint32_t wSrc, uint32_t hSrc,
+    SourceRect const &roi, uint32_t netWidth, uint32_t netHeight)
+{
+  // The axis with the smaller scale fills the network input exactly, the
+  // other one is rounded to whole pixels and centred.
+  uint32_t wDst = netWidth;
+  uint32_t hDst = netHeight;
+  if (static_cast<uint64_t>(netWidth) * roi.h
+      <= static_cast<uint64_t>(netHeight) * roi.w) {
+    hDst = static_cast<uint32_t>(lrintf(
+          static_cast<float>(roi.h) * netWidth / roi.w));
+    hDst = hDst < 1 ? 1 : (hDst > netHeight ? netHeight : hDst);
+  } else {
+    wDst = static_cast<uint32_t>(lrintf(
+          static_cast<float>(roi.w) * netHeight / roi.h));
+    wDst = wDst < 1 ? 1 : (wDst > netWidth ? netWidth : wDst);
+  }
+
+  ResizePlan plan = makeResizePlan(wSrc, hSrc, roi, wDst, hDst);
+  plan.netWidth = netWidth;
+  plan.netHeight = netHeight;
+  plan.xPad = (netWidth - wDst) / 2;
+  plan.yPad = (netHeight - hDst) / 2;
+  return plan;
+}
+
+void fillLetterboxPadding(float *imgDst, ResizePlan const &plan)
+{
+  uint32_t const planeSize = plan.netWidth * plan.netHeight;
+  for (uint32_t c = 0; c < 3; ++c) {
+    float *plane = imgDst + c * planeSize;
+    for (uint32_t j = 0; j < plan.netHeight; ++j) {
+      float *row = plane + j * plan.netWidth;
+      if (j < plan.yPad || j >= plan.yPad + plan.hDst) {
+        std::fill(row, row + plan.netWidth, letterboxFill);
+        continue;
+      }
+      std::fill(row, row + plan.xPad, letterboxFill);
+      std::fill(row + plan.xPad + plan.wDst, row + plan.netWidth,
+          letterboxFill);
+    }
+  }
+}
+
+// Map one axis of a box from network input to source pixels, clipped to the
+// region of interest.
+static void projectAxis(uint32_t &pos, uint32_t &size, uint32_t pad,
+    uint32_t dst, uint32_t roiPos, uint32_t roiSize)
+{
+  float const ratio = static_cast<float>(roiSize) / dst;
+  float const lo = static_cast<float>(pos) - pad;
+  float const hi = lo + static_cast<float>(size);
+  float const maxPos = static_cast<float>(roiSize);
+  float const p0 = std::min(std::max(lo * ratio, 0.0f), maxPos);
+  float const p1 = std::min(std::max(hi * ratio, 0.0f), maxPos);
+  pos = static_cast<uint32_t>(p0);
+  size = static_cast<uint32_t>(p1) - pos;
+  pos += roiPos;
+}
+
+void projectToSource(ResizePlan const &plan, uint32_t &x, uint32_t &y,
+    uint32_t &w, uint32_t &h)
+{
+  projectAxis(x, w, plan.xPad, plan.wDst, plan.roi.x, plan.roi.w);
+  projectAxis(y, h, plan.yPad, plan.hDst, plan.roi.y, plan.roi.h);
+}
+
+// Mark the source columns and rows the given mode reads.
+static void markSampled(ResizePlan const &plan, ResizeMode mode,
+    std::vector<bool> &columns, std::vector<bool> &rows)
+{
+  columns.assign(plan.wSrc, false);
+  rows.assign(plan.hSrc, false);
+  if (mode == ResizeMode::Area) {
+    for (uint32_t i = 0; i < plan.wDst; ++i) {
+      for (uint32_t k = 0; k < plan.areaWidth; ++k) {
+        columns[static_cast<uint32_t>(plan.xAreaOffset[i]) + k] = true;
+      }
+    }
+    for (uint32_t j = 0; j < plan.hDst; ++j) {
+      uint32_t const y = static_cast<uint32_t>(plan.yAreaOffset[j])
+        / plan.wSrc;
+      for (uint32_t k = 0; k < plan.areaHeight; ++k) {
+        rows[y + k] = true;
+      }
+    }
+    return;
+  }
+
+  bool const both = (mode != ResizeMode::Nearest);
+  for (uint32_t i = 0; i < plan.wDst; ++i) {
+    columns[static_cast<uint32_t>(plan.xOffset0[i])] = true;
+    if (both) {
+      columns[static_cast<uint32_t>(plan.xOffset1[i])] = true;
+    }
+  }
+  for (uint32_t j = 0; j < plan.hDst; ++j) {
+    rows[static_cast<uint32_t>(plan.yOffset0[j]) / plan.wSrc] = true;
+    if (both) {
+      rows[static_cast<uint32_t>(plan.yOffset1[j]) / plan.wSrc] = true;
+    }
+  }
+}
+
+std::vector<RowSpan> resizeSourceRows(ResizePlan const &plan,
+    ResizeMode mode)
+{
+  std::vector<bool> columns;
+  std::vector<bool> used;
+  markSampled(plan, mode, columns, used);
+
+  std::vector<RowSpan> spans;
+  for (uint32_t y = 0; y < plan.hSrc; ++y) {
+    if (!used[y]) {
+      continue;
+    }
+    if (!spans.empty() && spans.back().begin + spans.back().count == y) {
+      spans.back().count++;
+    } else {
+      spans.push_back(RowSpan{y, 1});
+    }
+  }
+  return spans;
+}
+
+std::vector<RowSpan> mergeRowSpans(std::vector<RowSpan> const &a,
+    std::vector<RowSpan> const &b)
+{
+  std::vector<RowSpan> all(a);
+  all.insert(all.end(), b.begin(), b.end());
+  std::sort(all.begin(), all.end(), [](RowSpan const &l, RowSpan const &r) {
+      return l.begin < r.begin;
+    });
+
+  std::vector<RowSpan> spans;
+  for (auto const &span : all) {
+    if (!spans.empty()
+        && spans.back().begin + spans.back().count >= span.begin) {
+      uint32_t const end = std::max(spans.back().begin + spans.back().count,
+          span.begin + span.count);
+      spans.back().count = end - spans.back().begin;
+    } else {
+      spans.push_back(span);
+    }
+  }
+  return spans;
+}
+
+SparseFetch makeSparseFetch(ResizePlan const &plan, ResizeMode mode)
+{
+  std::vector<bool> usedColumns;
+  std::vector<bool> usedRows;
+  markSampled(plan, mode, usedColumns, usedRows);
+
+  // Gathering single pixels is slower than copying whole rows, and the
+  // cache line reads are the same, unless most columns can be skipped.
+  uint32_t sampledColumns{0};
+  for (bool used : usedColumns) {
+    sampledColumns += used ? 1 : 0;
+  }
+  if (sampledColumns * 2 > plan.wSrc) {
+    usedColumns.assign(plan.wSrc, true);
+  }
+
+  // Position of every sampled source column and row in the compact frame.
+  SparseFetch fetch;
+  std::vector<int32_t> column(plan.wSrc, -1);
+  for (uint32_t x = 0; x < plan.wSrc; ++x) {
+    if (usedColumns[x]) {
+      column[x] = static_cast<int32_t>(fetch.columns.size());
+      fetch.columns.push_back(static_cast<int32_t>(x));
+    }
+  }
+  std::vector<int32_t> row(plan.hSrc, -1);
+  for (uint32_t y = 0; y < plan.hSrc; ++y) {
+    if (usedRows[y]) {
+      row[y] = static_cast<int32_t>(fetch.rows.size());
+      fetch.rows.push_back(static_cast<int32_t>(y));
+    }
+  }
+
+  // Same weights, offsets moved into the compact frame. Columns a mode does
+  // not sample keep their (unused) original offsets clamped into range.
+  int32_t const wSrc = static_cast<int32_t>(plan.wSrc);
+  int32_t const wCompact = static_cast<int32_t>(fetch.columns.size());
+  auto compactColumn = [&column](int32_t x) {
+    return column[static_cast<uint32_t>(x)] < 0
+      ? 0 : column[static_cast<uint32_t>(x)];
+  };
+  auto compactRow = [&row, wSrc, wCompact](int32_t offset) {
+    int32_t const y = row[static_cast<uint32_t>(offset / wSrc)];
+    return (y < 0 ? 0 : y) * wCompact;
+  };
+
+  ResizePlan &compact = fetch.plan;
+  compact = plan;
+  compact.wSrc = static_cast<uint32_t>(wCompact);
+  compact.hSrc = static_cast<uint32_t>(fetch.rows.size());
+  compact.roi = SourceRect{0, 0, compact.wSrc, compact.hSrc};
+  for (uint32_t i = 0; i < plan.wDst; ++i) {
+    compact.xOffset0[i] = compactColumn(plan.xOffset0[i]);
+    compact.xOffset1[i] = compactColumn(plan.xOffset1[i]);
+    compact.xAreaOffset[i] = compactColumn(plan.xAreaOffset[i]);
+  }
+  for (uint32_t j = 0; j < plan.hDst; ++j) {
+    compact.yOffset0[j] = compactRow(plan.yOffset0[j]);
+    compact.yOffset1[j] = compactRow(plan.yOffset1[j]);
+    compact.yAreaOffset[j] = compactRow(plan.yAreaOffset[j]);
+  }
+  return fetch;
+}
+
+void gatherSparse(char const *src, char *dst, uint32_t wSrc,
+    SparseFetch const &fetch)
+{
+  uint32_t const wCompact = static_cast<uint32_t>(fetch.columns.size());
+  bool const allColumns = (wCompact == wSrc);
+  for (uint32_t j = 0; j < fetch.rows.size(); ++j) {
+    char const *row = src + static_cast<uint32_t>(fetch.rows[j]) * wSrc * 4;
+    if (allColumns) {
+      memcpy(dst + j * wCompact * 4, row, wCompact * 4);
+      continue;
+    }
+    uint32_t const *rowPixels = reinterpret_cast<uint32_t const *>(row);
+    uint32_t *out = reinterpret_cast<uint32_t *>(dst) + j * wCompact;
+    for (uint32_t i = 0; i < wCompact; ++i) {
+      out[i] = rowPixels[fetch.columns[i]];
+    }
+  }
+}
+
+// Scalar reference for the output columns [i0, i1) of row j. The SIMD
+// kernels use it for the columns left over after the last full vector.
+static void resizeRowScalar(char const *imgSrc, float *imgDst,
+    ResizePlan const &plan, bool interpolate, uint32_t j, uint32_t i0,
+    uint32_t i1)
+{
+  uint8_t const *src = reinterpret_cast<uint8_t const *>(imgSrc);
+  uint32_t const planeSize = plan.netWidth * plan.netHeight;
+  uint8_t const *row0 = src + plan.yOffset0[j] * 4;
+  float *r = outputRow(imgDst, plan, j);
+  float *g = r + planeSize;
+  float *b = g + planeSize;
+
+  if (!interpolate) {
+    float const nearestScale = 1.0f / 255.0f;
+    for (uint32_t i = i0; i < i1; ++i) {
+      uint8_t const *p = row0 + plan.xOffset0[i] * 4;
+      r[i] = p[2] * nearestScale;
+      g[i] = p[1] * nearestScale;
+      b[i] = p[0] * nearestScale;
+    }
+    return;
+  }
+
+  uint8_t const *row1 = src + plan.yOffset1[j] * 4;
+  float const wy0 = plan.yWeight0[j] * bilinearScale;
+  float const wy1 = plan.yWeight1[j] * bilinearScale;
+  for (uint32_t i = i0; i < i1; ++i) {
+    int32_t const x0 = plan.xOffset0[i] * 4;
+    int32_t const x1 = plan.xOffset1[i] * 4;
+    int32_t const wx0 = plan.xWeights[i] & 0xffff;
+    int32_t const wx1 = plan.xWeights[i] >> 16;
+    float v[3];
+    for (uint32_t c = 0; c < 3; ++c) {
+      int32_t const h0 = row0[x0 + c] * wx0 + row0[x1 + c] * wx1;
+      int32_t const h1 = row1[x0 + c] * wx0 + row1[x1 + c] * wx1;
+      v[c] = h0 * wy0 + h1 * wy1;
+    }
+    r[i] = v[2];
+    g[i] = v[1];
+    b[i] = v[0];
+  }
+}
+
+static void resizeScalar(char const *imgSrc, float *imgDst,
+    ResizePlan const &plan, bool interpolate, uint32_t rowBegin,
+    uint32_t rowEnd)
+{
+  for (uint32_t j = rowBegin; j < rowEnd; ++j) {
+    resizeRowScalar(imgSrc, imgDst, plan, interpolate, j, 0, plan.wDst);
+  }
+}
+
+// The separable resize first resamples source rows horizontally into Q8
+// values (p * resizeWeightOne, at most 65280) and then blends two such rows
+// with Q15 weights keeping the upper 16 bits of the products, which leaves
+// the pixel value scaled by 128.
+static float const separableScale = 1.0f / (255.0f * 128.0f);
+
+static uint16_t separableRowWeight(int16_t w)
+{
+  return static_cast<uint16_t>(w << (15 - resizeWeightBits));
+}
+
+static void horizontalPassScalar(uint8_t const *row, uint16_t *dst,
+    ResizePlan const &plan)
+{
+  for (uint32_t i = 0; i < plan.wDst; ++i) {
+    uint8_t const *p0 = row + plan.xOffset0[i] * 4;
+    uint8_t const *p1 = row + plan.xOffset1[i] * 4;
+    int32_t const wx0 = plan.xWeights[i] & 0xffff;
+    int32_t const wx1 = plan.xWeights[i] >> 16;
+    for (uint32_t c = 0; c < 4; ++c) {
+      dst[i * 4 + c] = static_cast<uint16_t>(p0[c] * wx0 + p1[c] * wx1);
+    }
+  }
+}
+
+static void verticalPassScalar(uint16_t const *h0, uint16_t const *h1,
+    uint16_t wy0, uint16_t wy1, float *r, float *g, float *b, uint32_t i0,
+    uint32_t i1)
+{
+  for (uint32_t i = i0; i < i1; ++i) {
+    float v[3];
+    for (uint32_t c = 0; c < 3; ++c) {
+      uint32_t const a = (static_cast<uint32_t>(h0[i * 4 + c]) * wy0) >> 16;
+      uint32_t const d = (static_cast<uint32_t>(h1[i * 4 + c]) * wy1) >> 16;
+      v[c] = (a + d) * separableScale;
+    }
+    r[i] = v[2];
+    g[i] = v[1];
+    b[i] = v[0];
+  }
+}
+
+typedef void (*HorizontalPass)(uint8_t const *, uint16_t *,
+    ResizePlan const &);
+typedef void (*VerticalPass)(uint16_t const *, uint16_t const *, uint16_t,
+    uint16_t, float *, float *, float *, uint32_t);
+
+static uint16_t const *cachedRow(char const *imgSrc, ResizePlan const &plan,
+    ResizeRowCache &cache, int32_t row, HorizontalPass pass)
+{
+  uint32_t const slot = static_cast<uint32_t>(row) & 1;
+  uint16_t *dst = cache.rows.data() + slot * plan.wDst * 4;
+  if (cache.row[slot] != row) {
+    pass(reinterpret_cast<uint8_t const *>(imgSrc) + row * plan.wSrc * 4,
+        dst, plan);
+    cache.row[slot] = row;
+  }
+  return dst;
+}
+
+static void resizeSeparable(char const *imgSrc, float *imgDst,
+    ResizePlan const &plan, ResizeRowCache &cache, uint32_t rowBegin,
+    uint32_t rowEnd, HorizontalPass hPass, VerticalPass vPass)
+{
+  cache.rows.resize(2 * plan.wDst * 4);
+  // The source frame changes between calls, nothing cached is valid.
+  cache.row[0] = -1;
+  cache.row[1] = -1;
+
+  uint32_t const planeSize = plan.netWidth * plan.netHeight;
+  int32_t const wSrc = static_cast<int32_t>(plan.wSrc);
+  for (uint32_t j = rowBegin; j < rowEnd; ++j) {
+    uint16_t const *h0 = cachedRow(imgSrc, plan, cache,
+        plan.yOffset0[j] / wSrc, hPass);
+    uint16_t const *h1 = cachedRow(imgSrc, plan, cache,
+        plan.yOffset1[j] / wSrc, hPass);
+    float *r = outputRow(imgDst, plan, j);
+    vPass(h0, h1, separableRowWeight(plan.yWeight0[j]),
+        separableRowWeight(plan.yWeight1[j]), r, r + planeSize,
+        r + 2 * planeSize, plan.wDst);
+  }
+}
+
+static void verticalPassScalarRow(uint16_t const *h0, uint16_t const *h1,
+    uint16_t wy0, uint16_t wy1, float *r, float *g, float *b, uint32_t w)
+{
+  verticalPassScalar(h0, h1, wy0, wy1, r, g, b, 0, w);
+}
+
+static void resizeSeparableScalar(char const *imgSrc, float *imgDst,
+    ResizePlan const &plan, ResizeRowCache &cache, uint32_t rowBegin,
+    uint32_t rowEnd)
+{
+  resizeSeparable(imgSrc, imgDst, plan, cache, rowBegin, rowEnd,
+      horizontalPassScalar, verticalPassScalarRow);
+}
+
+typedef void (*AreaRowSum)(uint8_t const *, uint32_t, uint32_t,
+    uint16_t *);
+typedef void (*AreaBlockSum)(uint16_t const *, ResizePlan const &, float,
+    float *, float *, float *);
+
+// Sum the block rows column by column, all four channels.
+static void areaRowSumScalar(uint8_t const *row, uint32_t stride,
+    uint32_t n, uint16_t *dst)
+{
+  for (uint32_t k = 0; k < stride; ++k) {
+    dst[k] = row[k];
+  }
+  for (uint32_t y = 1; y < n; ++y) {
+    uint8_t const *p = row + y * stride;
+    for (uint32_t k = 0; k < stride; ++k) {
+      dst[k] = static_cast<uint16_t>(dst[k] + p[k]);
+    }
+  }
+}
+
+static void areaBlockSumScalar(uint16_t const *sum, ResizePlan const &plan,
+    float scale, float *r, float *g, float *b)
+{
+  for (uint32_t i = 0; i < plan.wDst; ++i) {
+    uint16_t const *p = sum + plan.xAreaOffset[i] * 4;
+    uint32_t v[3] = {0, 0, 0};
+    for (uint32_t x = 0; x < plan.areaWidth; ++x) {
+      for (uint32_t c = 0; c < 3; ++c) {
+        v[c] += p[x * 4 + c];
+      }
+    }
+    r[i] = v[2] * scale;
+    g[i] = v[1] * scale;
+    b[i] = v[0] * scale;
+  }
+}
+
+static void resizeArea(char const *imgSrc, float *imgDst,
+    ResizePlan const &plan, ResizeRowCache &cache, uint32_t rowBegin,
+    uint32_t rowEnd, AreaRowSum rowSum, AreaBlockSum blockSum)
+{
+  uint32_t const stride = plan.wSrc * 4;
+  cache.areaRow.resize(stride);
+
+  uint8_t const *src = reinterpret_cast<uint8_t const *>(imgSrc);
+  uint32_t const planeSize = plan.netWidth * plan.netHeight;
+  float const scale = 1.0f / (255.0f * plan.areaWidth * plan.areaHeight);
+  for (uint32_t j = rowBegin; j < rowEnd; ++j) {
+    rowSum(src + plan.yAreaOffset[j] * 4, stride, plan.areaHeight,
+        cache.areaRow.data());
+    float *r = outputRow(imgDst, plan, j);
+    blockSum(cache.areaRow.data(), plan, scale, r, r + planeSize,
+        r + 2 * planeSize);
+  }
+}
+
+static void resizeAreaScalar(char const *imgSrc, float *imgDst,
+    ResizePlan const &plan, ResizeRowCache &cache, uint32_t rowBegin,
+    uint32_t rowEnd)
+{
+  resizeArea(imgSrc, imgDst, plan, cache, rowBegin, rowEnd,
+      areaRowSumScalar, areaBlockSumScalar);
+}
+
+#ifdef ARGB_RESIZE_X86
+
+__attribute__((target("sse4.1")))
+static void storeChannelsSse(__m128i p, float *r, float *g, float *b)
+{
+  __m128i const mask = _mm_set1_epi32(0xff);
+  __m128 const scale = _mm_set1_ps(1.0f / 255.0f);
+  _mm_storeu_ps(r, _mm_mul_ps(_mm_cvtepi32_ps(
+          _mm_and_si128(_mm_srli_epi32(p, 16), mask)), scale));
+  _mm_storeu_ps(g, _mm_mul_ps(_mm_cvtepi32_ps(
+          _mm_and_si128(_mm_srli_epi32(p, 8), mask)), scale));
+  _mm_storeu_ps(b, _mm_mul_ps(_mm_cvtepi32_ps(
+          _mm_and_si128(p, mask)), scale));
+}
+
+__attribute__((target("sse4.1")))
+static __m128i gatherSse(int32_t const *row, int32_t const *x)
+{
+  return _mm_setr_epi32(row[x[0]], row[x[1]], row[x[2]], row[x[3]]);
+}
+
+// One channel of a left and a right pixel as an int16 pair per lane, ready
+// for a multiply-add with the packed horizontal weights.
+__attribute__((target("sse4.1")))
+static __m128i channelPairSse(__m128i left, __m128i right, __m128i shift)
+{
+  __m128i const mask = _mm_set1_epi32(0xff);
+  return _mm_or_si128(_mm_and_si128(_mm_srl_epi32(left, shift), mask),
+      _mm_slli_epi32(_mm_and_si128(_mm_srl_epi32(right, shift), mask), 16));
+}
+
+__attribute__((target("sse4.1")))
+static __m128 blendChannelSse(__m128i p00, __m128i p01, __m128i p10,
+    __m128i p11, int32_t shift, __m128i wx, __m128 wy0, __m128 wy1)
+{
+  __m128i const s = _mm_cvtsi32_si128(shift);
+  __m128i const h0 = _mm_madd_epi16(channelPairSse(p00, p01, s), wx);
+  __m128i const h1 = _mm_madd_epi16(channelPairSse(p10, p11, s), wx);
+  return _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(h0), wy0),
+      _mm_mul_ps(_mm_cvtepi32_ps(h1), wy1));
+}
+
+__attribute__((target("sse4.1")))
+static void resizeSse41(char const *imgSrc, float *imgDst,
+    ResizePlan const &plan, bool interpolate, uint32_t rowBegin,
+    uint32_t rowEnd)
+{
+  int32_t const *src = reinterpret_cast<int32_t const *>(imgSrc);
+  uint32_t const planeSize = plan.netWidth * plan.netHeight;
+  uint32_t const wVec = plan.wDst & ~3u;
+
+  for (uint32_t j = rowBegin; j < rowEnd; ++j) {
+    int32_t const *row0 = src + plan.yOffset0[j];
+    float *r = outputRow(imgDst, plan, j);
+    float *g = r + planeSize;
+    float *b = g + planeSize;
+
+    uint32_t i = 0;
+    if (!interpolate) {
+      for (; i < wVec; i += 4) {
+        storeChannelsSse(gatherSse(row0, &plan.xOffset0[i]), r + i, g + i,
+            b + i);
+      }
+    } else {
+      int32_t const *row1 = src + plan.yOffset1[j];
+      __m128 const wy0 = _mm_set1_ps(plan.yWeight0[j] * bilinearScale);
+      __m128 const wy1 = _mm_set1_ps(plan.yWeight1[j] * bilinearScale);
+      for (; i < wVec; i += 4) {
+        int32_t const *x0 = &plan.xOffset0[i];
+        int32_t const *x1 = &plan.xOffset1[i];
+        __m128i const wx = _mm_loadu_si128(
+            reinterpret_cast<__m128i const *>(&plan.xWeights[i]));
+        __m128i const p00 = gatherSse(row0, x0);
+        __m128i const p01 = gatherSse(row0, x1);
+        __m128i const p10 = gatherSse(row1, x0);
+        __m128i const p11 = gatherSse(row1, x1);
+        _mm_storeu_ps(r + i, blendChannelSse(p00, p01, p10, p11, 16, wx,
+              wy0, wy1));
+        _mm_storeu_ps(g + i, blendChannelSse(p00, p01, p10, p11, 8, wx,
+              wy0, wy1));
+        _mm_storeu_ps(b + i, blendChannelSse(p00, p01, p10, p11, 0, wx,
+              wy0, wy1));
+      }
+    }
+    resizeRowScalar(imgSrc, imgDst, plan, interpolate, j, i, plan.wDst);
+  }
+}
+
+__attribute__((target("sse4.1")))
+static void horizontalPassSse41(uint8_t const *row, uint16_t *dst,
+    ResizePlan const &plan)
+{
+  int32_t const *src = reinterpret_cast<int32_t const *>(row);
+  // Interleave the channels of the left and right neighbour of two output
+  // pixels so that one madd per pixel applies both weights.
+  __m128i const pairs = _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13,
+      10, 14, 11, 15);
+  uint32_t i = 0;
+  for (; i + 2 <= plan.wDst; i += 2) {
+    __m128i const p = _mm_shuffle_epi8(_mm_setr_epi32(
+          src[plan.xOffset0[i]], src[plan.xOffset1[i]],
+          src[plan.xOffset0[i + 1]], src[plan.xOffset1[i + 1]]), pairs);
+    __m128i const a = _mm_madd_epi16(_mm_cvtepu8_epi16(p),
+        _mm_set1_epi32(plan.xWeights[i]));
+    __m128i const b = _mm_madd_epi16(
+        _mm_unpackhi_epi8(p, _mm_setzero_si128()),
+        _mm_set1_epi32(plan.xWeights[i + 1]));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4),
+        _mm_packus_epi32(a, b));
+  }
+  for (; i < plan.wDst; ++i) {
+    uint8_t const *p0 = row + plan.xOffset0[i] * 4;
+    uint8_t const *p1 = row + plan.xOffset1[i] * 4;
+    int32_t const wx0 = plan.xWeights[i] & 0xffff;
+    int32_t const wx1 = plan.xWeights[i] >> 16;
+    for (uint32_t c = 0; c < 4; ++c) {
+      dst[i * 4 + c] = static_cast<uint16_t>(p0[c] * wx0 + p1[c] * wx1);
+    }
+  }
+}
+
+__attribute__((target("sse4.1")))
+static void verticalPassSse41(uint16_t const *h0, uint16_t const *h1,
+    uint16_t wy0, uint16_t wy1, float *r, float *g, float *b, uint32_t w)
+{
+  __m128i const vwy0 = _mm_set1_epi16(static_cast<int16_t>(wy0));
+  __m128i const vwy1 = _mm_set1_epi16(static_cast<int16_t>(wy1));
+  __m128 const scale = _mm_set1_ps(separableScale);
+  uint32_t i = 0;
+  for (; i + 4 <= w; i += 4) {
+    __m128i const lo = _mm_add_epi16(
+        _mm_mulhi_epu16(_mm_loadu_si128(
+            reinterpret_cast<__m128i const *>(h0 + i * 4)), vwy0),
+        _mm_mulhi_epu16(_mm_loadu_si128(
+            reinterpret_cast<__m128i const *>(h1 + i * 4)), vwy1));
+    __m128i const hi = _mm_add_epi16(
+        _mm_mulhi_epu16(_mm_loadu_si128(
+            reinterpret_cast<__m128i const *>(h0 + i * 4 + 8)), vwy0),
+        _mm_mulhi_epu16(_mm_loadu_si128(
+            reinterpret_cast<__m128i const *>(h1 + i * 4 + 8)), vwy1));
+    // Four BGRA pixels, transposed into B, G, R and A rows.
+    __m128 p0 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(lo));
+    __m128 p1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, _mm_setzero_si128()));
+    __m128 p2 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(hi));
+    __m128 p3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, _mm_setzero_si128()));
+    _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+    _mm_storeu_ps(b + i, _mm_mul_ps(p0, scale));
+    _mm_storeu_ps(g + i, _mm_mul_ps(p1, scale));
+    _mm_storeu_ps(r + i, _mm_mul_ps(p2, scale));
+  }
+  verticalPassScalar(h0, h1, wy0, wy1, r, g, b, i, w);
+}
+
+__attribute__((target("sse4.1")))
+static void resizeSeparableSse41(char const *imgSrc, float *imgDst,
+    ResizePlan const &plan, ResizeRowCache &cache, uint32_t rowBegin,
+    uint32_t rowEnd)
+{
+  resizeSeparable(imgSrc, imgDst, plan, cache, rowBegin, rowEnd,
+      horizontalPassSse41, verticalPassSse41);
+}
+
+__attribute__((target("sse4.1")))
+static void areaRowSumSse41(uint8_t const *row, uint32_t stride, uint32_t n,
+    uint16_t *dst)
+{
+  uint32_t k = 0;
+  for (; k + 16 <= stride; k += 16) {
+    __m128i lo = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    for (uint32_t y = 0; y < n; ++y) {
+      __m128i const p = _mm_loadu_si128(
+          reinterpret_cast<__m128i const *>(row + y * stride + k));
+      lo = _mm_add_epi16(lo, _mm_cvtepu8_epi16(p));
+      hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(p, _mm_setzero_si128()));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + k), lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + k + 8), hi);
+  }
+  for (; k < stride; ++k) {
+    uint32_t v = 0;
+    for (uint32_t y = 0; y < n; ++y) {
+      v += row[y * stride + k];
+    }
+    dst[k] = static_cast<uint16_t>(v);
+  }
+}
+
+// Channel sums of the N pixels starting at p in the lower four lanes: two
+// pixels are added per load and the halves folded together at the end. The
+// block width is a template argument so that the loop unrolls completely.
+template <uint32_t N>
+__attribute__((target("sse4.1")))
+static __m128i areaBlockSse41(uint16_t const *p)
+{
+  __m128i acc = _mm_setzero_si128();
+  for (uint32_t x = 0; x + 2 <= N; x += 2) {
+    acc = _mm_add_epi16(acc, _mm_loadu_si128(
+          reinterpret_cast<__m128i const *>(p + x * 4)));
+  }
+  acc = _mm_add_epi16(acc, _mm_srli_si128(acc, 8));
+  if (N % 2 == 1) {
+    acc = _mm_add_epi16(acc, _mm_loadl_epi64(
+          reinterpret_cast<__m128i const *>(p + (N - 1) * 4)));
+  }
+  return acc;
+}
+
+template <uint32_t N>
+__attribute__((target("sse4.1")))
+static void areaBlockSumSse41(uint16_t const *sum, ResizePlan const &plan,
+    float scale, float *r, float *g, float *b)
+{
+  __m128 const vscale = _mm_set1_ps(scale);
+  int32_t const *x = plan.xAreaOffset.data();
+  uint32_t i = 0;
+  for (; i + 4 <= plan.wDst; i += 4) {
+    __m128i const s01 = _mm_unpacklo_epi64(
+        areaBlockSse41<N>(sum + x[i] * 4),
+        areaBlockSse41<N>(sum + x[i + 1] * 4));
+    __m128i const s23 = _mm_unpacklo_epi64(
+        areaBlockSse41<N>(sum + x[i + 2] * 4),
+        areaBlockSse41<N>(sum + x[i + 3] * 4));
+    __m128 p0 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(s01));
+    __m128 p1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(s01, _mm_setzero_si128()));
+    __m128 p2 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(s23));
+    __m128 p3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(s23, _mm_setzero_si128()));
+    _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+    _mm_storeu_ps(b + i, _mm_mul_ps(p0, vscale));
+    _mm_storeu_ps(g + i, _mm_mul_ps(p1, vscale));
+    _mm_storeu_ps(r + i, _mm_mul_ps(p2, vscale));
+  }
+  for (; i < plan.wDst; ++i) {
+    __m128i const v = _mm_cvtepu16_epi32(areaBlockSse41<N>(sum + x[i] * 4));
+    r[i] = static_cast<float>(_mm_extract_epi32(v, 2)) * scale;
+    g[i] = static_cast<float>(_mm_extract_epi32(v, 1)) * scale;
+    b[i] = static_cast<float>(_mm_extract_epi32(v, 0)) * scale;
+  }
+}
+
+// Block sums for all block widths the plan can produce (1 to 16).
+static AreaBlockSum const areaBlockSumsSse41[16] = {
+  areaBlockSumSse41<1>, areaBlockSumSse41<2>, areaBlockSumSse41<3>,
+  areaBlockSumSse41<4>, areaBlockSumSse41<5>, areaBlockSumSse41<6>,
+  areaBlockSumSse41<7>, areaBlockSumSse41<8>, areaBlockSumSse41<9>,
+  areaBlockSumSse41<10>, areaBlockSumSse41<11>, areaBlockSumSse41<12>,
+  areaBlockSumSse41<13>, areaBlockSumSse41<14>, areaBlockSumSse41<15>,
+  areaBlockSumSse41<16>
+};
+
+__attribute__((target("sse4.1")))
+static void resizeAreaSse41(char const *imgSrc, float *imgDst,
+    ResizePlan const &plan, ResizeRowCache &cache, uint32_t rowBegin,
+    uint32_t rowEnd)
+{
+  resizeArea(imgSrc, imgDst, plan, cache, rowBegin, rowEnd,
+      areaRowSumSse41, areaBlockSumsSse41[plan.areaWidth - 1]);
+}
+
+__attribute__((target("avx2")))
+static void storeChannelsAvx2(__m256i p, float *r, float *g, float *b)
+{
+  __m256i const mask = _mm256_set1_epi32(0xff);
+  __m256 const scale = _mm256_set1_ps(1.0f / 255.0f);
+  _mm256_storeu_ps(r, _mm256_mul_ps(_mm256_cvtepi32_ps(
+          _mm256_and_si256(_mm256_srli_epi32(p, 16), mask)), scale));
+  _mm256_storeu_ps(g, _mm256_mul_ps(_mm256_cvtepi32_ps(
+          _mm256_and_si256(_mm256_srli_epi32(p, 8), mask)), scale));
+  _mm256_storeu_ps(b, _mm256_mul_ps(_mm256_cvtepi32_ps(
+          _mm256_and_si256(p, mask)), scale));
+}
+
+__attribute__((target("avx2")))
+static __m256i channelPairAvx2(__m256i left, __m256i right, __m128i shift)
+{
+  __m256i const mask = _mm256_set1_epi32(0xff);
+  return _mm256_or_si256(
+      _mm256_and_si256(_mm256_srl_epi32(left, shift), mask),
+      _mm256_slli_epi32(
+        _mm256_and_si256(_mm256_srl_epi32(right, shift), mask), 16));
+}
+
+__attribute__((target("avx2")))
+static __m256 blendChannelAvx2(__m256i p00, __m256i p01, __m256i p10,
+    __m256i p11, int32_t shift, __m256i wx, __m256 wy0, __m256 wy1)
+{
+  __m128i const s = _mm_cvtsi32_si128(shift);
+  __m256i const h0 = _mm256_madd_epi16(channelPairAvx2(p00, p01, s), wx);
+  __m256i const h1 = _mm256_madd_epi16(channelPairAvx2(p10, p11, s), wx);
+  return _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(h0), wy0),
+      _mm256_mul_ps(_mm256_cvtepi32_ps(h1), wy1));
+}
+
+__attribute__((target("avx2")))
+static void resizeAvx2(char const *imgSrc, float *imgDst,
+    ResizePlan const &plan, bool interpolate, uint32_t rowBegin,
+    uint32_t rowEnd)
+{
+  int32_t const *src = reinterpret_cast<int32_t const *>(imgSrc);
+  uint32_t const planeSize = plan.netWidth * plan.netHeight;
+  uint32_t const wVec = plan.wDst & ~7u;
+
+  for (uint32_t j = rowBegin; j < rowEnd; ++j) {
+    int32_t const *row0 = src + plan.yOffset0[j];
+    float *r = outputRow(imgDst, plan, j);
+    float *g = r + planeSize;
+    float *b = g + planeSize;
+
+    uint32_t i = 0;
+    if (!interpolate) {
+      for (; i < wVec; i += 8) {
+        __m256i const x = _mm256_loadu_si256(
+            reinterpret_cast<__m256i const *>(&plan.xOffset0[i]));
+        storeChannelsAvx2(_mm256_i32gather_epi32(row0, x, 4), r + i, g + i,
+            b + i);
+      }
+    } else {
+      int32_t const *row1 = src + plan.yOffset1[j];
+      __m256 const wy0 = _mm256_set1_ps(plan.yWeight0[j] * bilinearScale);
+      __m256 const wy1 = _mm256_set1_ps(plan.yWeight1[j] * bilinearScale);
+      for (; i < wVec; i += 8) {
+        __m256i const x0 = _mm256_loadu_si256(
+            reinterpret_cast<__m256i const *>(&plan.xOffset0[i]));
+        __m256i const x1 = _mm256_loadu_si256(
+            reinterpret_cast<__m256i const *>(&plan.xOffset1[i]));
+        __m256i const wx = _mm256_loadu_si256(
+            reinterpret_cast<__m256i const *>(&plan.xWeights[i]));
+        __m256i const p00 = _mm256_i32gather_epi32(row0, x0, 4);
+        __m256i const p01 = _mm256_i32gather_epi32(row0, x1, 4);
+        __m256i const p10 = _mm256_i32gather_epi32(row1, x0, 4);
+        __m256i const p11 = _mm256_i32gather_epi32(row1, x1, 4);
+        _mm256_storeu_ps(r + i, blendChannelAvx2(p00, p01, p10, p11, 16, wx,
+              wy0, wy1));
+        _mm256_storeu_ps(g + i, blendChannelAvx2(p00, p01, p10, p11, 8, wx,
+              wy0, wy1));
+        _mm256_storeu_ps(b + i, blendChannelAvx2(p00, p01, p10, p11, 0, wx,
+              wy0, wy1));
+      }
+    }
+    resizeRowScalar(imgSrc, imgDst, plan, interpolate, j, i, plan.wDst);
+  }
+}
+__attribute__((target("avx2")))
+static void horizontalPassAvx2(uint8_t const *row, uint16_t *dst,
+    ResizePlan const &plan)
+{
+  int32_t const *src = reinterpret_cast<int32_t const *>(row);
+  __m256i const pairs = _mm256_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9,
+      13, 10, 14, 11, 15, 0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11,
+      15);
+  __m256i const zero = _mm256_setzero_si256();
+  uint32_t i = 0;
+  for (; i + 8 <= plan.wDst; i += 8) {
+    __m256i const p0 = _mm256_i32gather_epi32(src, _mm256_loadu_si256(
+          reinterpret_cast<__m256i const *>(&plan.xOffset0[i])), 4);
+    __m256i const p1 = _mm256_i32gather_epi32(src, _mm256_loadu_si256(
+          reinterpret_cast<__m256i const *>(&plan.xOffset1[i])), 4);
+    __m256i const w = _mm256_loadu_si256(
+        reinterpret_cast<__m256i const *>(&plan.xWeights[i]));
+    // Per 128-bit lane: pixels (i, i + 1) and (i + 2, i + 3) in the lower,
+    // (i + 4, i + 5) and (i + 6, i + 7) in the upper lane.
+    __m256i const q01 = _mm256_shuffle_epi8(_mm256_unpacklo_epi32(p0, p1),
+        pairs);
+    __m256i const q23 = _mm256_shuffle_epi8(_mm256_unpackhi_epi32(p0, p1),
+        pairs);
+    __m256i const a = _mm256_madd_epi16(_mm256_unpacklo_epi8(q01, zero),
+        _mm256_permutevar8x32_epi32(w,
+          _mm256_setr_epi32(0, 0, 0, 0, 4, 4, 4, 4)));
+    __m256i const b = _mm256_madd_epi16(_mm256_unpackhi_epi8(q01, zero),
+        _mm256_permutevar8x32_epi32(w,
+          _mm256_setr_epi32(1, 1, 1, 1, 5, 5, 5, 5)));
+    __m256i const c = _mm256_madd_epi16(_mm256_unpacklo_epi8(q23, zero),
+        _mm256_permutevar8x32_epi32(w,
+          _mm256_setr_epi32(2, 2, 2, 2, 6, 6, 6, 6)));
+    __m256i const d = _mm256_madd_epi16(_mm256_unpackhi_epi8(q23, zero),
+        _mm256_permutevar8x32_epi32(w,
+          _mm256_setr_epi32(3, 3, 3, 3, 7, 7, 7, 7)));
+    __m256i const ab = _mm256_packus_epi32(a, b);
+    __m256i const cd = _mm256_packus_epi32(c, d);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 4),
+        _mm256_permute2x128_si256(ab, cd, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 4 + 16),
+        _mm256_permute2x128_si256(ab, cd, 0x31));
+  }
+  for (; i < plan.wDst; ++i) {
+    uint8_t const *q0 = row + plan.xOffset0[i] * 4;
+    uint8_t const *q1 = row + plan.xOffset1[i] * 4;
+    int32_t const wx0 = plan.xWeights[i] & 0xffff;
+    int32_t const wx1 = plan.xWeights[i] >> 16;
+    for (uint32_t ch = 0; ch < 4; ++ch) {
+      dst[i * 4 + ch] = static_cast<uint16_t>(q0[ch] * wx0 + q1[ch] * wx1);
+    }
+  }
+}
+
+__attribute__((target("avx2")))
+static void resizeSeparableAvx2(char const *imgSrc, float *imgDst,
+    ResizePlan const &plan, ResizeRowCache &cache, uint32_t rowBegin,
+    uint32_t rowEnd)
+{
+  resizeSeparable(imgSrc, imgDst, plan, cache, rowBegin, rowEnd,
+      horizontalPassAvx2, verticalPassSse41);
+}
+__attribute__((target("avx2")))
+static void areaRowSumAvx2(uint8_t const *row, uint32_t stride, uint32_t n,
+    uint16_t *dst)
+{
+  uint32_t k = 0;
+  for (; k + 32 <= stride; k += 32) {
+    __m256i lo = _mm256_setzero_si256();
+    __m256i hi = _mm256_setzero_si256();
+    for (uint32_t y = 0; y < n; ++y) {
+      uint8_t const *p = row + y * stride + k;
+      lo = _mm256_add_epi16(lo, _mm256_cvtepu8_epi16(
+            _mm_loadu_si128(reinterpret_cast<__m128i const *>(p))));
+      hi = _mm256_add_epi16(hi, _mm256_cvtepu8_epi16(
+            _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + 16))));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + k), lo);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + k + 16), hi);
+  }
+  for (; k < stride; ++k) {
+    uint32_t v = 0;
+    for (uint32_t y = 0; y < n; ++y) {
+      v += row[y * stride + k];
+    }
+    dst[k] = static_cast<uint16_t>(v);
+  }
+}
+
+__attribute__((target("avx2")))
+static void resizeAreaAvx2(char const *imgSrc, float *imgDst,
+    ResizePlan const &plan, ResizeRowCache &cache, uint32_t rowBegin,
+    uint32_t rowEnd)
+{
+  resizeArea(imgSrc, imgDst, plan, cache, rowBegin, rowEnd,
+      areaRowSumAvx2, areaBlockSumsSse41[plan.areaWidth - 1]);
+}
+#endif
+
+typedef void (*ResizeKernel)(char const *, float *, ResizePlan const &,
+    bool, uint32_t, uint32_t);
+typedef void (*CachedResizeKernel)(char const *, float *,
+    ResizePlan const &, ResizeRowCache &, uint32_t, uint32_t);
+
+struct ResizeKernelEntry {
+  ResizeKernel kernel;
+  CachedResizeKernel separable;
+  CachedResizeKernel area;
+  char const *name;
+};
+
+static ResizeKernelEntry const &selectResizeKernel()
+{
+  static ResizeKernelEntry const entry = []() {
+#ifdef ARGB_RESIZE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return ResizeKernelEntry{resizeAvx2, resizeSeparableAvx2,
+        resizeAreaAvx2, "avx2"};
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+      return ResizeKernelEntry{resizeSse41, resizeSeparableSse41,
+        resizeAreaSse41, "sse4.1"};
+    }
+#endif
+    return ResizeKernelEntry{resizeScalar, resizeSeparableScalar,
+      resizeAreaScalar, "scalar"};
+  }();
+  return entry;
+}
+
+bool parseResizeMode(std::string const &name, ResizeMode &mode)
+{
+  if (name == "nearest") {
+    mode = ResizeMode::Nearest;
+  } else if (name == "bilinear") {
+    mode = ResizeMode::Bilinear;
+  } else if (name == "separable") {
+    mode = ResizeMode::Separable;
+  } else if (name == "area") {
+    mode = ResizeMode::Area;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+char const *resizeModeName(ResizeMode mode)
+{
+  switch (mode) {
+    case ResizeMode::Nearest:
+      return "nearest";
+    case ResizeMode::Bilinear:
+      return "bilinear";
+    case ResizeMode::Separable:
+      return "separable";
+    case ResizeMode::Area:
+      return "area";
+  }
+  return "unknown";
+}
+
+void resizeArgbToYoloImg(char const *imgSrc, float *imgDst,
+    ResizePlan const &plan, ResizeMode mode, ResizeRowCache &cache,
+    uint32_t rowBegin, uint32_t rowEnd)
+{
+  ResizeKernelEntry const &entry = selectResizeKernel();
+  if (mode == ResizeMode::Separable) {
+    entry.separable(imgSrc, imgDst, plan, cache, rowBegin, rowEnd);
+  } else if (mode == ResizeMode::Area) {
+    entry.area(imgSrc, imgDst, plan, cache, rowBegin, rowEnd);
+  } else {
+    entry.kernel(imgSrc, imgDst, plan, mode == ResizeMode::Bilinear,
+        rowBegin, rowEnd);
+  }
+}
+
+void resizeArgbToYoloImg(char const *imgSrc, float *imgDst,
+    ResizePlan const &plan, ResizeMode mode, ThreadPool &pool,
+    std::vector<ResizeRowCache> &caches)
+{
+  // A few tiles per thread so that a slow thread does not hold up the rest.
+  uint32_t const threads = pool.threadCount();
+  uint32_t tiles = threads == 1 ? 1 : threads * 4;
+  tiles = tiles > plan.hDst ? plan.hDst : tiles;
+  caches.resize(threads);
+  pool.run(tiles, [&](uint32_t tile, uint32_t thread) {
+      uint32_t const rowBegin = plan.hDst * tile / tiles;
+      uint32_t const rowEnd = plan.hDst * (tile + 1) / tiles;
+      resizeArgbToYoloImg(imgSrc, imgDst, plan, mode, caches[thread],
+          rowBegin, rowEnd);
+    });
+}
+
+char const *resizeKernelName()
+{
+  return selectResizeKernel().name;
+}
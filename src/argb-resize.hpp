@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARGB_RESIZE
+#define ARGB_RESIZE
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Fixed-point scale of the bilinear weights in a ResizePlan.
+const int32_t resizeWeightBits = 8;
+const int32_t resizeWeightOne = 1 << resizeWeightBits;
+
+// Value of the letterbox padding, the grey darknet pads with.
+const float letterboxFill = 0.5f;
+
+// A sub-rectangle of the source frame.
+struct SourceRect {
+  uint32_t x = 0;
+  uint32_t y = 0;
+  uint32_t w = 0;
+  uint32_t h = 0;
+};
+
+// Source offsets and fixed-point bilinear weights for one resize geometry.
+// The tables only depend on the frame and network sizes, so the plan is
+// built once and every frame is resized with pure table lookups. Neighbours
+// outside the source frame get weight zero, which matches the black border
+// extension of the original per-pixel code. Only the region of interest of
+// the source frame is resized; the offsets still address the whole frame.
+struct ResizePlan {
+  uint32_t wSrc = 0;
+  uint32_t hSrc = 0;
+  SourceRect roi{};
+  uint32_t wDst = 0;
+  uint32_t hDst = 0;
+  // Source column of the left/nearest and the right neighbour.
+  std::vector<int32_t> xOffset0{};
+  std::vector<int32_t> xOffset1{};
+  // Left weight in the low and right weight in the high 16 bits.
+  std::vector<int32_t> xWeights{};
+  // Pixel offset of the upper/nearest and the lower source row.
+  std::vector<int32_t> yOffset0{};
+  std::vector<int32_t> yOffset1{};
+  std::vector<int16_t> yWeight0{};
+  std::vector<int16_t> yWeight1{};
+  // Block size of the area mode, the rounded scale ratio per axis, and the
+  // first source column and pixel offset of the first source row per block.
+  uint32_t areaWidth = 1;
+  uint32_t areaHeight = 1;
+  std::vector<int32_t> xAreaOffset{};
+  std::vector<int32_t> yAreaOffset{};
+  // Size of the network input and the top-left corner of the wDst x hDst
+  // image area in it. Without letterboxing the image area is all of it.
+  uint32_t netWidth = 0;
+  uint32_t netHeight = 0;
+  uint32_t xPad = 0;
+  uint32_t yPad = 0;
+};
+
+// Build the tables for resizing wSrc x hSrc, or the region of interest of
+// it, into wDst x hDst.
+ResizePlan makeResizePlan(uint32_t wSrc, uint32_t hSrc, uint32_t wDst,
+    uint32_t hDst);
+ResizePlan makeResizePlan(uint32_t wSrc, uint32_t hSrc,
+    SourceRect const &roi, uint32_t wDst, uint32_t hDst);
+
+// Build the tables for resizing wSrc x hSrc, or the region of interest of
+// it, into netWidth x netHeight keeping the aspect ratio. The image area is
+// centred and the rest of the network input is padding that no resize
+// writes to.
+ResizePlan makeLetterboxPlan(uint32_t wSrc, uint32_t hSrc,
+    uint32_t netWidth, uint32_t netHeight);
+ResizePlan makeLetterboxPlan(uint32_t wSrc, uint32_t hSrc,
+    SourceRect const &roi, uint32_t netWidth, uint32_t netHeight);
+
+// Fill the padding around the image area of a letterbox plan. The padding
+// never changes, so this is done once per network input buffer and plan.
+void fillLetterboxPadding(float *imgDst, ResizePlan const &plan);
+
+// Map a box (top-left corner and size) in network input pixels back to
+// source frame pixels, clipped to the region of interest.
+void projectToSource(ResizePlan const &plan, uint32_t &x, uint32_t &y,
+    uint32_t &w, uint32_t &h);
+
+enum class ResizeMode {
+  Nearest,
+  Bilinear,
+  // Bilinear as a horizontal and a vertical 16-bit fixed-point pass.
+  Separable,
+  // Mean over a fixed block of source pixels per output pixel.
+  Area
+};
+
+// Parse a --resize value (nearest, bilinear, separable or area).
+bool parseResizeMode(std::string const &name, ResizeMode &mode);
+
+char const *resizeModeName(ResizeMode mode);
+
+// Source rows after the horizontal pass of the separable resize, stored as
+// interleaved BGRA in 16-bit fixed point. Two slots are enough since an
+// output row only needs two neighbouring source rows; row r lives in slot
+// r % 2, so consecutive output rows sharing a source row reuse it. The area
+// mode sums its block rows into areaRow, one 16-bit value per channel.
+struct ResizeRowCache {
+  std::vector<uint16_t> rows{};
+  int32_t row[2] = {-1, -1};
+  std::vector<uint16_t> areaRow{};
+};
+
+// A run of consecutive source rows.
+struct RowSpan {
+  uint32_t begin;
+  uint32_t count;
+};
+
+// The source rows the given mode reads, as sorted, non-overlapping runs.
+std::vector<RowSpan> resizeSourceRows(ResizePlan const &plan,
+    ResizeMode mode);
+
+// The rows of both span lists, again as sorted, non-overlapping runs.
+std::vector<RowSpan> mergeRowSpans(std::vector<RowSpan> const &a,
+    std::vector<RowSpan> const &b);
+
+// The source columns and rows a resize mode samples, and a plan that
+// resizes the compact frame holding only those pixels (columns.size() x
+// rows.size()) exactly like the original plan resizes the full frame.
+struct SparseFetch {
+  std::vector<int32_t> columns{};
+  std::vector<int32_t> rows{};
+  ResizePlan plan{};
+};
+
+SparseFetch makeSparseFetch(ResizePlan const &plan, ResizeMode mode);
+
+// Copy the sampled pixels of a wSrc wide ARGB frame into the compact frame.
+void gatherSparse(char const *src, char *dst, uint32_t wSrc,
+    SparseFetch const &fetch);
+
+class ThreadPool;
+
+// Resize the output rows [rowBegin, rowEnd) of an ARGB frame (stored as B,
+// G, R, A bytes) into the planar RGB layout, normalized to [0, 1], that Yolo
+// expects. The kernel is picked once at runtime: AVX2, SSE4.1 or the scalar
+// reference implementation. The row cache is only used by the separable and
+// area modes.
+void resizeArgbToYoloImg(char const *imgSrc, float *imgDst,
+    ResizePlan const &plan, ResizeMode mode, ResizeRowCache &cache,
+    uint32_t rowBegin, uint32_t rowEnd);
+
+// Resize the whole frame in row tiles spread over the thread pool, with one
+// row cache per pool thread.
+void resizeArgbToYoloImg(char const *imgSrc, float *imgDst,
+    ResizePlan const &plan, ResizeMode mode, ThreadPool &pool,
+    std::vector<ResizeRowCache> &caches);
+
+// Name of the resize kernel selected for this CPU.
+char const *resizeKernelName();
+#endif
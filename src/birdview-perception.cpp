@@ -16,6 +16,8 @@
  */
 
 #include "birdview-perception.hpp"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 //Define intrinsic camera parameters inside matrix (left/right)
@@ -136,6 +138,7 @@ cameraPara setupCameraPara(uint32_t height, uint32_t camera){
     }
   camPara.focLength_pix = (*mtx)[0][0];
   camPara.cx = (*mtx)[0][2];
+  camPara.cy = (*mtx)[1][2];
   camPara.sensHeight_pix = height;
   camPara.focLength_mm = camPara.focLength_pix * pixelSize_mm;
   camPara.sensHeight_mm = camPara.sensHeight_pix * pixelSize_mm;
@@ -143,6 +146,24 @@ cameraPara setupCameraPara(uint32_t height, uint32_t camera){
   return camPara;
 }
 
+uint32_t horizonRow(cameraPara const &camPara, double minDistance_m)
+{
+  // Tallest cone, the big orange one.
+  double const coneHeight_m = 0.505;
+  // Angle of the highest visible cone top below the optical axis. Cone tops
+  // lower than the camera approach the horizon with distance, taller ones
+  // are highest when closest.
+  double const drop_m = camPara.height_m - coneHeight_m;
+  double const angle = (drop_m < 0.0 ? std::atan2(drop_m, minDistance_m) : 0.0)
+    - camPara.pitch_rad;
+  double const row = camPara.cy + camPara.focLength_pix * std::tan(angle);
+  if (row <= 0.0) {
+    return 0;
+  }
+  return static_cast<uint32_t>(
+      std::min(row, camPara.sensHeight_pix - 1.0));
+}
+
 opendlv::logic::perception::ObjectPosition getDistance(cameraPara camPara, bboxConf_t &detection, bool verbose)
 {
 
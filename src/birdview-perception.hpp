@@ -25,7 +25,7 @@ const float depthDistanceThreshold = 4;
 
 #include "cluon-complete.hpp"
 #include "opendlv-standard-message-set.hpp"
-#include <yolo_v2_class.hpp>
+#include "yolo-types.hpp"
 
 #include <iostream>
 
@@ -38,14 +38,24 @@ struct cameraPara {
   double focLength_mm = 0.0;
   double sensHeight_mm = 0.0;
   double cx = 0.0;
+  double cy = 0.0;
   double focLength_pix = 0.0;
   double sensHeight_pix = 0.0;
   double framewidth_mm = 0.0;
+  // Mounting above the ground and downward tilt, only used to find the
+  // horizon.
+  double height_m = 0.0;
+  double pitch_rad = 0.0;
 };
 
 // Set up camera parameters
 cameraPara setupCameraPara(uint32_t height, uint32_t camera);
 
+// First image row that can show a cone standing on flat ground at least
+// minDistance_m in front of the camera, i.e. the horizon, or above it if
+// the tallest cone reaches over the camera.
+uint32_t horizonRow(cameraPara const &camPara, double minDistance_m);
+
 // Calculate conde distance by hight of cone in frame
 opendlv::logic::perception::ObjectPosition getDistance(cameraPara camPara, bboxConf_t &detection, bool verbose = false);
 #endif
@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "box-propagator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+// Spread of a detected box edge as a share of the box height, on top of a
+// pixel.
+static float const boxNoise = 0.05f;
+// Spread of the acceleration of the box centre and of its size, and of
+// the speed of a new track, in box heights per s^2 and per s.
+static float const centreAcceleration = 1.0f;
+static float const sizeAcceleration = 0.5f;
+static float const initialSpeed = 2.0f;
+// Samples per side of a patch, and the largest search radius and predicted
+// shift searched in network input pixels.
+static uint32_t const patchSide = 12;
+static int32_t const maxSearch = 8;
+static int32_t const maxShift = 32;
+// Spread of an aligned centre in network input pixels.
+static float const alignNoise = 1.0f;
+// Largest share of the mean patch difference over the search window the
+// best match may have, so that flat patches are not aligned.
+static float const alignContrast = 0.7f;
+
+static float edgeNoise(float h)
+{
+  float const sigma = 1.0f + boxNoise * std::max(h, 1.0f);
+  return sigma * sigma;
+}
+
+// Move the state dt seconds ahead under white-noise acceleration of the
+// spectral density q.
+static void predictAxis(float &x, float &v, float &pxx, float &pxv,
+    float &pvv, float dt, float q)
+{
+  x += v * dt;
+  pxx += dt * (2.0f * pxv + dt * pvv) + q * dt * dt * dt / 3.0f;
+  pxv += dt * pvv + q * dt * dt / 2.0f;
+  pvv += q * dt;
+}
+
+static void correctAxis(float &x, float &v, float &pxx, float &pxv,
+    float &pvv, float z, float r)
+{
+  float const s = pxx + r;
+  float const kx = pxx / s;
+  float const kv = pxv / s;
+  float const residual = z - x;
+  x += kx * residual;
+  v += kv * residual;
+  pvv -= kv * pxv;
+  pxv *= 1.0f - kx;
+  pxx *= 1.0f - kx;
+}
+
+BoxPropagator::BoxPropagator(uint32_t width, uint32_t height,
+    ResizePlan const *alignPlan):
+  m_width(width),
+  m_height(height),
+  m_alignPlan(alignPlan)
+{
+}
+
+void BoxPropagator::advance(Track &track, int64_t timeUs) const
+{
+  float const dt = std::max(0.0f,
+      static_cast<float>(timeUs - track.timeUs) * 1.0e-6f);
+  track.timeUs = timeUs;
+  if (dt <= 0.0f) {
+    return;
+  }
+  float const h = std::max(track.h.x, 1.0f);
+  float const qCentre = centreAcceleration * centreAcceleration * h * h;
+  float const qSize = sizeAcceleration * sizeAcceleration * h * h;
+  for (Axis *a : {&track.cx, &track.cy}) {
+    predictAxis(a->x, a->v, a->pxx, a->pxv, a->pvv, dt, qCentre);
+  }
+  for (Axis *a : {&track.w, &track.h}) {
+    predictAxis(a->x, a->v, a->pxx, a->pxv, a->pvv, dt, qSize);
+  }
+}
+
+void BoxPropagator::correct(std::vector<bbox_t> const &boxes,
+    int64_t timeUs, float const *image)
+{
+  std::vector<Track> tracks;
+  tracks.reserve(boxes.size());
+  std::vector<bool> matched(m_tracks.size(), false);
+  for (auto const &box : boxes) {
+    float const w = static_cast<float>(box.w);
+    float const h = static_cast<float>(box.h);
+    float const cx = static_cast<float>(box.x) + w / 2.0f;
+    float const cy = static_cast<float>(box.y) + h / 2.0f;
+    float const r = edgeNoise(h);
+
+    size_t i = 0;
+    while (i < m_tracks.size() && (matched[i] || box.track_id == 0
+          || m_tracks[i].box.obj_id != box.obj_id
+          || m_tracks[i].box.track_id != box.track_id)) {
+      ++i;
+    }
+    Track track{};
+    if (i < m_tracks.size()) {
+      matched[i] = true;
+      track = std::move(m_tracks[i]);
+      advance(track, timeUs);
+      correctAxis(track.cx.x, track.cx.v, track.cx.pxx, track.cx.pxv,
+          track.cx.pvv, cx, r);
+      correctAxis(track.cy.x, track.cy.v, track.cy.pxx, track.cy.pxv,
+          track.cy.pvv, cy, r);
+      correctAxis(track.w.x, track.w.v, track.w.pxx, track.w.pxv,
+          track.w.pvv, w, r);
+      correctAxis(track.h.x, track.h.v, track.h.pxx, track.h.pxv,
+          track.h.pvv, h, r);
+    } else {
+      float const speed = initialSpeed * std::max(h, 1.0f);
+      track.cx = Axis{cx, 0.0f, r, 0.0f, speed * speed};
+      track.cy = Axis{cy, 0.0f, r, 0.0f, speed * speed};
+      track.w = Axis{w, 0.0f, r, 0.0f, speed * speed};
+      track.h = Axis{h, 0.0f, r, 0.0f, speed * speed};
+      track.timeUs = timeUs;
+    }
+    track.box = box;
+    track.patch.clear();
+    if (m_alignPlan != nullptr && image != nullptr) {
+      samplePatch(track, image);
+    }
+    tracks.push_back(std::move(track));
+  }
+  m_tracks.swap(tracks);
+}
+
+std::vector<bbox_t> BoxPropagator::predict(int64_t timeUs,
+    float const *image)
+{
+  std::vector<bbox_t> boxes;
+  boxes.reserve(m_tracks.size());
+  for (auto &track : m_tracks) {
+    advance(track, timeUs);
+    float cx{0.0f};
+    float cy{0.0f};
+    if (image != nullptr && !track.patch.empty()
+        && align(track, image, cx, cy)) {
+      float const sigmaX = alignNoise * static_cast<float>(
+          m_alignPlan->roi.w) / static_cast<float>(m_alignPlan->wDst);
+      float const sigmaY = alignNoise * static_cast<float>(
+          m_alignPlan->roi.h) / static_cast<float>(m_alignPlan->hDst);
+      correctAxis(track.cx.x, track.cx.v, track.cx.pxx, track.cx.pxv,
+          track.cx.pvv, cx, sigmaX * sigmaX);
+      correctAxis(track.cy.x, track.cy.v, track.cy.pxx, track.cy.pxv,
+          track.cy.pvv, cy, sigmaY * sigmaY);
+    }
+
+    float const w = std::max(track.w.x, 1.0f);
+    float const h = std::max(track.h.x, 1.0f);
+    float const maxX = static_cast<float>(m_width - 1);
+    float const maxY = static_cast<float>(m_height - 1);
+    float const x0 = std::min(std::max(track.cx.x - w / 2.0f, 0.0f), maxX);
+    float const y0 = std::min(std::max(track.cy.x - h / 2.0f, 0.0f), maxY);
+    float const x1 = std::min(std::max(track.cx.x + w / 2.0f, x0 + 1.0f),
+        maxX + 1.0f);
+    float const y1 = std::min(std::max(track.cy.x + h / 2.0f, y0 + 1.0f),
+        maxY + 1.0f);
+    bbox_t box = track.box;
+    box.x = static_cast<unsigned int>(x0);
+    box.y = static_cast<unsigned int>(y0);
+    box.w = static_cast<unsigned int>(std::max(x1 - x0, 1.0f));
+    box.h = static_cast<unsigned int>(std::max(y1 - y0, 1.0f));
+    boxes.push_back(box);
+  }
+  return boxes;
+}
+
+// Mean of the colour planes of the network input at a pixel, clamped to it.
+static float luma(float const *image, ResizePlan const &plan, int32_t x,
+    int32_t y)
+{
+  int32_t const w = static_cast<int32_t>(plan.netWidth);
+  int32_t const h = static_cast<int32_t>(plan.netHeight);
+  size_t const plane = static_cast<size_t>(w) * static_cast<size_t>(h);
+  size_t const i = static_cast<size_t>(std::min(std::max(y, 0), h - 1) * w
+      + std::min(std::max(x, 0), w - 1));
+  return (image[i] + image[i + plane] + image[i + 2 * plane]) / 3.0f;
+}
+
+static float patchOffset(uint32_t i, float size)
+{
+  return ((static_cast<float>(i) + 0.5f) / patchSide - 0.5f) * size;
+}
+
+void BoxPropagator::samplePatch(Track &track, float const *image) const
+{
+  ResizePlan const &plan = *m_alignPlan;
+  float const sx = static_cast<float>(plan.wDst)
+    / static_cast<float>(plan.roi.w);
+  float const sy = static_cast<float>(plan.hDst)
+    / static_cast<float>(plan.roi.h);
+  track.netW = static_cast<float>(track.box.w) * sx;
+  track.netH = static_cast<float>(track.box.h) * sy;
+  track.netCx = static_cast<float>(plan.xPad) + (static_cast<float>(
+        track.box.x) - static_cast<float>(plan.roi.x)) * sx + track.netW / 2;
+  track.netCy = static_cast<float>(plan.yPad) + (static_cast<float>(
+        track.box.y) - static_cast<float>(plan.roi.y)) * sy + track.netH / 2;
+  track.patch.resize(patchSide * patchSide);
+  for (uint32_t j = 0; j < patchSide; ++j) {
+    int32_t const y = static_cast<int32_t>(std::floor(
+          track.netCy + patchOffset(j, track.netH)));
+    for (uint32_t i = 0; i < patchSide; ++i) {
+      int32_t const x = static_cast<int32_t>(std::floor(
+            track.netCx + patchOffset(i, track.netW)));
+      track.patch[j * patchSide + i] = luma(image, plan, x, y);
+    }
+  }
+}
+
+// Search the network input from the detected to around the predicted
+// centre, so that a stop or turn since the detection is found too, for the
+// shift of the detected patch that differs least from it, and give the
+// centre it puts the box at in frame pixels.
+bool BoxPropagator::align(Track const &track, float const *image,
+    float &cx, float &cy) const
+{
+  ResizePlan const &plan = *m_alignPlan;
+  float const sx = static_cast<float>(plan.wDst)
+    / static_cast<float>(plan.roi.w);
+  float const sy = static_cast<float>(plan.hDst)
+    / static_cast<float>(plan.roi.h);
+  auto toNet = [](float v, float origin, uint32_t pad, float scale) {
+    return static_cast<float>(pad) + (v - origin) * scale;
+  };
+  float const predX = toNet(track.cx.x, static_cast<float>(plan.roi.x),
+      plan.xPad, sx);
+  float const predY = toNet(track.cy.x, static_cast<float>(plan.roi.y),
+      plan.yPad, sy);
+  if (!std::isfinite(predX) || !std::isfinite(predY)) {
+    return false;
+  }
+  float const limit = static_cast<float>(maxShift);
+  int32_t const shiftX = static_cast<int32_t>(std::lround(
+        std::min(std::max(predX - track.netCx, -limit), limit)));
+  int32_t const shiftY = static_cast<int32_t>(std::lround(
+        std::min(std::max(predY - track.netCy, -limit), limit)));
+  int32_t const radius = std::min(maxSearch, std::max(1,
+        static_cast<int32_t>(0.3f * std::max(track.netW, track.netH))));
+
+  int32_t xs[patchSide];
+  int32_t ys[patchSide];
+  for (uint32_t i = 0; i < patchSide; ++i) {
+    xs[i] = static_cast<int32_t>(std::floor(
+          track.netCx + patchOffset(i, track.netW)));
+    ys[i] = static_cast<int32_t>(std::floor(
+          track.netCy + patchOffset(i, track.netH)));
+  }
+  float best{INFINITY};
+  float total{0.0f};
+  uint32_t count{0};
+  int32_t bestX{shiftX};
+  int32_t bestY{shiftY};
+  for (int32_t dy = std::min(shiftY, 0) - radius;
+      dy <= std::max(shiftY, 0) + radius; ++dy) {
+    for (int32_t dx = std::min(shiftX, 0) - radius;
+        dx <= std::max(shiftX, 0) + radius; ++dx) {
+      float sad{0.0f};
+      for (uint32_t j = 0; j < patchSide; ++j) {
+        for (uint32_t i = 0; i < patchSide; ++i) {
+          sad += std::fabs(luma(image, plan, xs[i] + dx, ys[j] + dy)
+              - track.patch[j * patchSide + i]);
+        }
+      }
+      total += sad;
+      count++;
+      if (sad < best) {
+        best = sad;
+        bestX = dx;
+        bestY = dy;
+      }
+    }
+  }
+  if (!(best < alignContrast * total / static_cast<float>(count))) {
+    return false;
+  }
+  cx = static_cast<float>(plan.roi.x)
+    + (track.netCx + static_cast<float>(bestX)
+        - static_cast<float>(plan.xPad)) / sx;
+  cy = static_cast<float>(plan.roi.y)
+    + (track.netCy + static_cast<float>(bestY)
+        - static_cast<float>(plan.yPad)) / sy;
+  return true;
+}
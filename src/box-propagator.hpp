@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BOX_PROPAGATOR
+#define BOX_PROPAGATOR
+
+#include "argb-resize.hpp"
+#include "yolo-types.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Carries the tracked boxes of a detector run over the frames until the
+// next one, with a constant-velocity Kalman filter per track on the centre
+// and size of its box. Tracks are told apart by class and track id. With
+// alignment the predicted centre of a box is also corrected by matching
+// the patch of the network input it was detected in against the network
+// input of the frame at hand.
+class BoxPropagator {
+ public:
+  // Boxes are in pixels of a width x height frame. The frame is resized
+  // into the network input by alignPlan, if aligning, which must outlive
+  // the propagator.
+  BoxPropagator(uint32_t width, uint32_t height,
+      ResizePlan const *alignPlan);
+  BoxPropagator(BoxPropagator const &) = delete;
+  BoxPropagator &operator=(BoxPropagator const &) = delete;
+
+  // Correct the tracks with the boxes of a frame sampled at timeUs, and
+  // drop those that are no longer detected. image is the network input of
+  // the frame, only used when aligning.
+  void correct(std::vector<bbox_t> const &boxes, int64_t timeUs,
+      float const *image);
+
+  // The boxes of the tracks predicted to a frame sampled at timeUs, and
+  // aligned in its network input if given.
+  std::vector<bbox_t> predict(int64_t timeUs, float const *image);
+
+ private:
+  // Position and velocity along one axis, and their covariance.
+  struct Axis {
+    float x;
+    float v;
+    float pxx;
+    float pxv;
+    float pvv;
+  };
+
+  struct Track {
+    bbox_t box;
+    int64_t timeUs;
+    Axis cx;
+    Axis cy;
+    Axis w;
+    Axis h;
+    // The detected box in the network input, and its patch of the network
+    // input, empty if not aligning.
+    float netCx;
+    float netCy;
+    float netW;
+    float netH;
+    std::vector<float> patch;
+  };
+
+  uint32_t m_width;
+  uint32_t m_height;
+  ResizePlan const *m_alignPlan;
+  std::vector<Track> m_tracks{};
+
+  void advance(Track &track, int64_t timeUs) const;
+  void samplePatch(Track &track, float const *image) const;
+  bool align(Track const &track, float const *image, float &cx,
+      float &cy) const;
+};
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "box-tracker.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+uint32_t BoxTracker::newId(uint32_t objId)
+{
+  auto it = m_nextId.find(objId);
+  if (it == m_nextId.end()) {
+    it = m_nextId.emplace(objId, 1).first;
+  }
+  return it->second++;
+}
+
+std::vector<bbox_t> BoxTracker::track(std::vector<bbox_t> boxes,
+    bool changeHistory, int32_t framesStory, int32_t maxDist)
+{
+  bool const hasHistory = std::any_of(m_history.begin(), m_history.end(),
+      [](std::vector<bbox_t> const &frame) { return !frame.empty(); });
+
+  if (hasHistory) {
+    std::vector<uint32_t> dist(boxes.size(),
+        std::numeric_limits<uint32_t>::max());
+    for (auto const &frame : m_history) {
+      for (auto const &prev : frame) {
+        int32_t closest{-1};
+        for (uint32_t m = 0; m < boxes.size(); ++m) {
+          bbox_t const &box = boxes[m];
+          if (prev.obj_id != box.obj_id) {
+            continue;
+          }
+          float const dx = static_cast<float>(prev.x + prev.w / 2)
+            - static_cast<float>(box.x + box.w / 2);
+          float const dy = static_cast<float>(prev.y + prev.h / 2)
+            - static_cast<float>(box.y + box.h / 2);
+          uint32_t const d = static_cast<uint32_t>(
+              std::sqrt(dx * dx + dy * dy));
+          if (d < static_cast<uint32_t>(maxDist)
+              && (box.track_id == 0 || dist[m] > d)) {
+            dist[m] = d;
+            closest = static_cast<int32_t>(m);
+          }
+        }
+
+        bool const idTaken = std::any_of(boxes.begin(), boxes.end(),
+            [&prev](bbox_t const &box) {
+              return box.track_id == prev.track_id
+                && box.obj_id == prev.obj_id;
+            });
+        if (closest >= 0 && !idTaken) {
+          bbox_t &box = boxes[static_cast<uint32_t>(closest)];
+          box.track_id = prev.track_id;
+          box.w = (box.w + prev.w) / 2;
+          box.h = (box.h + prev.h) / 2;
+        }
+      }
+    }
+  }
+
+  for (auto &box : boxes) {
+    if (box.track_id == 0) {
+      box.track_id = newId(box.obj_id);
+    }
+  }
+
+  // Without history the first frame always starts it.
+  if (changeHistory || !hasHistory) {
+    m_history.push_front(boxes);
+    if (m_history.size() > static_cast<uint32_t>(framesStory)) {
+      m_history.pop_back();
+    }
+  }
+  return boxes;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BOX_TRACKER
+#define BOX_TRACKER
+
+#include "yolo-types.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <vector>
+
+// Track ids by nearest box centre over the last frames, the way darknet's
+// Detector::tracking_id assigns them, for backends without darknet.
+class BoxTracker {
+ public:
+  BoxTracker() = default;
+
+  std::vector<bbox_t> track(std::vector<bbox_t> boxes, bool changeHistory,
+      int32_t framesStory, int32_t maxDist);
+
+ private:
+  std::deque<std::vector<bbox_t>> m_history{};
+  // Next free track id per class.
+  std::map<uint32_t, uint32_t> m_nextId{};
+
+  uint32_t newId(uint32_t objId);
+};
+#endif
@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "conv-gemm.hpp"
+#include "thread-pool.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CONV_GEMM_X86
+#endif
+
+static uint32_t roundUp(uint32_t value, uint32_t multiple)
+{
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+uint32_t packedSize(uint32_t m, uint32_t k)
+{
+  return roundUp(m, gemmTileRows) * k;
+}
+
+// Offset of element (row, i) of an M x K matrix in its packed layout.
+static uint32_t packedOffset(uint32_t row, uint32_t i, uint32_t m,
+    uint32_t k, GemmBlocking const &blocking)
+{
+  uint32_t const k0 = i / blocking.kc * blocking.kc;
+  uint32_t const kLen = std::min(blocking.kc, k - k0);
+  return k0 * roundUp(m, gemmTileRows)
+    + (row / gemmTileRows) * gemmTileRows * kLen
+    + (i - k0) * gemmTileRows + row % gemmTileRows;
+}
+
+PackedWeights packWeights(float const *weights, uint32_t m, uint32_t k,
+    GemmBlocking const &blocking)
+{
+  PackedWeights packed;
+  packed.m = m;
+  packed.k = k;
+  packed.blocking = blocking;
+  uint32_t const mPadded = roundUp(m, gemmTileRows);
+  packed.storage.assign(packedSize(m, k), 0.0f);
+  for (uint32_t k0 = 0; k0 < k; k0 += blocking.kc) {
+    uint32_t const kLen = std::min(blocking.kc, k - k0);
+    float *block = packed.storage.data() + k0 * mPadded;
+    for (uint32_t row = 0; row < m; ++row) {
+      float *strip = block + (row / gemmTileRows) * gemmTileRows * kLen
+        + row % gemmTileRows;
+      for (uint32_t i = 0; i < kLen; ++i) {
+        strip[i * gemmTileRows] = weights[row * k + k0 + i];
+      }
+    }
+  }
+  return packed;
+}
+
+std::vector<float> unpackWeights(PackedWeights const &packed)
+{
+  std::vector<float> weights(packed.m * packed.k);
+  float const *data = packed.data();
+  for (uint32_t row = 0; row < packed.m; ++row) {
+    for (uint32_t i = 0; i < packed.k; ++i) {
+      weights[row * packed.k + i] = data[packedOffset(row, i, packed.m,
+          packed.k, packed.blocking)];
+    }
+  }
+  return weights;
+}
+
+// Unroll rows [k0, k0 + kLen) and columns [n0, n0 + nLen) of the im2col
+// matrix into strips of gemmTileColumns columns stored row by row, zero
+// padded to whole strips.
+static void packPanel(float const *input, ConvShape const &s, uint32_t k0,
+    uint32_t kLen, uint32_t n0, uint32_t nLen, float *panel)
+{
+  uint32_t const n = s.outH * s.outW;
+  uint32_t const nPadded = roundUp(nLen, gemmTileColumns);
+  uint32_t const taps = s.size * s.size;
+  bool const pointwise = (s.size == 1 && s.stride == 1 && s.pad == 0);
+  for (uint32_t i = 0; i < kLen; ++i) {
+    uint32_t const k = k0 + i;
+    float *out = panel + i * gemmTileColumns;
+    if (pointwise) {
+      float const *row = input + k * n + n0;
+      for (uint32_t j = 0; j < nPadded; j += gemmTileColumns) {
+        float *strip = out + j * kLen;
+        uint32_t const count = std::min(gemmTileColumns, nLen - j);
+        memcpy(strip, row + j, count * sizeof(float));
+        std::fill(strip + count, strip + gemmTileColumns, 0.0f);
+      }
+      continue;
+    }
+
+    uint32_t const c = k / taps;
+    int32_t const ky = static_cast<int32_t>((k / s.size) % s.size)
+      - static_cast<int32_t>(s.pad);
+    int32_t const kx = static_cast<int32_t>(k % s.size)
+      - static_cast<int32_t>(s.pad);
+    float const *plane = input + c * s.h * s.w;
+    uint32_t oy = n0 / s.outW;
+    uint32_t ox = n0 % s.outW;
+    for (uint32_t j = 0; j < nPadded; ++j) {
+      float v{0.0f};
+      if (j < nLen) {
+        int32_t const y = static_cast<int32_t>(oy * s.stride) + ky;
+        int32_t const x = static_cast<int32_t>(ox * s.stride) + kx;
+        if (y >= 0 && y < static_cast<int32_t>(s.h) && x >= 0
+            && x < static_cast<int32_t>(s.w)) {
+          v = plane[static_cast<uint32_t>(y) * s.w
+            + static_cast<uint32_t>(x)];
+        }
+        if (++ox == s.outW) {
+          ox = 0;
+          oy++;
+        }
+      }
+      out[(j / gemmTileColumns) * gemmTileColumns * kLen
+        + j % gemmTileColumns] = v;
+    }
+  }
+}
+
+static float leakyRelu(float v)
+{
+  return v < 0.0f ? 0.1f * v : v;
+}
+
+// c (gemmTileRows x gemmTileColumns, row stride ldc) = (or +=) a strip of
+// packed weights times a strip of the packed panel. On the last block of
+// the shared dimension the tile's rows of bias are added (if not null) and
+// leaky is applied before the store.
+typedef void (*GemmKernel)(uint32_t kLen, float const *a, float const *b,
+    float *c, uint32_t ldc, bool accumulate, float const *bias, bool leaky);
+
+static void gemmKernelScalar(uint32_t kLen, float const *a, float const *b,
+    float *c, uint32_t ldc, bool accumulate, float const *bias, bool leaky)
+{
+  float acc[gemmTileRows][gemmTileColumns] = {};
+  for (uint32_t i = 0; i < kLen; ++i) {
+    for (uint32_t r = 0; r < gemmTileRows; ++r) {
+      for (uint32_t j = 0; j < gemmTileColumns; ++j) {
+        acc[r][j] += a[r] * b[j];
+      }
+    }
+    a += gemmTileRows;
+    b += gemmTileColumns;
+  }
+  for (uint32_t r = 0; r < gemmTileRows; ++r) {
+    float const shift = (bias != nullptr) ? bias[r] : 0.0f;
+    for (uint32_t j = 0; j < gemmTileColumns; ++j) {
+      float v = accumulate ? c[r * ldc + j] + acc[r][j] : acc[r][j];
+      v += shift;
+      c[r * ldc + j] = leaky ? leakyRelu(v) : v;
+    }
+  }
+}
+
+#ifdef CONV_GEMM_X86
+// 6 x 16 register tile: twelve accumulators, two panel loads and six
+// weight broadcasts per step of the shared dimension.
+__attribute__((target("avx2,fma")))
+static void gemmKernelAvx2(uint32_t kLen, float const *a, float const *b,
+    float *c, uint32_t ldc, bool accumulate, float const *bias, bool leaky)
+{
+  __m256 c00 = _mm256_setzero_ps();
+  __m256 c01 = _mm256_setzero_ps();
+  __m256 c10 = _mm256_setzero_ps();
+  __m256 c11 = _mm256_setzero_ps();
+  __m256 c20 = _mm256_setzero_ps();
+  __m256 c21 = _mm256_setzero_ps();
+  __m256 c30 = _mm256_setzero_ps();
+  __m256 c31 = _mm256_setzero_ps();
+  __m256 c40 = _mm256_setzero_ps();
+  __m256 c41 = _mm256_setzero_ps();
+  __m256 c50 = _mm256_setzero_ps();
+  __m256 c51 = _mm256_setzero_ps();
+  for (uint32_t i = 0; i < kLen; ++i) {
+    __m256 const b0 = _mm256_loadu_ps(b);
+    __m256 const b1 = _mm256_loadu_ps(b + 8);
+    __m256 a0 = _mm256_broadcast_ss(a);
+    __m256 a1 = _mm256_broadcast_ss(a + 1);
+    c00 = _mm256_fmadd_ps(a0, b0, c00);
+    c01 = _mm256_fmadd_ps(a0, b1, c01);
+    c10 = _mm256_fmadd_ps(a1, b0, c10);
+    c11 = _mm256_fmadd_ps(a1, b1, c11);
+    a0 = _mm256_broadcast_ss(a + 2);
+    a1 = _mm256_broadcast_ss(a + 3);
+    c20 = _mm256_fmadd_ps(a0, b0, c20);
+    c21 = _mm256_fmadd_ps(a0, b1, c21);
+    c30 = _mm256_fmadd_ps(a1, b0, c30);
+    c31 = _mm256_fmadd_ps(a1, b1, c31);
+    a0 = _mm256_broadcast_ss(a + 4);
+    a1 = _mm256_broadcast_ss(a + 5);
+    c40 = _mm256_fmadd_ps(a0, b0, c40);
+    c41 = _mm256_fmadd_ps(a0, b1, c41);
+    c50 = _mm256_fmadd_ps(a1, b0, c50);
+    c51 = _mm256_fmadd_ps(a1, b1, c51);
+    a += gemmTileRows;
+    b += gemmTileColumns;
+  }
+
+  // Leaky ReLU as max(v, 0.1 v).
+  __m256 const slope = _mm256_set1_ps(0.1f);
+  __m256 const rows[gemmTileRows][2] = {{c00, c01}, {c10, c11}, {c20, c21},
+    {c30, c31}, {c40, c41}, {c50, c51}};
+  for (uint32_t r = 0; r < gemmTileRows; ++r) {
+    float *out = c + r * ldc;
+    __m256 v0 = rows[r][0];
+    __m256 v1 = rows[r][1];
+    if (accumulate) {
+      v0 = _mm256_add_ps(v0, _mm256_loadu_ps(out));
+      v1 = _mm256_add_ps(v1, _mm256_loadu_ps(out + 8));
+    }
+    if (bias != nullptr) {
+      __m256 const shift = _mm256_broadcast_ss(bias + r);
+      v0 = _mm256_add_ps(v0, shift);
+      v1 = _mm256_add_ps(v1, shift);
+    }
+    if (leaky) {
+      v0 = _mm256_max_ps(v0, _mm256_mul_ps(v0, slope));
+      v1 = _mm256_max_ps(v1, _mm256_mul_ps(v1, slope));
+    }
+    _mm256_storeu_ps(out, v0);
+    _mm256_storeu_ps(out + 8, v1);
+  }
+}
+#endif
+
+namespace {
+
+struct GemmKernelEntry {
+  GemmKernel kernel;
+  char const *name;
+};
+
+}
+
+static GemmKernelEntry const &selectGemmKernel()
+{
+  static GemmKernelEntry const entry = []() {
+#ifdef CONV_GEMM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+      return GemmKernelEntry{gemmKernelAvx2, "avx2+fma"};
+    }
+#endif
+    return GemmKernelEntry{gemmKernelScalar, "scalar"};
+  }();
+  return entry;
+}
+
+char const *gemmKernelName()
+{
+  return selectGemmKernel().name;
+}
+
+void multiplyPackedPanel(PackedWeights const &weights, float const *b,
+    uint32_t n, float *c, uint32_t ldc)
+{
+  GemmKernel const kernel = selectGemmKernel().kernel;
+  uint32_t const kc = weights.blocking.kc;
+  uint32_t const mPadded = roundUp(weights.m, gemmTileRows);
+  uint32_t const nPadded = roundUp(n, gemmTileColumns);
+  for (uint32_t k0 = 0; k0 < weights.k; k0 += kc) {
+    uint32_t const kLen = std::min(kc, weights.k - k0);
+    float const *block = weights.data() + k0 * mPadded;
+    float const *panel = b + k0 * nPadded;
+    for (uint32_t col = 0; col < nPadded; col += gemmTileColumns) {
+      for (uint32_t row = 0; row < mPadded; row += gemmTileRows) {
+        kernel(kLen, block + row * kLen, panel + col * kLen,
+            c + row * ldc + col, ldc, k0 > 0, nullptr, false);
+      }
+    }
+  }
+}
+
+void convolutionGemm(PackedWeights const &weights, float const *input,
+    ConvShape const &shape, GemmEpilogue const &epilogue, float *output,
+    ThreadPool &pool, std::vector<GemmScratch> &scratch)
+{
+  GemmKernel const kernel = selectGemmKernel().kernel;
+  GemmBlocking const &blocking = weights.blocking;
+  uint32_t const m = weights.m;
+  uint32_t const k = weights.k;
+  uint32_t const n = shape.outH * shape.outW;
+  uint32_t const mPadded = roundUp(m, gemmTileRows);
+  uint32_t const mStrips = mPadded / gemmTileRows;
+  uint32_t const blockStrips = std::max(1u, blocking.mc / gemmTileRows);
+  uint32_t const nTiles = (n + blocking.nc - 1) / blocking.nc;
+
+  // The deep, small layers have few column tiles, so their rows are split
+  // as well to give every thread a few tasks.
+  uint32_t const threads = pool.threadCount();
+  uint32_t mSplit = 1;
+  while (nTiles * mSplit < 4 * threads && mSplit * 2 <= mStrips) {
+    mSplit *= 2;
+  }
+  if (scratch.size() < threads) {
+    scratch.resize(threads);
+  }
+
+  pool.run(nTiles * mSplit, [&](uint32_t task, uint32_t thread) {
+      uint32_t const n0 = (task % nTiles) * blocking.nc;
+      uint32_t const nLen = std::min(blocking.nc, n - n0);
+      uint32_t const nStrips = (nLen + gemmTileColumns - 1)
+        / gemmTileColumns;
+      uint32_t const part = task / nTiles;
+      uint32_t const s0 = mStrips * part / mSplit;
+      uint32_t const s1 = mStrips * (part + 1) / mSplit;
+
+      std::vector<float> &panel = scratch[thread].panel;
+      panel.resize(std::max<size_t>(panel.size(),
+            blocking.kc * roundUp(blocking.nc, gemmTileColumns)));
+      float tile[gemmTileRows * gemmTileColumns];
+
+      for (uint32_t k0 = 0; k0 < k; k0 += blocking.kc) {
+        uint32_t const kLen = std::min(blocking.kc, k - k0);
+        bool const accumulate = (k0 > 0);
+        bool const last = (k0 + kLen == k);
+        bool const leaky = last && epilogue.leaky;
+        packPanel(input, shape, k0, kLen, n0, nLen, panel.data());
+        float const *block = weights.data() + k0 * mPadded;
+
+        for (uint32_t sb = s0; sb < s1; sb += blockStrips) {
+          uint32_t const sEnd = std::min(sb + blockStrips, s1);
+          for (uint32_t js = 0; js < nStrips; ++js) {
+            float const *b = panel.data() + js * gemmTileColumns * kLen;
+            uint32_t const col = n0 + js * gemmTileColumns;
+            uint32_t const cols = std::min(gemmTileColumns, n - col);
+            for (uint32_t s = sb; s < sEnd; ++s) {
+              float const *a = block + s * gemmTileRows * kLen;
+              uint32_t const row = s * gemmTileRows;
+              uint32_t const rows = std::min(gemmTileRows, m - row);
+              float *c = output + row * n + col;
+              float const *bias = (last && epilogue.bias != nullptr)
+                ? epilogue.bias + row : nullptr;
+              if (rows == gemmTileRows && cols == gemmTileColumns) {
+                kernel(kLen, a, b, c, n, accumulate, bias, leaky);
+                continue;
+              }
+              kernel(kLen, a, b, tile, gemmTileColumns, false, nullptr,
+                  false);
+              for (uint32_t r = 0; r < rows; ++r) {
+                float const shift = (bias != nullptr) ? bias[r] : 0.0f;
+                for (uint32_t j = 0; j < cols; ++j) {
+                  float v = tile[r * gemmTileColumns + j];
+                  v = (accumulate ? c[r * n + j] + v : v) + shift;
+                  c[r * n + j] = leaky ? leakyRelu(v) : v;
+                }
+              }
+            }
+          }
+        }
+      }
+    });
+}
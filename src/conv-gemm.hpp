@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONV_GEMM
+#define CONV_GEMM
+
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// Rows and columns of the register tile of the GEMM micro-kernel.
+const uint32_t gemmTileRows = 6;
+const uint32_t gemmTileColumns = 16;
+
+// Cache blocking of the GEMM: output rows (filters) per block of packed
+// weights kept in L2, shared dimension per block, and output columns
+// (pixels) per packed input panel.
+struct GemmBlocking {
+  uint32_t mc = 72;
+  uint32_t kc = 256;
+  uint32_t nc = 384;
+};
+
+// The M x K weight matrix of a convolution (filters x input channels *
+// kernel taps, darknet's layout), packed once into the order the
+// micro-kernel reads it: per K block, strips of gemmTileRows rows stored
+// column by column, zero padded to whole strips. The packed matrix is held
+// in storage, or elsewhere (a mapped model cache) if mapped is set.
+struct PackedWeights {
+  uint32_t m = 0;
+  uint32_t k = 0;
+  GemmBlocking blocking{};
+  std::vector<float> storage{};
+  float const *mapped = nullptr;
+
+  float const *data() const
+  {
+    return mapped != nullptr ? mapped : storage.data();
+  }
+};
+
+// Floats of a packed M x K matrix.
+uint32_t packedSize(uint32_t m, uint32_t k);
+
+PackedWeights packWeights(float const *weights, uint32_t m, uint32_t k,
+    GemmBlocking const &blocking);
+
+// The M x K matrix back in row order.
+std::vector<float> unpackWeights(PackedWeights const &packed);
+
+// Input and output geometry of a convolution, planar.
+struct ConvShape {
+  uint32_t c;
+  uint32_t h;
+  uint32_t w;
+  uint32_t size;
+  uint32_t stride;
+  uint32_t pad;
+  uint32_t outH;
+  uint32_t outW;
+};
+
+// Applied to each finished output tile while it is still in registers:
+// a bias per output row (filter) and darknet's leaky ReLU.
+struct GemmEpilogue {
+  float const *bias = nullptr;
+  bool leaky = false;
+};
+
+// Per pool thread buffer for the packed input panel.
+struct GemmScratch {
+  std::vector<float> panel{};
+};
+
+// output (M x outH * outW) = weights (M x K) * im2col(input) (K x outH *
+// outW), followed by the epilogue. The input is unrolled panel by panel
+// straight into the packed layout, so the full im2col matrix never exists.
+// Output column tiles, and row blocks if there are few of them, are spread
+// over the pool.
+void convolutionGemm(PackedWeights const &weights, float const *input,
+    ConvShape const &shape, GemmEpilogue const &epilogue, float *output,
+    ThreadPool &pool, std::vector<GemmScratch> &scratch);
+
+// c = weights (M x K) * b (K x n), for b already packed like the input
+// panels of convolutionGemm: per K block of the weights' blocking, strips
+// of gemmTileColumns columns stored row by row, zero padded to whole
+// strips. c has row stride ldc and room for M and n rounded up to whole
+// tiles, which are written in full. Runs on the calling thread.
+void multiplyPackedPanel(PackedWeights const &weights, float const *b,
+    uint32_t n, float *c, uint32_t ldc);
+
+// Name of the micro-kernel selected for this CPU.
+char const *gemmKernelName();
+#endif
@@ -0,0 +1,483 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "conv-int8.hpp"
+#include "thread-pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CONV_INT8_X86
+#endif
+
+// Bytes of the shared dimension summed per 32-bit lane.
+const uint32_t int8Group = 4;
+// Budget for the quantized input panel, which stays in L2 while every
+// weight strip passes over it.
+const uint32_t int8PanelBytes = 128 * 1024;
+
+static uint32_t roundUp(uint32_t value, uint32_t multiple)
+{
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+static float leakyRelu(float v)
+{
+  return v < 0.0f ? 0.1f * v : v;
+}
+
+// c (gemmTileRows x gemmTileColumns floats, row stride ldc) = the integer
+// products of a weight strip and a panel strip over all groups, back in
+// float with the tile's rows of scale, offset and bias (if not null), then
+// leaky.
+typedef void (*Int8Kernel)(uint32_t groups, int8_t const *a,
+    uint8_t const *b, float *c, uint32_t ldc, float const *rowScale,
+    int32_t const *rowOffset, float const *bias, bool leaky);
+
+static void int8KernelScalar(uint32_t groups, int8_t const *a,
+    uint8_t const *b, float *c, uint32_t ldc, float const *rowScale,
+    int32_t const *rowOffset, float const *bias, bool leaky)
+{
+  int32_t acc[gemmTileRows][gemmTileColumns] = {};
+  for (uint32_t g = 0; g < groups; ++g) {
+    for (uint32_t r = 0; r < gemmTileRows; ++r) {
+      for (uint32_t j = 0; j < gemmTileColumns; ++j) {
+        for (uint32_t i = 0; i < int8Group; ++i) {
+          acc[r][j] += static_cast<int32_t>(a[r * int8Group + i])
+            * static_cast<int32_t>(b[j * int8Group + i]);
+        }
+      }
+    }
+    a += gemmTileRows * int8Group;
+    b += gemmTileColumns * int8Group;
+  }
+  for (uint32_t r = 0; r < gemmTileRows; ++r) {
+    float const shift = (bias != nullptr) ? bias[r] : 0.0f;
+    for (uint32_t j = 0; j < gemmTileColumns; ++j) {
+      float const v = static_cast<float>(acc[r][j] - rowOffset[r])
+        * rowScale[r] + shift;
+      c[r * ldc + j] = leaky ? leakyRelu(v) : v;
+    }
+  }
+}
+
+// Quantize a group of rows (int8Group rows of nPadded floats, one after
+// the other) to bytes with a zero point of levels + 1, storing each strip
+// of gemmTileColumns columns, column by column with the group's bytes
+// together, stripBytes apart.
+typedef void (*QuantizeGroup)(float const *rows, uint32_t nPadded,
+    float inverse, int32_t levels, uint8_t *out, uint32_t stripBytes);
+
+static void quantizeGroupScalar(float const *rows, uint32_t nPadded,
+    float inverse, int32_t levels, uint8_t *out, uint32_t stripBytes)
+{
+  float const limit = static_cast<float>(levels);
+  for (uint32_t j = 0; j < nPadded; ++j) {
+    uint8_t *column = out + (j / gemmTileColumns) * stripBytes
+      + (j % gemmTileColumns) * int8Group;
+    for (uint32_t i = 0; i < int8Group; ++i) {
+      float const v = std::min(limit, std::max(-limit,
+            rows[i * nPadded + j] * inverse));
+      column[i] = static_cast<uint8_t>(static_cast<int32_t>(
+            std::nearbyint(v)) + levels + 1);
+    }
+  }
+}
+
+#ifdef CONV_INT8_X86
+// Sixteen bytes of one row: clamped in float, rounded to nearest even as
+// nearbyint does, narrowed with the lanes put back in order.
+__attribute__((target("avx2")))
+static inline __m128i quantizeRow16(float const *row, __m256 inverse,
+    __m256 limit, __m256i zero)
+{
+  __m256 v0 = _mm256_mul_ps(_mm256_loadu_ps(row), inverse);
+  __m256 v1 = _mm256_mul_ps(_mm256_loadu_ps(row + 8), inverse);
+  v0 = _mm256_min_ps(limit, _mm256_max_ps(_mm256_sub_ps(_mm256_setzero_ps(),
+          limit), v0));
+  v1 = _mm256_min_ps(limit, _mm256_max_ps(_mm256_sub_ps(_mm256_setzero_ps(),
+          limit), v1));
+  __m256i const q0 = _mm256_add_epi32(_mm256_cvtps_epi32(v0), zero);
+  __m256i const q1 = _mm256_add_epi32(_mm256_cvtps_epi32(v1), zero);
+  __m256i const words = _mm256_permute4x64_epi64(_mm256_packs_epi32(q0, q1),
+      0xd8);
+  return _mm_packus_epi16(_mm256_castsi256_si128(words),
+      _mm256_extracti128_si256(words, 1));
+}
+
+__attribute__((target("avx2")))
+static void quantizeGroupAvx2(float const *rows, uint32_t nPadded,
+    float inverse, int32_t levels, uint8_t *out, uint32_t stripBytes)
+{
+  __m256 const scale = _mm256_set1_ps(inverse);
+  __m256 const limit = _mm256_set1_ps(static_cast<float>(levels));
+  __m256i const zero = _mm256_set1_epi32(levels + 1);
+  for (uint32_t j = 0; j < nPadded; j += gemmTileColumns) {
+    __m128i const r0 = quantizeRow16(rows + j, scale, limit, zero);
+    __m128i const r1 = quantizeRow16(rows + nPadded + j, scale, limit, zero);
+    __m128i const r2 = quantizeRow16(rows + 2 * nPadded + j, scale, limit,
+        zero);
+    __m128i const r3 = quantizeRow16(rows + 3 * nPadded + j, scale, limit,
+        zero);
+    // Interleave the four rows so each column's group is contiguous.
+    __m128i const t0 = _mm_unpacklo_epi8(r0, r1);
+    __m128i const t1 = _mm_unpackhi_epi8(r0, r1);
+    __m128i const t2 = _mm_unpacklo_epi8(r2, r3);
+    __m128i const t3 = _mm_unpackhi_epi8(r2, r3);
+    __m128i *strip = reinterpret_cast<__m128i *>(
+        out + (j / gemmTileColumns) * stripBytes);
+    _mm_storeu_si128(strip, _mm_unpacklo_epi16(t0, t2));
+    _mm_storeu_si128(strip + 1, _mm_unpackhi_epi16(t0, t2));
+    _mm_storeu_si128(strip + 2, _mm_unpacklo_epi16(t1, t3));
+    _mm_storeu_si128(strip + 3, _mm_unpackhi_epi16(t1, t3));
+  }
+}
+
+static int32_t loadGroup(int8_t const *a)
+{
+  int32_t v;
+  memcpy(&v, a, sizeof(v));
+  return v;
+}
+
+// The float epilogue shared by the vector kernels, for one row of the
+// tile.
+__attribute__((target("avx2,fma")))
+static inline void storeInt8Row(__m256i acc0, __m256i acc1, float *out,
+    float scale, int32_t offset, float shift, bool leaky)
+{
+  __m256i const o = _mm256_set1_epi32(offset);
+  __m256 const s = _mm256_set1_ps(scale);
+  __m256 const b = _mm256_set1_ps(shift);
+  __m256 v0 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(acc0, o)),
+      s, b);
+  __m256 v1 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(acc1, o)),
+      s, b);
+  if (leaky) {
+    __m256 const slope = _mm256_set1_ps(0.1f);
+    v0 = _mm256_max_ps(v0, _mm256_mul_ps(v0, slope));
+    v1 = _mm256_max_ps(v1, _mm256_mul_ps(v1, slope));
+  }
+  _mm256_storeu_ps(out, v0);
+  _mm256_storeu_ps(out + 8, v1);
+}
+
+// 6 x 16 tile, two accumulators of eight columns per row. maddubs
+// multiplies unsigned activations by signed weights into pairwise 16-bit
+// sums, which madd against ones widens to the 32-bit sum of the group.
+__attribute__((target("avx2,fma")))
+static void int8KernelAvx2(uint32_t groups, int8_t const *a,
+    uint8_t const *b, float *c, uint32_t ldc, float const *rowScale,
+    int32_t const *rowOffset, float const *bias, bool leaky)
+{
+  __m256i const ones = _mm256_set1_epi16(1);
+  __m256i acc[gemmTileRows][2];
+  for (uint32_t r = 0; r < gemmTileRows; ++r) {
+    acc[r][0] = _mm256_setzero_si256();
+    acc[r][1] = _mm256_setzero_si256();
+  }
+  for (uint32_t g = 0; g < groups; ++g) {
+    __m256i const b0 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(
+          b));
+    __m256i const b1 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(
+          b + 32));
+    for (uint32_t r = 0; r < gemmTileRows; ++r) {
+      __m256i const w = _mm256_set1_epi32(loadGroup(a + r * int8Group));
+      acc[r][0] = _mm256_add_epi32(acc[r][0], _mm256_madd_epi16(
+            _mm256_maddubs_epi16(b0, w), ones));
+      acc[r][1] = _mm256_add_epi32(acc[r][1], _mm256_madd_epi16(
+            _mm256_maddubs_epi16(b1, w), ones));
+    }
+    a += gemmTileRows * int8Group;
+    b += gemmTileColumns * int8Group;
+  }
+  for (uint32_t r = 0; r < gemmTileRows; ++r) {
+    storeInt8Row(acc[r][0], acc[r][1], c + r * ldc, rowScale[r],
+        rowOffset[r], (bias != nullptr) ? bias[r] : 0.0f, leaky);
+  }
+}
+
+// As the AVX2 kernel, with the whole group summed into the accumulator by
+// one VNNI instruction and no 16-bit intermediate.
+__attribute__((target("avx2,fma,avx512f,avx512vl,avx512vnni")))
+static void int8KernelVnni(uint32_t groups, int8_t const *a,
+    uint8_t const *b, float *c, uint32_t ldc, float const *rowScale,
+    int32_t const *rowOffset, float const *bias, bool leaky)
+{
+  __m256i acc[gemmTileRows][2];
+  for (uint32_t r = 0; r < gemmTileRows; ++r) {
+    acc[r][0] = _mm256_setzero_si256();
+    acc[r][1] = _mm256_setzero_si256();
+  }
+  for (uint32_t g = 0; g < groups; ++g) {
+    __m256i const b0 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(
+          b));
+    __m256i const b1 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(
+          b + 32));
+    for (uint32_t r = 0; r < gemmTileRows; ++r) {
+      __m256i const w = _mm256_set1_epi32(loadGroup(a + r * int8Group));
+      acc[r][0] = _mm256_dpbusd_epi32(acc[r][0], b0, w);
+      acc[r][1] = _mm256_dpbusd_epi32(acc[r][1], b1, w);
+    }
+    a += gemmTileRows * int8Group;
+    b += gemmTileColumns * int8Group;
+  }
+  for (uint32_t r = 0; r < gemmTileRows; ++r) {
+    storeInt8Row(acc[r][0], acc[r][1], c + r * ldc, rowScale[r],
+        rowOffset[r], (bias != nullptr) ? bias[r] : 0.0f, leaky);
+  }
+}
+#endif
+
+namespace {
+
+struct Int8KernelEntry {
+  Int8Kernel kernel;
+  QuantizeGroup quantize;
+  uint32_t levels;
+  char const *name;
+};
+
+}
+
+static Int8KernelEntry const &selectInt8Kernel()
+{
+  static Int8KernelEntry const entry = []() {
+#ifdef CONV_INT8_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512vnni")
+        && __builtin_cpu_supports("avx512vl")
+        && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+      return Int8KernelEntry{int8KernelVnni, quantizeGroupAvx2, 127,
+        "avx512vnni"};
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+      return Int8KernelEntry{int8KernelAvx2, quantizeGroupAvx2, 63, "avx2"};
+    }
+#endif
+    return Int8KernelEntry{int8KernelScalar, quantizeGroupScalar, 127,
+      "scalar"};
+  }();
+  return entry;
+}
+
+uint32_t int8ActivationLevels()
+{
+  return selectInt8Kernel().levels;
+}
+
+char const *int8KernelName()
+{
+  return selectInt8Kernel().name;
+}
+
+QuantizedWeights quantizeWeights(float const *weights, uint32_t m,
+    uint32_t k, float inputRange)
+{
+  uint32_t const levels = int8ActivationLevels();
+  QuantizedWeights q;
+  q.m = m;
+  q.k = k;
+  q.kPadded = roundUp(k, int8Group);
+  q.inputScale = (inputRange > 0.0f) ? inputRange / levels : 1.0f;
+  q.rowScale.resize(m);
+  q.rowOffset.resize(m);
+  q.data.assign(roundUp(m, gemmTileRows) * q.kPadded, 0);
+
+  for (uint32_t row = 0; row < m; ++row) {
+    float const *w = weights + row * k;
+    float maxAbs{0.0f};
+    for (uint32_t i = 0; i < k; ++i) {
+      maxAbs = std::max(maxAbs, std::abs(w[i]));
+    }
+    float const scale = (maxAbs > 0.0f) ? maxAbs / 127.0f : 1.0f;
+    int8_t *strip = q.data.data() + (row / gemmTileRows) * gemmTileRows
+      * q.kPadded + (row % gemmTileRows) * int8Group;
+    int32_t sum{0};
+    for (uint32_t i = 0; i < k; ++i) {
+      int32_t const v = std::min(127, std::max(-127, static_cast<int32_t>(
+              std::nearbyint(w[i] / scale))));
+      strip[(i / int8Group) * gemmTileRows * int8Group + i % int8Group] =
+        static_cast<int8_t>(v);
+      sum += v;
+    }
+    q.rowScale[row] = scale * q.inputScale;
+    q.rowOffset[row] = static_cast<int32_t>(levels + 1) * sum;
+  }
+  return q;
+}
+
+// Row k of the im2col matrix, columns [n0, n0 + nLen), into row. Taps
+// outside the input are zero.
+static void unrollRow(float const *input, ConvShape const &s, uint32_t k,
+    uint32_t n0, uint32_t nLen, float *row)
+{
+  uint32_t const n = s.outH * s.outW;
+  if (s.size == 1 && s.stride == 1 && s.pad == 0) {
+    memcpy(row, input + k * n + n0, nLen * sizeof(float));
+    return;
+  }
+
+  uint32_t const taps = s.size * s.size;
+  int32_t const stride = static_cast<int32_t>(s.stride);
+  int32_t const w = static_cast<int32_t>(s.w);
+  int32_t const ky = static_cast<int32_t>((k / s.size) % s.size)
+    - static_cast<int32_t>(s.pad);
+  int32_t const kx = static_cast<int32_t>(k % s.size)
+    - static_cast<int32_t>(s.pad);
+  float const *plane = input + (k / taps) * s.h * s.w;
+  uint32_t oy = n0 / s.outW;
+  uint32_t ox = n0 % s.outW;
+  for (uint32_t j = 0; j < nLen; oy++, ox = 0) {
+    uint32_t const count = std::min(s.outW - ox, nLen - j);
+    float *out = row + j;
+    j += count;
+    int32_t const y = static_cast<int32_t>(oy) * stride + ky;
+    if (y < 0 || y >= static_cast<int32_t>(s.h)) {
+      std::fill(out, out + count, 0.0f);
+      continue;
+    }
+    // Output columns [begin, end) of the segment read inside the row.
+    int32_t const x0 = static_cast<int32_t>(ox) * stride + kx;
+    int32_t const begin = std::min(static_cast<int32_t>(count),
+        std::max(0, (-x0 + stride - 1) / stride));
+    int32_t const end = std::max(begin, std::min(
+          static_cast<int32_t>(count), (w - x0 + stride - 1) / stride));
+    float const *line = plane + static_cast<uint32_t>(y) * s.w;
+    std::fill(out, out + begin, 0.0f);
+    if (stride == 1) {
+      memcpy(out + begin, line + x0 + begin,
+          static_cast<uint32_t>(end - begin) * sizeof(float));
+    } else {
+      for (int32_t i = begin; i < end; ++i) {
+        out[i] = line[x0 + i * stride];
+      }
+    }
+    std::fill(out + end, out + count, 0.0f);
+  }
+}
+
+// Unroll columns [n0, n0 + nLen) of the im2col matrix into strips of
+// gemmTileColumns columns quantized to bytes, a group of int8Group rows at
+// a time, each column's group together. Padding, inside and outside the
+// matrix, is the zero point.
+static void packPanelInt8(float const *input, ConvShape const &s,
+    uint32_t kPadded, float inputScale, uint32_t n0, uint32_t nLen,
+    uint8_t *panel, float *rows)
+{
+  Int8KernelEntry const &entry = selectInt8Kernel();
+  uint32_t const k = s.c * s.size * s.size;
+  uint32_t const nPadded = roundUp(nLen, gemmTileColumns);
+  for (uint32_t k0 = 0; k0 < kPadded; k0 += int8Group) {
+    for (uint32_t i = 0; i < int8Group; ++i) {
+      float *row = rows + i * nPadded;
+      uint32_t const filled = (k0 + i < k) ? nLen : 0;
+      if (filled > 0) {
+        unrollRow(input, s, k0 + i, n0, nLen, row);
+      }
+      std::fill(row + filled, row + nPadded, 0.0f);
+    }
+    entry.quantize(rows, nPadded, 1.0f / inputScale,
+        static_cast<int32_t>(entry.levels), panel + k0 * gemmTileColumns,
+        gemmTileColumns * kPadded);
+  }
+}
+
+void convolutionInt8(QuantizedWeights const &weights, float const *input,
+    ConvShape const &shape, GemmEpilogue const &epilogue, float *output,
+    ThreadPool &pool, std::vector<Int8Scratch> &scratch)
+{
+  Int8Kernel const kernel = selectInt8Kernel().kernel;
+  uint32_t const m = weights.m;
+  uint32_t const kPadded = weights.kPadded;
+  uint32_t const groups = kPadded / int8Group;
+  uint32_t const n = shape.outH * shape.outW;
+  uint32_t const mStrips = roundUp(m, gemmTileRows) / gemmTileRows;
+  // The whole shared dimension is summed in one pass, so the panel width
+  // follows from its depth.
+  uint32_t const nc = std::min(512u, std::max(gemmTileColumns,
+        int8PanelBytes / kPadded / gemmTileColumns * gemmTileColumns));
+  uint32_t const nTiles = (n + nc - 1) / nc;
+
+  uint32_t const threads = pool.threadCount();
+  uint32_t mSplit = 1;
+  while (nTiles * mSplit < 4 * threads && mSplit * 2 <= mStrips) {
+    mSplit *= 2;
+  }
+  if (scratch.size() < threads) {
+    scratch.resize(threads);
+  }
+
+  pool.run(nTiles * mSplit, [&](uint32_t task, uint32_t thread) {
+      uint32_t const n0 = (task % nTiles) * nc;
+      uint32_t const nLen = std::min(nc, n - n0);
+      uint32_t const nStrips = (nLen + gemmTileColumns - 1)
+        / gemmTileColumns;
+      uint32_t const part = task / nTiles;
+      uint32_t const s0 = mStrips * part / mSplit;
+      uint32_t const s1 = mStrips * (part + 1) / mSplit;
+
+      std::vector<uint8_t> &panel = scratch[thread].panel;
+      std::vector<float> &unrolled = scratch[thread].rows;
+      uint32_t const ncPadded = roundUp(nc, gemmTileColumns);
+      panel.resize(std::max<size_t>(panel.size(), kPadded * ncPadded));
+      unrolled.resize(std::max<size_t>(unrolled.size(),
+            int8Group * ncPadded));
+      packPanelInt8(input, shape, kPadded, weights.inputScale, n0, nLen,
+          panel.data(), unrolled.data());
+      float tile[gemmTileRows * gemmTileColumns];
+
+      // Each weight strip stays in L1 while it passes over the panel.
+      for (uint32_t s = s0; s < s1; ++s) {
+        int8_t const *a = weights.data.data() + s * gemmTileRows * kPadded;
+        uint32_t const row = s * gemmTileRows;
+        uint32_t const rows = std::min(gemmTileRows, m - row);
+        float const *bias = (epilogue.bias != nullptr)
+          ? epilogue.bias + row : nullptr;
+        for (uint32_t js = 0; js < nStrips; ++js) {
+          uint8_t const *b = panel.data() + js * gemmTileColumns * kPadded;
+          uint32_t const col = n0 + js * gemmTileColumns;
+          uint32_t const cols = std::min(gemmTileColumns, n - col);
+          float *c = output + row * n + col;
+          if (rows == gemmTileRows && cols == gemmTileColumns) {
+            kernel(groups, a, b, c, n, weights.rowScale.data() + row,
+                weights.rowOffset.data() + row, bias, epilogue.leaky);
+            continue;
+          }
+          // The last strip's rows past m have no scale; their tile rows
+          // are computed from zero weights and dropped.
+          float rowScale[gemmTileRows] = {};
+          int32_t rowOffset[gemmTileRows] = {};
+          float rowBias[gemmTileRows] = {};
+          for (uint32_t r = 0; r < rows; ++r) {
+            rowScale[r] = weights.rowScale[row + r];
+            rowOffset[r] = weights.rowOffset[row + r];
+            rowBias[r] = (bias != nullptr) ? bias[r] : 0.0f;
+          }
+          kernel(groups, a, b, tile, gemmTileColumns, rowScale, rowOffset,
+              rowBias, epilogue.leaky);
+          for (uint32_t r = 0; r < rows; ++r) {
+            memcpy(c + r * n, tile + r * gemmTileColumns,
+                cols * sizeof(float));
+          }
+        }
+      }
+    });
+}
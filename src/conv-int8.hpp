@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONV_INT8
+#define CONV_INT8
+
+#include "conv-gemm.hpp"
+
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// Largest magnitude of a quantized activation for the int8 kernel selected
+// for this CPU. Activations are stored as unsigned bytes with a zero point
+// of one more than this: 127 with VNNI and in the scalar kernel, 63 with
+// AVX2, whose pairwise 16-bit sums would saturate on full bytes.
+uint32_t int8ActivationLevels();
+
+// The weights of a convolution quantized symmetrically per output row
+// (filter) to int8, with the scale of its input activations. Packed per
+// strip of gemmTileRows rows in groups of four along the shared dimension,
+// the unit of the integer dot products.
+struct QuantizedWeights {
+  uint32_t m = 0;
+  uint32_t k = 0;
+  // The shared dimension padded to whole groups.
+  uint32_t kPadded = 0;
+  // Input value of one activation step.
+  float inputScale = 1.0f;
+  // Per row, back to float: (sum - rowOffset) * rowScale. The offset
+  // removes the zero point of the activations.
+  std::vector<float> rowScale{};
+  std::vector<int32_t> rowOffset{};
+  std::vector<int8_t> data{};
+};
+
+// Quantize an M x K weight matrix for inputs within [-inputRange,
+// inputRange].
+QuantizedWeights quantizeWeights(float const *weights, uint32_t m,
+    uint32_t k, float inputRange);
+
+// Per pool thread buffers for the quantized input panel and the float
+// rows it is quantized from.
+struct Int8Scratch {
+  std::vector<uint8_t> panel{};
+  std::vector<float> rows{};
+};
+
+// As convolutionGemm, but the input is quantized while it is unrolled and
+// the products are summed in 32-bit integers. The epilogue converts back
+// to float, so the output is float like the input.
+void convolutionInt8(QuantizedWeights const &weights, float const *input,
+    ConvShape const &shape, GemmEpilogue const &epilogue, float *output,
+    ThreadPool &pool, std::vector<Int8Scratch> &scratch);
+
+// Name of the int8 micro-kernel selected for this CPU.
+char const *int8KernelName();
+#endif
@@ -0,0 +1,459 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "conv-tuning.hpp"
+#include "model-cache.hpp"
+#include "thread-pool.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+typedef std::chrono::steady_clock Clock;
+
+// Candidate blockings, each used only up to the first value covering the
+// whole dimension. For Winograd nc counts input tiles.
+static uint32_t const candidateKc[] = {128, 256, 512};
+static uint32_t const candidateGemmNc[] = {192, 384, 768};
+static uint32_t const candidateGemmMc[] = {36, 144};
+static uint32_t const candidateWinogradNc[] = {32, 64, 128, 256};
+
+// Output columns a tuning run covers at least, per thread.
+static uint32_t const tuningColumnsPerThread = 4096;
+
+// The fastest few candidates are timed again this many times, the best
+// run counting.
+static uint32_t const tuningRepeats = 2;
+static uint32_t const tuningFinalists = 3;
+
+std::string cpuModelName()
+{
+  std::ifstream in("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.compare(0, 10, "model name") == 0) {
+      size_t const colon = line.find(':');
+      size_t const begin = line.find_first_not_of(" \t", colon + 1);
+      if (colon != std::string::npos && begin != std::string::npos) {
+        return line.substr(begin);
+      }
+    }
+  }
+  return "unknown";
+}
+
+std::string tuningFile(std::string const &cfgFile)
+{
+  return cfgFile + ".tuning";
+}
+
+static std::vector<ConvTuning> candidateTunings(Layer const &l,
+    ConvShape const &shape)
+{
+  std::vector<ConvTuning> candidates;
+  auto add = [&candidates](ConvAlgorithm algorithm, uint32_t mc, uint32_t kc,
+      uint32_t nc) {
+    ConvTuning t;
+    t.algorithm = algorithm;
+    t.blocking.mc = mc;
+    t.blocking.kc = kc;
+    t.blocking.nc = nc;
+    for (auto const &c : candidates) {
+      if (c.algorithm == algorithm && c.blocking.mc == mc
+          && c.blocking.kc == kc && c.blocking.nc == nc) {
+        return;
+      }
+    }
+    candidates.push_back(t);
+  };
+
+  ConvTuning const fallback = defaultConvTuning(l);
+  add(fallback.algorithm, fallback.blocking.mc, fallback.blocking.kc,
+      fallback.blocking.nc);
+
+  GemmBlocking const blocking;
+  uint32_t const k = l.c * l.size * l.size;
+  uint32_t const n = l.outH * l.outW;
+  uint32_t previousKc{0};
+  for (uint32_t kc : candidateKc) {
+    if (previousKc >= k) {
+      break;
+    }
+    uint32_t previousNc{0};
+    for (uint32_t nc : candidateGemmNc) {
+      if (previousNc >= n) {
+        break;
+      }
+      add(ConvAlgorithm::Gemm, blocking.mc, kc, nc);
+      previousNc = nc;
+    }
+    previousKc = kc;
+  }
+  for (uint32_t mc : candidateGemmMc) {
+    add(ConvAlgorithm::Gemm, mc, blocking.kc, blocking.nc);
+  }
+
+  if (winogradApplies(shape)) {
+    uint32_t const tiles = ((l.outH + 1) / 2) * ((l.outW + 1) / 2);
+    previousKc = 0;
+    for (uint32_t kc : candidateKc) {
+      if (previousKc >= l.c) {
+        break;
+      }
+      uint32_t previousNc{0};
+      for (uint32_t nc : candidateWinogradNc) {
+        if (previousNc >= tiles) {
+          break;
+        }
+        add(ConvAlgorithm::Winograd, blocking.mc, kc, nc);
+        previousNc = nc;
+      }
+      previousKc = kc;
+    }
+  }
+  return candidates;
+}
+
+static char const *algorithmName(ConvAlgorithm algorithm)
+{
+  return algorithm == ConvAlgorithm::Winograd ? "winograd" : "gemm";
+}
+
+static float randomUnit()
+{
+  return static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+}
+
+namespace {
+
+// One convolution cut to a band of output rows, with random weights and
+// input, timed per candidate tuning.
+class TuningRun {
+ public:
+  TuningRun(Layer const &l, uint32_t columns):
+    m_layer(l),
+    m_shape{l.c, l.h, l.w, l.size, l.stride, l.pad, l.outH, l.outW},
+    m_weights(l.outC * l.c * l.size * l.size),
+    m_bias(l.outC, 0.1f),
+    m_input(),
+    m_output()
+  {
+    // Whole tile rows for Winograd.
+    uint32_t rows = std::min(l.outH, (columns + l.outW - 1) / l.outW);
+    rows = std::min(l.outH, rows + rows % 2);
+    m_shape.outH = rows;
+    m_shape.h = std::min(l.h, (rows - 1) * l.stride + l.size);
+
+    float const scale = 2.0f / std::sqrt(static_cast<float>(l.c * l.size
+          * l.size));
+    for (auto &w : m_weights) {
+      w = (randomUnit() - 0.5f) * scale;
+    }
+    m_input.resize(l.c * m_shape.h * m_shape.w);
+    for (auto &v : m_input) {
+      v = randomUnit();
+    }
+    m_output.resize(l.outC * m_shape.outH * m_shape.outW);
+  }
+
+  ConvShape const &shape() const
+  {
+    return m_shape;
+  }
+
+  // Milliseconds of the best of runs.
+  double time(ConvTuning const &tuning, uint32_t runs, ThreadPool &pool)
+  {
+    GemmEpilogue epilogue;
+    epilogue.bias = m_bias.data();
+    epilogue.leaky = (m_layer.activation == Activation::Leaky);
+    uint32_t const k = m_layer.c * m_layer.size * m_layer.size;
+    PackedWeights packed;
+    WinogradWeights winograd;
+    if (tuning.algorithm == ConvAlgorithm::Winograd) {
+      winograd = transformWeights(m_weights.data(), m_layer.outC, m_layer.c,
+          tuning.blocking);
+    } else {
+      packed = packWeights(m_weights.data(), m_layer.outC, k,
+          tuning.blocking);
+    }
+    double best{0.0};
+    for (uint32_t run = 0; run < runs; ++run) {
+      Clock::time_point const t0 = Clock::now();
+      if (tuning.algorithm == ConvAlgorithm::Winograd) {
+        convolutionWinograd(winograd, m_input.data(), m_shape, epilogue,
+            m_output.data(), pool, m_winogradScratch);
+      } else {
+        convolutionGemm(packed, m_input.data(), m_shape, epilogue,
+            m_output.data(), pool, m_gemmScratch);
+      }
+      double const ms = std::chrono::duration<double, std::milli>(
+          Clock::now() - t0).count();
+      best = (run == 0) ? ms : std::min(best, ms);
+    }
+    return best;
+  }
+
+ private:
+  Layer const &m_layer;
+  ConvShape m_shape;
+  std::vector<float> m_weights;
+  std::vector<float> m_bias;
+  std::vector<float> m_input;
+  std::vector<float> m_output;
+  std::vector<GemmScratch> m_gemmScratch{};
+  std::vector<WinogradScratch> m_winogradScratch{};
+};
+
+}
+
+std::vector<ConvTuning> tuneConvolutions(std::vector<Layer> const &layers,
+    ThreadPool &pool)
+{
+  Clock::time_point const start = Clock::now();
+  std::vector<ConvTuning> tuning(layers.size());
+  double defaultMs{0.0};
+  double tunedMs{0.0};
+  uint32_t const columns = tuningColumnsPerThread * pool.threadCount();
+  for (size_t i = 0; i < layers.size(); ++i) {
+    Layer const &l = layers[i];
+    if (l.type != LayerType::Convolutional) {
+      continue;
+    }
+    TuningRun run(l, columns);
+    std::vector<ConvTuning> const candidates = candidateTunings(l,
+        run.shape());
+
+    // Warm the scratch of both algorithms, then time every candidate once
+    // and the fastest few again.
+    run.time(candidates.front(), 1, pool);
+    for (auto const &c : candidates) {
+      if (c.algorithm != candidates.front().algorithm) {
+        run.time(c, 1, pool);
+        break;
+      }
+    }
+    std::vector<std::pair<double, size_t>> times;
+    for (size_t j = 0; j < candidates.size(); ++j) {
+      times.emplace_back(run.time(candidates[j], 1, pool), j);
+    }
+    std::sort(times.begin(), times.end());
+    for (size_t j = 0; j < std::min<size_t>(tuningFinalists, times.size());
+        ++j) {
+      times[j].first = std::min(times[j].first,
+          run.time(candidates[times[j].second], tuningRepeats, pool));
+    }
+    std::sort(times.begin(), times.begin() + static_cast<std::ptrdiff_t>(
+          std::min<size_t>(tuningFinalists, times.size())));
+    tuning[i] = candidates[times.front().second];
+
+    double fallbackMs{0.0};
+    for (auto const &t : times) {
+      if (t.second == 0) {
+        fallbackMs = t.first;
+      }
+    }
+    defaultMs += fallbackMs;
+    tunedMs += times.front().first;
+    std::clog << "Tuned layer " << i << " (" << l.c << "x" << l.h << "x"
+      << l.w << " to " << l.outC << ", " << l.size << "x" << l.size
+      << "): " << algorithmName(tuning[i].algorithm) << " mc "
+      << tuning[i].blocking.mc << " kc " << tuning[i].blocking.kc << " nc "
+      << tuning[i].blocking.nc << ", " << std::fixed << std::setprecision(2)
+      << times.front().first << " ms (default " << fallbackMs << " ms) on "
+      << run.shape().outH << " of " << l.outH << " rows" << std::endl;
+  }
+  std::clog << "Tuned in " << std::fixed << std::setprecision(1)
+    << std::chrono::duration<double>(Clock::now() - start).count()
+    << " s: " << std::setprecision(2) << tunedMs << " ms tuned against "
+    << defaultMs << " ms by default on the measured rows" << std::endl;
+  return tuning;
+}
+
+static bool parseAlgorithm(std::string const &name, ConvAlgorithm &algorithm)
+{
+  if (name == "gemm") {
+    algorithm = ConvAlgorithm::Gemm;
+  } else if (name == "winograd") {
+    algorithm = ConvAlgorithm::Winograd;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// The header line of the tuning of a key.
+static std::string keyLine(TuningKey const &key)
+{
+  std::ostringstream line;
+  line << "tuning " << key.threads << " " << std::hex << std::setw(16)
+    << std::setfill('0') << key.cfgHash << " " << key.cpuModel;
+  return line.str();
+}
+
+bool readTuning(std::string const &file, TuningKey const &key,
+    std::vector<Layer> const &layers, std::vector<ConvTuning> &tuning)
+{
+  std::ifstream in(file);
+  std::string const header = keyLine(key);
+  std::string line;
+  while (std::getline(in, line) && line != header) {
+  }
+  if (!in) {
+    return false;
+  }
+
+  std::vector<ConvTuning> read(layers.size());
+  std::vector<bool> seen(layers.size(), false);
+  while (std::getline(in, line) && line != "end") {
+    std::istringstream fields(line);
+    size_t index;
+    std::string name;
+    ConvTuning t;
+    if (!(fields >> index >> name >> t.blocking.mc >> t.blocking.kc
+          >> t.blocking.nc) || !parseAlgorithm(name, t.algorithm)
+        || index >= layers.size() || seen[index]
+        || layers[index].type != LayerType::Convolutional
+        || t.blocking.mc < gemmTileRows || t.blocking.mc % gemmTileRows != 0
+        || t.blocking.kc == 0 || t.blocking.nc == 0
+        || t.blocking.nc % gemmTileColumns != 0) {
+      return false;
+    }
+    Layer const &l = layers[index];
+    if (t.algorithm == ConvAlgorithm::Winograd && !winogradApplies(
+          ConvShape{l.c, l.h, l.w, l.size, l.stride, l.pad, l.outH,
+          l.outW})) {
+      return false;
+    }
+    read[index] = t;
+    seen[index] = true;
+  }
+  for (size_t i = 0; i < layers.size(); ++i) {
+    if (layers[i].type == LayerType::Convolutional && !seen[i]) {
+      return false;
+    }
+  }
+  tuning = read;
+  return true;
+}
+
+bool writeTuning(std::string const &file, TuningKey const &key,
+    std::vector<Layer> const &layers, std::vector<ConvTuning> const &tuning)
+{
+  // The tunings of other keys, as they are.
+  std::string const header = keyLine(key);
+  std::vector<std::string> kept;
+  {
+    std::ifstream in(file);
+    std::string line;
+    bool skip{false};
+    while (std::getline(in, line)) {
+      if (line.compare(0, 7, "tuning ") == 0) {
+        skip = (line == header);
+      }
+      if (!skip && line.compare(0, 1, "#") != 0) {
+        kept.push_back(line);
+      }
+      if (line == "end") {
+        skip = false;
+      }
+    }
+  }
+
+  std::string const temporary = file + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream out(temporary);
+    out << "# Per thread count, cfg hash and CPU model: layer, algorithm, "
+      << "mc, kc, nc" << std::endl;
+    for (auto const &line : kept) {
+      out << line << std::endl;
+    }
+    out << header << std::endl;
+    for (size_t i = 0; i < layers.size(); ++i) {
+      if (layers[i].type == LayerType::Convolutional) {
+        out << i << " " << algorithmName(tuning[i].algorithm) << " "
+          << tuning[i].blocking.mc << " " << tuning[i].blocking.kc << " "
+          << tuning[i].blocking.nc << std::endl;
+      }
+    }
+    out << "end" << std::endl;
+    out.flush();
+    if (!out) {
+      std::remove(temporary.c_str());
+      return false;
+    }
+  }
+  if (0 != std::rename(temporary.c_str(), file.c_str())) {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::vector<ConvTuning> loadConvTuning(std::string const &cfgFile,
+    ThreadPool &pool, bool retune)
+{
+  std::vector<Layer> const layers = YoloNetwork(cfgFile).layers();
+  TuningKey const key{cpuModelName(), hashCfgFile(cfgFile),
+    pool.threadCount()};
+  std::string const file = tuningFile(cfgFile);
+  std::string const fallback = fallbackCacheFile(file);
+  std::vector<ConvTuning> tuning;
+  if (!retune && (readTuning(file, key, layers, tuning)
+        || (!fallback.empty()
+          && readTuning(fallback, key, layers, tuning)))) {
+    return tuning;
+  }
+
+  std::clog << "Tuning the convolutions of '" << cfgFile << "' for "
+    << key.threads << " thread(s) on " << key.cpuModel << "." << std::endl;
+  tuning = tuneConvolutions(layers, pool);
+  if (!writeTuning(file, key, layers, tuning) && (fallback.empty()
+        || !writeTuning(fallback, key, layers, tuning))) {
+    std::clog << "Could not write the tuning file '" << file << "'."
+      << std::endl;
+  }
+  return tuning;
+}
+
+YoloNetwork loadTunedYoloNetwork(std::string const &cfgFile,
+    std::string const &weightFile, ThreadPool &pool, bool retune)
+{
+  uint64_t const sourceHash = hashModelSource(cfgFile, weightFile);
+  uint64_t const targetHash = hashTuningTarget(cpuModelName(),
+      pool.threadCount());
+  if (!retune) {
+    std::unique_ptr<YoloNetwork> cached = findModelCache(weightFile,
+        sourceHash, targetHash);
+    if (cached) {
+      return std::move(*cached);
+    }
+  }
+
+  YoloNetwork network(cfgFile);
+  network.loadWeights(weightFile, loadConvTuning(cfgFile, pool, retune));
+  storeModelCache(weightFile, sourceHash, targetHash, network);
+  return network;
+}
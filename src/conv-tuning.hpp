@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONV_TUNING
+#define CONV_TUNING
+
+#include "yolo-network.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+// What a tuning was measured for.
+struct TuningKey {
+  std::string cpuModel;
+  uint64_t cfgHash;
+  uint32_t threads;
+};
+
+// The CPU model as /proc/cpuinfo names it, or "unknown".
+std::string cpuModelName();
+
+// The tuning file of a cfg file, next to it.
+std::string tuningFile(std::string const &cfgFile);
+
+// Time the candidate algorithms and blockings of every convolution of the
+// layers on the pool and pick the fastest of each. Only the shapes of the
+// layers are used, with random weights and inputs, cut to a band of
+// output rows wide enough to keep every thread busy. Progress goes to
+// std::clog.
+std::vector<ConvTuning> tuneConvolutions(std::vector<Layer> const &layers,
+    ThreadPool &pool);
+
+// The tuning of a key in a tuning file, which holds one tuning per key as
+// text. Reading returns false if there is none for the key or it does not
+// fit the layers. Writing replaces the tuning of the key, keeps the
+// others, and returns false if the file could not be written.
+bool readTuning(std::string const &file, TuningKey const &key,
+    std::vector<Layer> const &layers, std::vector<ConvTuning> &tuning);
+bool writeTuning(std::string const &file, TuningKey const &key,
+    std::vector<Layer> const &layers, std::vector<ConvTuning> const &tuning);
+
+// The tuning of a cfg file for this CPU and the pool's thread count: from
+// the tuning file (or its fallbackCacheFile) if it has one and retune is
+// not set, otherwise measured and written there. Throws std::runtime_error
+// on a cfg file the network cannot use.
+std::vector<ConvTuning> loadConvTuning(std::string const &cfgFile,
+    ThreadPool &pool, bool retune);
+
+// The network of a cfg and weights file tuned for this CPU and the pool's
+// thread count. The model cache keeps it per CPU model and thread count, so
+// a start that finds it there reads neither the cfg nor the tuning file.
+// Otherwise, or with retune, it is loaded with loadConvTuning and cached.
+// Throws std::runtime_error on files the network cannot use.
+YoloNetwork loadTunedYoloNetwork(std::string const &cfgFile,
+    std::string const &weightFile, ThreadPool &pool, bool retune);
+#endif
@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "conv-winograd.hpp"
+#include "thread-pool.hpp"
+
+#include <algorithm>
+
+// Floats of scratch per thread that sizes the default run of tiles of a
+// task.
+static uint32_t const winogradScratchFloats = 1u << 20;
+
+static uint32_t roundUp(uint32_t value, uint32_t multiple)
+{
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+// Floats between the panels (or products) of consecutive tile points. The
+// transforms touch all 16 at once, so a power of two stride would map them
+// onto the same cache sets; a cache line more keeps them apart.
+static uint32_t pointStride(uint32_t rows, uint32_t columns)
+{
+  return rows * columns + 16;
+}
+
+bool winogradApplies(ConvShape const &shape)
+{
+  return shape.size == 3 && shape.stride == 1 && shape.pad == 1;
+}
+
+bool winogradSuits(ConvShape const &shape, uint32_t m)
+{
+  return winogradApplies(shape) && shape.c >= 16 && m >= 16;
+}
+
+GemmBlocking winogradBlocking(ConvShape const &shape, uint32_t m)
+{
+  GemmBlocking blocking;
+  blocking.nc = std::min(256u, std::max(gemmTileColumns,
+        winogradScratchFloats / (winogradPoints * (shape.c
+            + roundUp(m, gemmTileRows))) / gemmTileColumns
+        * gemmTileColumns));
+  return blocking;
+}
+
+PackedWeights WinogradWeights::point(uint32_t index) const
+{
+  PackedWeights packed;
+  packed.m = m;
+  packed.k = c;
+  packed.blocking = blocking;
+  packed.mapped = data() + index * packedSize(m, c);
+  return packed;
+}
+
+uint32_t winogradSize(uint32_t m, uint32_t c)
+{
+  return winogradPoints * packedSize(m, c);
+}
+
+WinogradWeights transformWeights(float const *weights, uint32_t m,
+    uint32_t c, GemmBlocking const &blocking)
+{
+  WinogradWeights transformed;
+  transformed.m = m;
+  transformed.c = c;
+  transformed.blocking = blocking;
+  transformed.storage.assign(winogradSize(m, c), 0.0f);
+  uint32_t const mPadded = roundUp(m, gemmTileRows);
+  uint32_t const pointSize = packedSize(m, c);
+
+  // Per tile point, G g G^T with G = [1 0 0; .5 .5 .5; .5 -.5 .5; 0 0 1],
+  // stored where packWeights would put element (f, ch) of its M x C
+  // matrix: a strip of gemmTileRows filters at a time, so each point gets
+  // whole columns of a strip.
+  for (uint32_t f0 = 0; f0 < m; f0 += gemmTileRows) {
+    uint32_t const rows = std::min(gemmTileRows, m - f0);
+    for (uint32_t ch = 0; ch < c; ++ch) {
+      float u[winogradPoints][gemmTileRows] = {};
+      for (uint32_t r = 0; r < rows; ++r) {
+        float const *g = weights + ((f0 + r) * c + ch) * 9;
+        float t[4][3];
+        for (uint32_t x = 0; x < 3; ++x) {
+          t[0][x] = g[x];
+          t[1][x] = 0.5f * (g[x] + g[3 + x] + g[6 + x]);
+          t[2][x] = 0.5f * (g[x] - g[3 + x] + g[6 + x]);
+          t[3][x] = g[6 + x];
+        }
+        for (uint32_t y = 0; y < 4; ++y) {
+          u[y * 4][r] = t[y][0];
+          u[y * 4 + 1][r] = 0.5f * (t[y][0] + t[y][1] + t[y][2]);
+          u[y * 4 + 2][r] = 0.5f * (t[y][0] - t[y][1] + t[y][2]);
+          u[y * 4 + 3][r] = t[y][2];
+        }
+      }
+      uint32_t const k0 = ch / blocking.kc * blocking.kc;
+      uint32_t const kLen = std::min(blocking.kc, c - k0);
+      float *out = transformed.storage.data() + k0 * mPadded + f0 * kLen
+        + (ch - k0) * gemmTileRows;
+      for (uint32_t i = 0; i < winogradPoints; ++i) {
+        std::copy(u[i], u[i] + gemmTileRows, out + i * pointSize);
+      }
+    }
+  }
+  return transformed;
+}
+
+static float leakyRelu(float v)
+{
+  return v < 0.0f ? 0.1f * v : v;
+}
+
+// B^T d B of the 4 x 4 input tiles [t0, t0 + count) of every channel, with
+// B^T = [1 0 -1 0; 0 1 1 0; 0 -1 1 0; 0 1 0 -1], into one panel per tile
+// point, packed as multiplyPackedPanel reads it. Taps outside the input
+// are zero.
+static void transformInput(float const *input, ConvShape const &s,
+    uint32_t kc, uint32_t tilesX, uint32_t t0, uint32_t count, float *tiles)
+{
+  uint32_t const countPadded = roundUp(count, gemmTileColumns);
+  uint32_t const pointSize = pointStride(s.c, countPadded);
+  int32_t const h = static_cast<int32_t>(s.h);
+  int32_t const w = static_cast<int32_t>(s.w);
+  for (uint32_t ch = 0; ch < s.c; ++ch) {
+    float const *plane = input + ch * s.h * s.w;
+    uint32_t const k0 = ch / kc * kc;
+    uint32_t const kLen = std::min(kc, s.c - k0);
+    float *row = tiles + k0 * countPadded + (ch - k0) * gemmTileColumns;
+    for (uint32_t j = count; j < countPadded; ++j) {
+      float *out = row + (j / gemmTileColumns) * gemmTileColumns * kLen
+        + j % gemmTileColumns;
+      for (uint32_t i = 0; i < winogradPoints; ++i) {
+        out[i * pointSize] = 0.0f;
+      }
+    }
+    uint32_t ty = t0 / tilesX;
+    uint32_t tx = t0 % tilesX;
+    for (uint32_t j = 0; j < count; ++j) {
+      int32_t const y0 = static_cast<int32_t>(ty) * 2 - 1;
+      int32_t const x0 = static_cast<int32_t>(tx) * 2 - 1;
+      if (++tx == tilesX) {
+        tx = 0;
+        ty++;
+      }
+      float *out = row + (j / gemmTileColumns) * gemmTileColumns * kLen
+        + j % gemmTileColumns;
+      float d[4][4];
+      if (y0 >= 0 && y0 + 4 <= h && x0 >= 0 && x0 + 4 <= w) {
+        for (int32_t y = 0; y < 4; ++y) {
+          float const *line = plane + (y0 + y) * w + x0;
+          for (int32_t x = 0; x < 4; ++x) {
+            d[y][x] = line[x];
+          }
+        }
+      } else {
+        for (int32_t y = 0; y < 4; ++y) {
+          for (int32_t x = 0; x < 4; ++x) {
+            bool const inside = y0 + y >= 0 && y0 + y < h && x0 + x >= 0
+              && x0 + x < w;
+            d[y][x] = inside ? plane[(y0 + y) * w + x0 + x] : 0.0f;
+          }
+        }
+      }
+      float r[4][4];
+      for (uint32_t x = 0; x < 4; ++x) {
+        r[0][x] = d[0][x] - d[2][x];
+        r[1][x] = d[1][x] + d[2][x];
+        r[2][x] = d[2][x] - d[1][x];
+        r[3][x] = d[1][x] - d[3][x];
+      }
+      for (uint32_t y = 0; y < 4; ++y) {
+        float *point = out + y * 4 * pointSize;
+        point[0] = r[y][0] - r[y][2];
+        point[pointSize] = r[y][1] + r[y][2];
+        point[2 * pointSize] = r[y][2] - r[y][1];
+        point[3 * pointSize] = r[y][1] - r[y][3];
+      }
+    }
+  }
+}
+
+// A^T m A of the products of tiles [t0, t0 + count), with A^T = [1 1 1 0;
+// 0 1 -1 -1], plus the epilogue, into the 2 x 2 output blocks inside the
+// output. The blocks of a filter are computed into blocks, one run per
+// block position, and then stored tile row by tile row.
+static void transformOutput(float const *products, uint32_t m,
+    ConvShape const &s, GemmEpilogue const &epilogue, uint32_t tilesX,
+    uint32_t t0, uint32_t count, float *output, float *blocks)
+{
+  uint32_t const ldc = roundUp(count, gemmTileColumns);
+  uint32_t const pointSize = pointStride(roundUp(m, gemmTileRows), ldc);
+  for (uint32_t f = 0; f < m; ++f) {
+    float const shift = (epilogue.bias != nullptr) ? epilogue.bias[f] : 0.0f;
+    float const *in = products + f * ldc;
+    for (uint32_t j = 0; j < count; ++j) {
+      float r[2][4];
+      for (uint32_t x = 0; x < 4; ++x) {
+        float const p1 = in[(4 + x) * pointSize + j];
+        float const p2 = in[(8 + x) * pointSize + j];
+        r[0][x] = in[x * pointSize + j] + p1 + p2;
+        r[1][x] = p1 - p2 - in[(12 + x) * pointSize + j];
+      }
+      for (uint32_t y = 0; y < 2; ++y) {
+        float const v0 = r[y][0] + r[y][1] + r[y][2] + shift;
+        float const v1 = r[y][1] - r[y][2] - r[y][3] + shift;
+        blocks[2 * y * ldc + j] = epilogue.leaky ? leakyRelu(v0) : v0;
+        blocks[(2 * y + 1) * ldc + j] = epilogue.leaky ? leakyRelu(v1) : v1;
+      }
+    }
+
+    float *plane = output + f * s.outH * s.outW;
+    uint32_t ty = t0 / tilesX;
+    uint32_t tx = t0 % tilesX;
+    for (uint32_t j = 0; j < count; ty++, tx = 0) {
+      uint32_t const run = std::min(tilesX - tx, count - j);
+      for (uint32_t y = 0; y < 2 && 2 * ty + y < s.outH; ++y) {
+        float *line = plane + (2 * ty + y) * s.outW + 2 * tx;
+        float const *left = blocks + 2 * y * ldc + j;
+        float const *right = left + ldc;
+        // The last tile of an odd width has only its left column inside.
+        uint32_t const pairs = (tx + run == tilesX && s.outW % 2 == 1)
+          ? run - 1 : run;
+        for (uint32_t i = 0; i < pairs; ++i) {
+          line[2 * i] = left[i];
+          line[2 * i + 1] = right[i];
+        }
+        if (pairs < run) {
+          line[2 * pairs] = left[pairs];
+        }
+      }
+      j += run;
+    }
+  }
+}
+
+void convolutionWinograd(WinogradWeights const &weights, float const *input,
+    ConvShape const &shape, GemmEpilogue const &epilogue, float *output,
+    ThreadPool &pool, std::vector<WinogradScratch> &scratch)
+{
+  uint32_t const m = weights.m;
+  uint32_t const mPadded = roundUp(m, gemmTileRows);
+  uint32_t const tilesX = (shape.outW + 1) / 2;
+  uint32_t const tileCount = tilesX * ((shape.outH + 1) / 2);
+
+  // Enough tasks for every thread.
+  uint32_t const threads = pool.threadCount();
+  uint32_t run = roundUp(std::max(1u, weights.blocking.nc),
+      gemmTileColumns);
+  while (run > gemmTileColumns && (tileCount + run - 1) / run < 4 * threads) {
+    run = roundUp(run / 2, gemmTileColumns);
+  }
+  uint32_t const tasks = (tileCount + run - 1) / run;
+  if (scratch.size() < threads) {
+    scratch.resize(threads);
+  }
+
+  pool.run(tasks, [&](uint32_t task, uint32_t thread) {
+      uint32_t const t0 = task * run;
+      uint32_t const count = std::min(run, tileCount - t0);
+      uint32_t const ldc = roundUp(count, gemmTileColumns);
+      std::vector<float> &tiles = scratch[thread].tiles;
+      std::vector<float> &products = scratch[thread].products;
+      uint32_t const tileStride = pointStride(shape.c, ldc);
+      uint32_t const productStride = pointStride(mPadded, ldc);
+      tiles.resize(std::max<size_t>(tiles.size(),
+            winogradPoints * tileStride));
+      products.resize(std::max<size_t>(products.size(),
+            winogradPoints * productStride));
+
+      transformInput(input, shape, weights.blocking.kc, tilesX, t0, count,
+          tiles.data());
+      for (uint32_t i = 0; i < winogradPoints; ++i) {
+        multiplyPackedPanel(weights.point(i), tiles.data() + i * tileStride,
+            count, products.data() + i * productStride, ldc);
+      }
+      std::vector<float> &blocks = scratch[thread].blocks;
+      blocks.resize(std::max<size_t>(blocks.size(), 4 * ldc));
+      transformOutput(products.data(), m, shape, epilogue, tilesX, t0, count,
+          output, blocks.data());
+    });
+}
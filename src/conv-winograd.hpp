@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONV_WINOGRAD
+#define CONV_WINOGRAD
+
+#include "conv-gemm.hpp"
+
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// Winograd F(2x2, 3x3): each 2 x 2 block of output is computed from a 4 x
+// 4 tile of input in 16 products instead of 36. Its transforms only take
+// sums, differences and halves, so it adds little rounding to the direct
+// convolution, unlike larger tiles.
+const uint32_t winogradTileSize = 4;
+const uint32_t winogradPoints = winogradTileSize * winogradTileSize;
+
+// Whether a convolution can run with Winograd: 3 x 3, stride 1 and same
+// padding.
+bool winogradApplies(ConvShape const &shape);
+
+// Whether it should, without measuring: if it applies and has enough input
+// channels and filters that the products, not the transforms, dominate.
+bool winogradSuits(ConvShape const &shape, uint32_t m);
+
+// The default blocking of the transformed weights of a convolution of M
+// filters, for the GEMM over the tile points. Only kc applies to Winograd;
+// nc is the number of input tiles per task, here as many as a thread's
+// scratch holds comfortably.
+GemmBlocking winogradBlocking(ConvShape const &shape, uint32_t m);
+
+// The 3 x 3 filters of a convolution transformed into the 4 x 4 tile
+// domain: per tile point, an M x C matrix (filters x input channels)
+// packed as the GEMM reads it, one after another. Held in storage, or
+// elsewhere (a mapped model cache) if mapped is set.
+struct WinogradWeights {
+  uint32_t m = 0;
+  uint32_t c = 0;
+  GemmBlocking blocking{};
+  std::vector<float> storage{};
+  float const *mapped = nullptr;
+
+  float const *data() const
+  {
+    return mapped != nullptr ? mapped : storage.data();
+  }
+
+  // The packed matrix of one tile point, pointing into this.
+  PackedWeights point(uint32_t index) const;
+};
+
+// Floats of the transformed weights of M filters over C channels.
+uint32_t winogradSize(uint32_t m, uint32_t c);
+
+// Transform M x (C * 9) weights in darknet's layout.
+WinogradWeights transformWeights(float const *weights, uint32_t m,
+    uint32_t c, GemmBlocking const &blocking);
+
+// Per pool thread buffers for the transformed input tiles, their products
+// with the weights and the output blocks of one filter.
+struct WinogradScratch {
+  std::vector<float> tiles{};
+  std::vector<float> products{};
+  std::vector<float> blocks{};
+};
+
+// As convolutionGemm for a shape that winogradApplies to. A task
+// transforms a run of input tiles (nc of the blocking, fewer if the
+// threads would otherwise run out of tasks), multiplies them by the
+// weights of each tile point and transforms the products back into output
+// blocks, applying the epilogue on the way.
+void convolutionWinograd(WinogradWeights const &weights, float const *input,
+    ConvShape const &shape, GemmEpilogue const &epilogue, float *output,
+    ThreadPool &pool, std::vector<WinogradScratch> &scratch);
+#endif
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "darknet-detector.hpp"
+#include "inference-profile.hpp"
+
+DarknetDetector::DarknetDetector(std::string const &cfgFile,
+    std::string const &weightFile):
+  m_detector(cfgFile, weightFile)
+{
+}
+
+uint32_t DarknetDetector::netWidth() const
+{
+  return static_cast<uint32_t>(m_detector.get_net_width());
+}
+
+uint32_t DarknetDetector::netHeight() const
+{
+  return static_cast<uint32_t>(m_detector.get_net_height());
+}
+
+std::vector<bbox_t> DarknetDetector::detect(image_t const &img,
+    float threshold, bool useMean)
+{
+  // Darknet runs the network and decodes the boxes in one call, so it is
+  // profiled as a single span.
+  int64_t const start = profileClock();
+  std::vector<bbox_t> boxes = m_detector.detect(img, threshold, useMean);
+  if (profile() != nullptr) {
+    profile()->record("darknet detect", "darknet", start, profileClock());
+  }
+  return boxes;
+}
+
+std::vector<bbox_t> DarknetDetector::trackingId(std::vector<bbox_t> boxes,
+    bool changeHistory, int32_t framesStory, int32_t maxDist)
+{
+  return m_detector.tracking_id(boxes, changeHistory, framesStory, maxDist);
+}
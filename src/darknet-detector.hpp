@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DARKNET_DETECTOR
+#define DARKNET_DETECTOR
+
+#include "detector-backend.hpp"
+
+// The darknet library's detector, on the GPU if darknet was built for it.
+class DarknetDetector : public DetectorBackend {
+ public:
+  DarknetDetector(std::string const &cfgFile, std::string const &weightFile);
+
+  uint32_t netWidth() const override;
+  uint32_t netHeight() const override;
+  std::vector<bbox_t> detect(image_t const &img, float threshold,
+      bool useMean) override;
+  std::vector<bbox_t> trackingId(std::vector<bbox_t> boxes,
+      bool changeHistory, int32_t framesStory, int32_t maxDist) override;
+
+ private:
+  Detector m_detector;
+};
+#endif
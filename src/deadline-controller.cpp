@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "deadline-controller.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <utility>
+
+// Weight of a new frame in the moving estimates.
+static double const estimateWeight = 0.25;
+// Frames made at a level before its estimates are acted on.
+static uint32_t const settleFrames = 8;
+// Share of the deadline the latency must fit in to give up a step.
+static double const headroom = 0.8;
+
+char const *degradationName(Degradation step)
+{
+  switch (step) {
+    case Degradation::NearestResize:
+      return "nearest resize";
+    case Degradation::SkipDepth:
+      return "no depth lookup";
+    case Degradation::SkipFarField:
+      return "no far-field pass";
+    case Degradation::HalveDetection:
+      return "detection half as often";
+  }
+  return "unknown";
+}
+
+DeadlineController::DeadlineController(int64_t deadlineUs,
+    std::vector<Degradation> steps):
+  m_deadlineUs(deadlineUs),
+  m_steps(std::move(steps)),
+  m_latencyBeforeUs(m_steps.size(), 0.0),
+  m_savedUs(m_steps.size(), -1.0)
+{
+}
+
+uint32_t DeadlineController::level() const
+{
+  return m_level.load();
+}
+
+bool DeadlineController::degraded(uint32_t level, Degradation step) const
+{
+  for (uint32_t i = 0; i < level && i < m_steps.size(); ++i) {
+    if (m_steps[i] == step) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool DeadlineController::update(uint32_t frameLevel,
+    FrameTiming const &timing, std::string &reason)
+{
+  uint32_t const level = m_level.load();
+  if (frameLevel != level) {
+    return false;
+  }
+  auto blend = [this](double &estimate, int64_t value) {
+    double const v = static_cast<double>(value);
+    estimate = m_frames == 0 ? v : estimate + estimateWeight * (v - estimate);
+  };
+  blend(m_estimate.latencyUs, timing.latencyUs);
+  blend(m_estimate.resizeUs, timing.resizeUs);
+  blend(m_estimate.detectUs, timing.detectUs);
+  blend(m_estimate.depthUs, timing.depthUs);
+  blend(m_estimate.publishUs, timing.publishUs);
+  if (++m_frames < settleFrames) {
+    return false;
+  }
+  if (level > 0 && m_savedUs[level - 1] < 0.0) {
+    m_savedUs[level - 1] = std::max(0.0,
+        m_latencyBeforeUs[level - 1] - m_estimate.latencyUs);
+  }
+
+  double const deadlineUs = static_cast<double>(m_deadlineUs);
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1);
+  if (m_estimate.latencyUs > deadlineUs) {
+    if (level == m_steps.size()) {
+      if (m_exhausted) {
+        return false;
+      }
+      m_exhausted = true;
+      out << "Latency " << m_estimate.latencyUs / 1000.0 << " ms is over the "
+        << deadlineUs / 1000.0 << " ms deadline with every degradation "
+        << "taken (" << stagesText() << ")";
+      reason = out.str();
+      return true;
+    }
+    out << "Taking " << degradationName(m_steps[level]) << ": latency "
+      << m_estimate.latencyUs / 1000.0 << " ms is over the "
+      << deadlineUs / 1000.0 << " ms deadline (" << stagesText() << ")";
+    m_latencyBeforeUs[level] = m_estimate.latencyUs;
+    m_savedUs[level] = -1.0;
+    switchTo(level + 1);
+    reason = out.str();
+    return true;
+  }
+  m_exhausted = false;
+  if (level > 0
+      && m_estimate.latencyUs + m_savedUs[level - 1] < headroom * deadlineUs) {
+    out << "Giving up " << degradationName(m_steps[level - 1])
+      << ": latency " << m_estimate.latencyUs / 1000.0 << " ms and the "
+      << m_savedUs[level - 1] / 1000.0 << " ms it saved fit under "
+      << headroom * 100.0 << "% of the " << deadlineUs / 1000.0
+      << " ms deadline (" << stagesText() << ")";
+    switchTo(level - 1);
+    reason = out.str();
+    return true;
+  }
+  return false;
+}
+
+std::string DeadlineController::stagesText() const
+{
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1) << "resize "
+    << m_estimate.resizeUs / 1000.0 << ", detect "
+    << m_estimate.detectUs / 1000.0 << ", depth "
+    << m_estimate.depthUs / 1000.0 << ", publish "
+    << m_estimate.publishUs / 1000.0 << " ms";
+  return out.str();
+}
+
+void DeadlineController::switchTo(uint32_t level)
+{
+  m_level.store(level);
+  m_frames = 0;
+}
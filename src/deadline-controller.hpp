@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEADLINE_CONTROLLER
+#define DEADLINE_CONTROLLER
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Cheaper ways to run a frame, taken on top of each other in this order
+// while frames miss their deadline.
+enum class Degradation {
+  // Nearest instead of the configured resize.
+  NearestResize,
+  // No depth lookup, the distance then comes from the box size.
+  SkipDepth,
+  // No far-field pass, the second run of the network.
+  SkipFarField,
+  // Run the network half as often and propagate the tracked boxes over the
+  // frames in between.
+  HalveDetection
+};
+
+char const *degradationName(Degradation step);
+
+// Times of a published frame.
+struct FrameTiming {
+  // From the sample time to publication.
+  int64_t latencyUs;
+  int64_t resizeUs;
+  // Detection, the far-field pass and tracking.
+  int64_t detectUs;
+  int64_t depthUs;
+  int64_t publishUs;
+};
+
+// Takes the next degradation while the moving estimate of the frame latency
+// is over the deadline, and gives the last one up again once the latency it
+// saved fits under the deadline with headroom. Frames are accounted from one
+// thread; the level may be read from any.
+class DeadlineController {
+ public:
+  DeadlineController(int64_t deadlineUs, std::vector<Degradation> steps);
+  DeadlineController(DeadlineController const &) = delete;
+  DeadlineController &operator=(DeadlineController const &) = delete;
+
+  // Number of degradations in effect, the first ones of the steps.
+  uint32_t level() const;
+
+  // Whether the step is in effect at the level.
+  bool degraded(uint32_t level, Degradation step) const;
+
+  // Account a frame made at the given level, ignoring frames made before
+  // the last switch. True if the level changed, or the frames are over the
+  // deadline with every step taken, with the reason.
+  bool update(uint32_t frameLevel, FrameTiming const &timing,
+      std::string &reason);
+
+ private:
+  struct Estimate {
+    double latencyUs;
+    double resizeUs;
+    double detectUs;
+    double depthUs;
+    double publishUs;
+  };
+
+  int64_t const m_deadlineUs;
+  std::vector<Degradation> const m_steps;
+  std::atomic<uint32_t> m_level{0};
+  Estimate m_estimate{0.0, 0.0, 0.0, 0.0, 0.0};
+  uint32_t m_frames{0};
+  bool m_exhausted{false};
+  // Per step, the latency estimate just before it was taken and the
+  // latency it saved, negative until known.
+  std::vector<double> m_latencyBeforeUs;
+  std::vector<double> m_savedUs;
+
+  std::string stagesText() const;
+  void switchTo(uint32_t level);
+};
+#endif
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "detection-merge.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+float boxOverlap(bbox_t const &a, bbox_t const &b)
+{
+  uint32_t const x0 = std::max(a.x, b.x);
+  uint32_t const y0 = std::max(a.y, b.y);
+  uint32_t const x1 = std::min(a.x + a.w, b.x + b.w);
+  uint32_t const y1 = std::min(a.y + a.h, b.y + b.h);
+  if (x1 <= x0 || y1 <= y0) {
+    return 0.0f;
+  }
+  float const intersection = static_cast<float>(x1 - x0)
+    * static_cast<float>(y1 - y0);
+  float const areaA = static_cast<float>(a.w) * static_cast<float>(a.h);
+  float const areaB = static_cast<float>(b.w) * static_cast<float>(b.h);
+  return intersection / (areaA + areaB - intersection);
+}
+
+void dropCroppedBoxes(std::vector<bbox_t> &boxes, SourceRect const &roi,
+    uint32_t width, uint32_t height)
+{
+  bool const left = roi.x > 0;
+  bool const top = roi.y > 0;
+  bool const right = roi.x + roi.w < width;
+  bool const bottom = roi.y + roi.h < height;
+  auto cropped = [&](bbox_t const &box) {
+    return (left && box.x <= roi.x)
+      || (top && box.y <= roi.y)
+      || (right && box.x + box.w >= roi.x + roi.w)
+      || (bottom && box.y + box.h >= roi.y + roi.h);
+  };
+  boxes.erase(std::remove_if(boxes.begin(), boxes.end(), cropped),
+      boxes.end());
+}
+
+std::vector<bbox_t> mergeDetections(std::vector<bbox_t> const &a,
+    std::vector<bbox_t> const &b, float maxOverlap)
+{
+  std::vector<bbox_t> all(a);
+  all.insert(all.end(), b.begin(), b.end());
+  std::stable_sort(all.begin(), all.end(),
+      [](bbox_t const &l, bbox_t const &r) { return l.prob > r.prob; });
+
+  std::vector<bbox_t> kept;
+  for (auto const &box : all) {
+    bool suppressed{false};
+    for (auto const &other : kept) {
+      if (other.obj_id == box.obj_id && boxOverlap(box, other) > maxOverlap) {
+        suppressed = true;
+        break;
+      }
+    }
+    if (!suppressed) {
+      kept.push_back(box);
+    }
+  }
+  return kept;
+}
+
+void compareDetections(std::vector<bbox_t> const &reference,
+    std::vector<bbox_t> const &others, float minOverlap, float maxProbDiff,
+    DetectionAgreement &agreement)
+{
+  for (auto const &box : reference) {
+    agreement.reference++;
+    float best{0.0f};
+    float probDiff{1.0f};
+    for (auto const &other : others) {
+      float const overlap = boxOverlap(box, other);
+      if (other.obj_id == box.obj_id && overlap > best) {
+        best = overlap;
+        probDiff = std::abs(other.prob - box.prob);
+      }
+    }
+    if (best > minOverlap && probDiff <= maxProbDiff) {
+      agreement.matched++;
+      agreement.overlapSum += best;
+      agreement.maxProbDiff = std::max(agreement.maxProbDiff, probDiff);
+    }
+  }
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DETECTION_MERGE
+#define DETECTION_MERGE
+
+#include "argb-resize.hpp"
+#include "yolo-types.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Intersection over union of two boxes.
+float boxOverlap(bbox_t const &a, bbox_t const &b);
+
+// Drop boxes touching an edge of the region of interest that is not also
+// an edge of the frame. Such boxes are cut off by the crop and the pass
+// over the whole frame sees the object in full.
+void dropCroppedBoxes(std::vector<bbox_t> &boxes, SourceRect const &roi,
+    uint32_t width, uint32_t height);
+
+// Merge the detections of two passes over the same frame. Of the boxes of
+// one class overlapping more than maxOverlap only the most probable is kept.
+std::vector<bbox_t> mergeDetections(std::vector<bbox_t> const &a,
+    std::vector<bbox_t> const &b, float maxOverlap);
+
+// How many boxes of a reference detector another detector also found, over
+// any number of frames.
+struct DetectionAgreement {
+  uint32_t reference = 0;
+  uint32_t matched = 0;
+  double overlapSum = 0.0;
+  float maxProbDiff = 0.0f;
+};
+
+// Count a reference box as matched if the best overlapping box of the same
+// class among others overlaps more than minOverlap with a probability
+// within maxProbDiff.
+void compareDetections(std::vector<bbox_t> const &reference,
+    std::vector<bbox_t> const &others, float minOverlap, float maxProbDiff,
+    DetectionAgreement &agreement);
+#endif
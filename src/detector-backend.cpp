@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "detector-backend.hpp"
+#include "native-detector.hpp"
+#if defined(HAVE_DARKNET)
+#include "darknet-detector.hpp"
+#endif
+
+#include <stdexcept>
+
+void DetectorBackend::setProfile(InferenceProfile *profile)
+{
+  m_profile = profile;
+}
+
+InferenceProfile *DetectorBackend::profile() const
+{
+  return m_profile;
+}
+
+std::vector<std::string> detectorBackendNames()
+{
+#if defined(HAVE_DARKNET)
+  return {"darknet", "native", "native-int8"};
+#else
+  return {"native", "native-int8"};
+#endif
+}
+
+std::unique_ptr<DetectorBackend> makeDetectorBackend(std::string const &name,
+    std::string const &cfgFile, std::string const &weightFile,
+    uint32_t threads, bool retune)
+{
+#if defined(HAVE_DARKNET)
+  if (name == "darknet") {
+    return std::unique_ptr<DetectorBackend>(
+        new DarknetDetector(cfgFile, weightFile));
+  }
+#endif
+  if (name == "native") {
+    return std::unique_ptr<DetectorBackend>(
+        new NativeDetector(cfgFile, weightFile, threads, "", retune));
+  }
+  if (name == "native-int8") {
+    return std::unique_ptr<DetectorBackend>(new NativeDetector(cfgFile,
+          weightFile, threads, inputRangesFile(weightFile), retune));
+  }
+  throw std::runtime_error("Detector backend '" + name
+      + "' is not available in this build");
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DETECTOR_BACKEND
+#define DETECTOR_BACKEND
+
+#include "yolo-types.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class InferenceProfile;
+
+// An object detector running a Yolo network on the planar RGB network
+// input, with the interface of darknet's Detector.
+class DetectorBackend {
+ public:
+  DetectorBackend() = default;
+  DetectorBackend(DetectorBackend const &) = delete;
+  DetectorBackend &operator=(DetectorBackend const &) = delete;
+  virtual ~DetectorBackend() = default;
+
+  virtual uint32_t netWidth() const = 0;
+  virtual uint32_t netHeight() const = 0;
+
+  // Detect objects in an image of the network input size. The boxes are in
+  // pixels of that image. useMean asks darknet to average its predictions
+  // over the last frames; other backends may ignore it.
+  virtual std::vector<bbox_t> detect(image_t const &img, float threshold,
+      bool useMean) = 0;
+
+  // Give the boxes the track id of the closest box of the same class in the
+  // last framesStory frames, if closer than maxDist pixels, or a new one.
+  virtual std::vector<bbox_t> trackingId(std::vector<bbox_t> boxes,
+      bool changeHistory, int32_t framesStory, int32_t maxDist) = 0;
+
+  // Record the spans of every later detect in the profile, broken down as
+  // far as the backend can (per layer, or detect as a whole), or stop
+  // recording given nullptr. The profile must outlive the detector.
+  void setProfile(InferenceProfile *profile);
+
+ protected:
+  InferenceProfile *profile() const;
+
+ private:
+  InferenceProfile *m_profile{nullptr};
+};
+
+// Names of the backends this build has, the first one being the default.
+std::vector<std::string> detectorBackendNames();
+
+// Load the network of the given cfg and weights file into the named
+// backend, running on up to the given number of CPU threads. native-int8
+// also needs the activation ranges next to the weights, as written by the
+// calibration tool. retune makes the native backends measure their
+// convolutions again rather than use the tuning file. Throws
+// std::runtime_error if the backend is not available or the files cannot be
+// used.
+std::unique_ptr<DetectorBackend> makeDetectorBackend(std::string const &name,
+    std::string const &cfgFile, std::string const &weightFile,
+    uint32_t threads, bool retune = false);
+#endif
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frame-acquire.hpp"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <stdexcept>
+
+static char *allocateAligned(uint32_t size)
+{
+  void *p{nullptr};
+  if (0 != posix_memalign(&p, 64, size)) {
+    throw std::bad_alloc();
+  }
+  return static_cast<char *>(p);
+}
+
+bool parseAcquireMode(std::string const &name, AcquireMode &mode)
+{
+  if (name == "direct") {
+    mode = AcquireMode::Direct;
+  } else if (name == "snapshot") {
+    mode = AcquireMode::Snapshot;
+  } else if (name == "sparse") {
+    mode = AcquireMode::Sparse;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+char const *acquireModeName(AcquireMode mode)
+{
+  switch (mode) {
+    case AcquireMode::Direct:
+      return "direct";
+    case AcquireMode::Snapshot:
+      return "snapshot";
+    case AcquireMode::Sparse:
+      return "sparse";
+  }
+  return "unknown";
+}
+
+FrameSnapshot::FrameSnapshot(uint32_t size, uint32_t rowBytes):
+  m_buffers{std::unique_ptr<char, FreeDeleter>(allocateAligned(size)),
+    std::unique_ptr<char, FreeDeleter>(allocateAligned(size))},
+  m_size(size),
+  m_rowBytes(rowBytes)
+{
+}
+
+char *FrameSnapshot::acquire(cluon::SharedMemory &shm,
+    std::vector<RowSpan> const &rows)
+{
+  char *dst = m_buffers[m_next].get();
+  m_next = 1 - m_next;
+
+  shm.lock();
+  cluon::data::TimeStamp const t0 = cluon::time::now();
+  {
+    char const *src = shm.data();
+    uint32_t const size = static_cast<uint32_t>(shm.size()) < m_size
+      ? static_cast<uint32_t>(shm.size()) : m_size;
+    if (rows.empty()) {
+      memcpy(dst, src, size);
+    } else {
+      for (auto const &span : rows) {
+        uint32_t const offset = span.begin * m_rowBytes;
+        uint32_t const bytes = span.count * m_rowBytes;
+        if (offset + bytes <= size) {
+          memcpy(dst + offset, src + offset, bytes);
+        }
+      }
+    }
+  }
+  m_sampleTimeUs = cluon::time::toMicroseconds(shm.getTimeStamp().second);
+  m_lockHoldUs = cluon::time::toMicroseconds(cluon::time::now())
+    - cluon::time::toMicroseconds(t0);
+  shm.unlock();
+  return dst;
+}
+
+char *FrameSnapshot::acquire(cluon::SharedMemory &shm,
+    SparseFetch const &fetch, char *fullFrame)
+{
+  char *dst = m_buffers[m_next].get();
+  m_next = 1 - m_next;
+
+  shm.lock();
+  cluon::data::TimeStamp const t0 = cluon::time::now();
+  {
+    gatherSparse(shm.data(), dst, m_rowBytes / 4, fetch);
+    if (fullFrame != nullptr) {
+      memcpy(fullFrame, shm.data(), shm.size());
+    }
+  }
+  m_sampleTimeUs = cluon::time::toMicroseconds(shm.getTimeStamp().second);
+  m_lockHoldUs = cluon::time::toMicroseconds(cluon::time::now())
+    - cluon::time::toMicroseconds(t0);
+  shm.unlock();
+  return dst;
+}
+
+int64_t FrameSnapshot::lockHoldUs() const
+{
+  return m_lockHoldUs;
+}
+
+int64_t FrameSnapshot::sampleTimeUs() const
+{
+  return m_sampleTimeUs;
+}
+
+static void readFrameFile(std::string const &file, uint32_t frameSize,
+    std::vector<std::vector<char>> &frames)
+{
+  std::ifstream in(file, std::ios::binary);
+  if (!in) {
+    throw std::runtime_error("Could not open '" + file + "'");
+  }
+  std::vector<char> frame(frameSize);
+  while (in.read(frame.data(), frameSize)) {
+    frames.push_back(frame);
+  }
+}
+
+std::vector<std::vector<char>> readRecordedFrames(std::string const &path,
+    uint32_t width, uint32_t height)
+{
+  uint32_t const frameSize = width * height * 4;
+  std::vector<std::vector<char>> frames;
+  struct stat info;
+  if (0 != stat(path.c_str(), &info)) {
+    throw std::runtime_error("Could not find '" + path + "'");
+  }
+  if (!S_ISDIR(info.st_mode)) {
+    readFrameFile(path, frameSize, frames);
+    return frames;
+  }
+
+  std::vector<std::string> files;
+  DIR *dir = opendir(path.c_str());
+  if (dir == nullptr) {
+    throw std::runtime_error("Could not open directory '" + path + "'");
+  }
+  while (struct dirent *entry = readdir(dir)) {
+    std::string const file = path + "/" + entry->d_name;
+    if (0 == stat(file.c_str(), &info) && S_ISREG(info.st_mode)) {
+      files.push_back(file);
+    }
+  }
+  closedir(dir);
+  std::sort(files.begin(), files.end());
+  for (auto const &file : files) {
+    readFrameFile(file, frameSize, frames);
+  }
+  return frames;
+}
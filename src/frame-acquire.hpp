@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_ACQUIRE
+#define FRAME_ACQUIRE
+
+#include "cluon-complete.hpp"
+#include "argb-resize.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class AcquireMode {
+  // Resize straight from the shared memory while holding its lock.
+  Direct,
+  // Copy the frame into a private buffer and release the lock at once.
+  Snapshot,
+  // Like snapshot, but copy only the sampled pixels into a compact frame.
+  Sparse
+};
+
+// Parse an --acquire value (direct, snapshot or sparse).
+bool parseAcquireMode(std::string const &name, AcquireMode &mode);
+
+char const *acquireModeName(AcquireMode mode);
+
+struct FreeDeleter {
+  void operator()(void *p) const { free(p); }
+};
+
+// Two process-local, cache-line aligned copies of the shared ARGB frame
+// used in turn. The shared memory lock is only held while copying, so the
+// producer can write the next frame while this one is preprocessed.
+class FrameSnapshot {
+ public:
+  FrameSnapshot(uint32_t size, uint32_t rowBytes);
+
+  // Lock the shared memory, copy the given source rows (the whole frame if
+  // empty) into the next buffer, unlock and return the buffer. Rows that
+  // are not copied keep stale data and must not be read.
+  char *acquire(cluon::SharedMemory &shm, std::vector<RowSpan> const &rows);
+
+  // Lock the shared memory, gather the pixels of the sparse fetch into the
+  // next buffer as a compact frame, unlock and return the buffer. If
+  // fullFrame is given the whole frame is also copied there while locked.
+  char *acquire(cluon::SharedMemory &shm, SparseFetch const &fetch,
+      char *fullFrame);
+
+  // Time the lock was held by the last acquire.
+  int64_t lockHoldUs() const;
+
+  // Sample time stamp the producer gave the frame of the last acquire.
+  int64_t sampleTimeUs() const;
+
+ private:
+  std::unique_ptr<char, FreeDeleter> m_buffers[2];
+  uint32_t m_size;
+  uint32_t m_rowBytes;
+  uint32_t m_next{0};
+  int64_t m_lockHoldUs{0};
+  int64_t m_sampleTimeUs{0};
+};
+
+// ARGB frames of the given size recorded back to back as they are in the
+// shared memory, from a file or from every file of a directory in name
+// order. A partial frame at the end of a file is ignored. Throws
+// std::runtime_error if the path cannot be read.
+std::vector<std::vector<char>> readRecordedFrames(std::string const &path,
+    uint32_t width, uint32_t height);
+#endif
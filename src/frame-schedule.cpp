@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frame-schedule.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+
+// Age histogram buckets below 1, 2, 4 ... 1024 ms and one for the rest.
+static uint32_t const ageBucketCount = 12;
+
+// Shortest time between two frames of a producer that does not stamp them.
+static int64_t const minFramePeriodUs = 1000;
+
+// How long the clock waits for the next frame to wake its thread once
+// stopped, before leaving the thread to stop on its own.
+static std::chrono::milliseconds const stopTimeout{1000};
+
+bool parseScheduleMode(std::string const &name, ScheduleMode &mode)
+{
+  if (name == "next") {
+    mode = ScheduleMode::Next;
+  } else if (name == "latest") {
+    mode = ScheduleMode::Latest;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+char const *scheduleModeName(ScheduleMode mode)
+{
+  switch (mode) {
+    case ScheduleMode::Next:
+      return "next";
+    case ScheduleMode::Latest:
+      return "latest";
+  }
+  return "unknown";
+}
+
+struct FrameClock::State {
+  explicit State(std::string const &name):
+    shm(new cluon::SharedMemory{name})
+  {
+  }
+
+  std::unique_ptr<cluon::SharedMemory> shm;
+  std::mutex mutex{};
+  std::condition_variable published{};
+  FrameTick latest{0, 0};
+  std::atomic<bool> stopped{false};
+  bool counting{true};
+
+  int64_t stampUs()
+  {
+    shm->lock();
+    int64_t const stamp{
+      cluon::time::toMicroseconds(shm->getTimeStamp().second)};
+    shm->unlock();
+    return stamp;
+  }
+
+  void stop()
+  {
+    stopped.store(true);
+    std::lock_guard<std::mutex> lock(mutex);
+    published.notify_all();
+  }
+};
+
+FrameClock::FrameClock(std::string const &name):
+  m_state(std::make_shared<State>(name)),
+  m_thread()
+{
+  std::shared_ptr<State> state = m_state;
+  m_thread = std::thread([state]() {
+      int64_t lastStampUs{state->stampUs()};
+      int64_t lastNotifiedUs{0};
+      bool stamped{false};
+      while (!state->stopped.load() && state->shm->valid()) {
+        state->shm->wait();
+        int64_t const now = cluon::time::toMicroseconds(cluon::time::now());
+        // The SysV wait of cluon returns for as long as a notification
+        // lasts, so a wake is only a new frame if the stamp moved on or,
+        // from a producer that does not stamp its frames, if it is not
+        // right after the last one.
+        int64_t const stampUs{state->stampUs()};
+        stamped = stamped || stampUs != lastStampUs;
+        if (stamped ? stampUs == lastStampUs
+            : now - lastNotifiedUs < minFramePeriodUs) {
+          std::this_thread::yield();
+          continue;
+        }
+        lastStampUs = stampUs;
+        lastNotifiedUs = now;
+        {
+          std::lock_guard<std::mutex> lock(state->mutex);
+          state->latest.sequence++;
+          state->latest.notifiedUs = now;
+        }
+        state->published.notify_all();
+      }
+      state->stopped.store(true);
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->counting = false;
+      state->published.notify_all();
+    });
+}
+
+FrameClock::~FrameClock()
+{
+  stop();
+  bool counting{false};
+  {
+    std::unique_lock<std::mutex> lock(m_state->mutex);
+    counting = !m_state->published.wait_for(lock, stopTimeout, [this]() {
+        return !m_state->counting;
+      });
+  }
+  if (counting) {
+    // No frame came to wake it, so it keeps the state until one does.
+    m_thread.detach();
+  } else {
+    m_thread.join();
+  }
+}
+
+FrameTick FrameClock::latest()
+{
+  std::lock_guard<std::mutex> lock(m_state->mutex);
+  return m_state->latest;
+}
+
+bool FrameClock::waitNewer(uint64_t sequence, FrameTick &tick)
+{
+  std::unique_lock<std::mutex> lock(m_state->mutex);
+  m_state->published.wait(lock, [this, sequence]() {
+      return m_state->latest.sequence > sequence || m_state->stopped.load();
+    });
+  tick = m_state->latest;
+  return tick.sequence > sequence;
+}
+
+void FrameClock::stop()
+{
+  m_state->stop();
+}
+
+FrameStats::FrameStats():
+  m_ages(ageBucketCount, 0),
+  m_frames(0),
+  m_dropped(0),
+  m_ageTotalUs(0),
+  m_ageMinUs(0),
+  m_ageMaxUs(0)
+{
+}
+
+void FrameStats::add(uint64_t dropped, int64_t ageUs)
+{
+  ageUs = std::max(ageUs, int64_t{0});
+  uint32_t bucket{0};
+  while (bucket + 1 < ageBucketCount && ageUs >= (int64_t{1000} << bucket)) {
+    bucket++;
+  }
+  m_ages[bucket]++;
+  m_ageMinUs = m_frames == 0 ? ageUs : std::min(m_ageMinUs, ageUs);
+  m_ageMaxUs = std::max(m_ageMaxUs, ageUs);
+  m_ageTotalUs += ageUs;
+  m_dropped += dropped;
+  m_frames++;
+}
+
+void FrameStats::print(std::ostream &out) const
+{
+  uint64_t const published = m_frames + m_dropped;
+  out << "Frames: " << m_frames << " processed, " << m_dropped
+    << " dropped (" << std::fixed << std::setprecision(1)
+    << (published == 0 ? 0.0 : 100.0 * static_cast<double>(m_dropped)
+        / static_cast<double>(published)) << "%)";
+  if (m_frames != 0) {
+    out << ", age " << m_ageMinUs / 1000.0 << " min, "
+      << static_cast<double>(m_ageTotalUs) / 1000.0
+        / static_cast<double>(m_frames) << " mean, "
+      << m_ageMaxUs / 1000.0 << " max ms";
+  }
+  out << std::defaultfloat << std::setprecision(6) << std::endl;
+  if (m_frames == 0) {
+    return;
+  }
+  out << "Age (ms):";
+  for (uint32_t i = 0; i < ageBucketCount; ++i) {
+    if (m_ages[i] != 0) {
+      out << " " << (i + 1 < ageBucketCount ? "<" : ">=")
+        << (1u << (i + 1 < ageBucketCount ? i : i - 1)) << ": " << m_ages[i];
+    }
+  }
+  out << std::endl;
+}
+
+void FrameStats::clear()
+{
+  std::fill(m_ages.begin(), m_ages.end(), 0);
+  m_frames = 0;
+  m_dropped = 0;
+  m_ageTotalUs = 0;
+  m_ageMinUs = 0;
+  m_ageMaxUs = 0;
+}
+
+uint64_t FrameStats::frames() const
+{
+  return m_frames;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_SCHEDULE
+#define FRAME_SCHEDULE
+
+#include "cluon-complete.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class ScheduleMode {
+  // Wait for the first frame published after the pipeline has room.
+  Next,
+  // Take the newest frame not yet taken at once, waiting only if there is
+  // none.
+  Latest
+};
+
+// Parse a --schedule value (next or latest).
+bool parseScheduleMode(std::string const &name, ScheduleMode &mode);
+
+char const *scheduleModeName(ScheduleMode mode);
+
+// A frame published into the shared memory: its number, counted from one,
+// and when the notification was seen.
+struct FrameTick {
+  uint64_t sequence;
+  int64_t notifiedUs;
+};
+
+// Counts the frames published into a shared memory on a thread of its own,
+// with an attachment of its own, so the frames the pipeline is too busy to
+// take are counted as well. Destroying the clock joins the thread once the
+// next frame wakes it, or leaves it to stop on its own if none comes within
+// a second. The clock never notifies the shared memory itself, which is the
+// producer's to signal.
+class FrameClock {
+ public:
+  explicit FrameClock(std::string const &name);
+  ~FrameClock();
+  FrameClock(FrameClock const &) = delete;
+  FrameClock &operator=(FrameClock const &) = delete;
+
+  // The last frame published, sequence 0 if none yet.
+  FrameTick latest();
+
+  // Wait for a frame after the given sequence number and return the
+  // newest. False if the clock is stopped first.
+  bool waitNewer(uint64_t sequence, FrameTick &tick);
+
+  void stop();
+
+ private:
+  struct State;
+  std::shared_ptr<State> m_state;
+  std::thread m_thread;
+};
+
+// Frames published and dropped and the age of each processed frame, from
+// its sample time to its publication, over some interval.
+class FrameStats {
+ public:
+  FrameStats();
+
+  void add(uint64_t dropped, int64_t ageUs);
+
+  // One line of counts and ages, then the age histogram.
+  void print(std::ostream &out) const;
+
+  void clear();
+
+  uint64_t frames() const;
+
+ private:
+  std::vector<uint64_t> m_ages;
+  uint64_t m_frames;
+  uint64_t m_dropped;
+  int64_t m_ageTotalUs;
+  int64_t m_ageMinUs;
+  int64_t m_ageMaxUs;
+};
+#endif
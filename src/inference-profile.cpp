@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "inference-profile.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <stdexcept>
+
+int64_t profileClock()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The latest spans kept for the trace, some minutes of frames.
+static size_t const traceCapacity{1 << 18};
+
+// Of a duration in the histogram of a series.
+static uint32_t bucketOf(int64_t duration)
+{
+  if (duration < 16) {
+    return static_cast<uint32_t>(std::max<int64_t>(duration, 0));
+  }
+  uint64_t const d = static_cast<uint64_t>(duration);
+  uint32_t const e = 63 - static_cast<uint32_t>(__builtin_clzll(d));
+  return (e - 3) * 16 + static_cast<uint32_t>((d >> (e - 4)) & 15);
+}
+
+// Middle of the durations of a bucket.
+static int64_t bucketMiddle(uint32_t bucket)
+{
+  if (bucket < 16) {
+    return bucket;
+  }
+  uint32_t const shift = bucket / 16 - 1;
+  int64_t const first = static_cast<int64_t>(16 + bucket % 16) << shift;
+  return first + ((int64_t{1} << shift) >> 1);
+}
+
+InferenceProfile::InferenceProfile(bool trace):
+  m_trace(trace),
+  m_origin(profileClock())
+{
+}
+
+uint32_t InferenceProfile::series(std::string const &name,
+    char const *category)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return findSeries(name, category);
+}
+
+void InferenceProfile::record(uint32_t series, int64_t start, int64_t end)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  add(series, start, end);
+}
+
+void InferenceProfile::record(char const *name, char const *category,
+    int64_t start, int64_t end)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto const found = m_literalIndex.find(name);
+  uint32_t series;
+  if (found != m_literalIndex.end()) {
+    series = found->second;
+  } else {
+    series = findSeries(name, category);
+    m_literalIndex.emplace(name, series);
+  }
+  add(series, start, end);
+}
+
+uint32_t InferenceProfile::findSeries(std::string const &name,
+    char const *category)
+{
+  auto const found = m_seriesIndex.find(name);
+  if (found != m_seriesIndex.end()) {
+    return found->second;
+  }
+  uint32_t const series = static_cast<uint32_t>(m_series.size());
+  m_series.push_back(Series{name, category, Histogram(), 0, 0,
+      std::numeric_limits<int64_t>::max(), 0});
+  m_series.back().histogram.fill(0);
+  m_seriesIndex.emplace(name, series);
+  return series;
+}
+
+void InferenceProfile::add(uint32_t series, int64_t start, int64_t end)
+{
+  int64_t const duration = end - start;
+  Series &s = m_series[series];
+  ++s.histogram[bucketOf(duration)];
+  ++s.count;
+  s.total += duration;
+  s.min = std::min(s.min, duration);
+  s.max = std::max(s.max, duration);
+
+  if (m_trace) {
+    std::thread::id const self = std::this_thread::get_id();
+    auto const thread = std::find(m_threads.begin(), m_threads.end(), self);
+    if (thread == m_threads.end()) {
+      m_threads.push_back(self);
+    }
+    Span const span{series,
+        static_cast<uint32_t>(thread - m_threads.begin()), start, duration};
+    if (m_spans.size() < traceCapacity) {
+      m_spans.push_back(span);
+    } else {
+      m_spans[m_spanCount % traceCapacity] = span;
+    }
+    ++m_spanCount;
+  }
+}
+
+void InferenceProfile::printTable(std::ostream &out) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  size_t nameWidth{4};
+  for (auto const &s : m_series) {
+    nameWidth = std::max(nameWidth, s.name.size());
+  }
+  std::ios::fmtflags const flags = out.flags();
+  out << std::left << std::setw(static_cast<int>(nameWidth)) << "Span"
+    << std::right << std::setw(8) << "count" << std::setw(10) << "min ms"
+    << std::setw(10) << "mean ms" << std::setw(10) << "p99 ms" << '\n';
+  out << std::fixed << std::setprecision(3);
+  for (auto const &s : m_series) {
+    if (s.count == 0) {
+      continue;
+    }
+    // Nearest rank, at the middle of its bucket.
+    uint64_t const rank = (s.count * 99 + 99) / 100;
+    uint64_t below{0};
+    uint32_t bucket{0};
+    while (below + s.histogram[bucket] < rank) {
+      below += s.histogram[bucket];
+      ++bucket;
+    }
+    int64_t const p99 = std::min(std::max(bucketMiddle(bucket), s.min),
+        s.max);
+    out << std::left << std::setw(static_cast<int>(nameWidth)) << s.name
+      << std::right << std::setw(8) << s.count
+      << std::setw(10) << static_cast<double>(s.min) / 1e6
+      << std::setw(10)
+      << static_cast<double>(s.total) / static_cast<double>(s.count) / 1e6
+      << std::setw(10) << static_cast<double>(p99) / 1e6 << '\n';
+  }
+  out.flags(flags);
+  out << std::flush;
+}
+
+static void writeJsonString(std::ostream &out, std::string const &s)
+{
+  out << '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      out << ' ';
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+}
+
+void InferenceProfile::writeTrace(std::string const &file) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::ofstream out(file);
+  if (!out) {
+    throw std::runtime_error("Could not write '" + file + "'");
+  }
+  // Times are in microseconds since the profile was created.
+  out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+  for (size_t i = 0; i < m_threads.size(); ++i) {
+    out << (i == 0 ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\","
+      << "\"pid\":1,\"tid\":" << i << ",\"args\":{\"name\":\"thread " << i
+      << "\"}}";
+  }
+  // Oldest first, from where the ring next writes once it is full.
+  size_t const first = m_spans.size() < traceCapacity ? 0
+    : static_cast<size_t>(m_spanCount % traceCapacity);
+  for (size_t i = 0; i < m_spans.size(); ++i) {
+    Span const &span = m_spans[(first + i) % m_spans.size()];
+    Series const &s = m_series[span.series];
+    out << ",\n{\"name\":";
+    writeJsonString(out, s.name);
+    out << ",\"cat\":";
+    writeJsonString(out, s.category);
+    out << ",\"ph\":\"X\",\"ts\":"
+      << static_cast<double>(span.start - m_origin) / 1e3 << ",\"dur\":"
+      << static_cast<double>(span.duration) / 1e3 << ",\"pid\":1,\"tid\":"
+      << span.thread << "}";
+  }
+  out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  if (!out) {
+    throw std::runtime_error("Could not write '" + file + "'");
+  }
+}
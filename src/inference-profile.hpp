@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INFERENCE_PROFILE
+#define INFERENCE_PROFILE
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Nanoseconds of the monotonic clock, for the spans of a profile.
+int64_t profileClock();
+
+// Spans of the inference, such as the layers of a network, timed with
+// profileClock. The durations of each name are counted in a histogram of
+// fixed size, for a table of their minimum, mean and 99th percentile. With
+// trace set the latest spans are kept as well, with their thread, to be
+// written as a Chrome trace. Spans may be recorded from any thread.
+class InferenceProfile {
+ public:
+  explicit InferenceProfile(bool trace = false);
+  InferenceProfile(InferenceProfile const &) = delete;
+  InferenceProfile &operator=(InferenceProfile const &) = delete;
+
+  // The series of spans of a name, for record. The category groups spans of
+  // the same kind (conv, maxpool, ...) in the trace.
+  uint32_t series(std::string const &name, char const *category);
+
+  // A span of a series from start to end on the calling thread.
+  void record(uint32_t series, int64_t start, int64_t end);
+
+  // A span from start to end on the calling thread, its series found by the
+  // address of name, which must outlive the profile (a string literal).
+  void record(char const *name, char const *category, int64_t start,
+      int64_t end);
+
+  // One line per name, in the order they were first recorded, of the span
+  // count and the minimum, mean and 99th percentile in ms.
+  void printTable(std::ostream &out) const;
+
+  // The spans as Chrome trace-event JSON, for chrome://tracing or Perfetto.
+  // Throws std::runtime_error if the file cannot be written.
+  void writeTrace(std::string const &file) const;
+
+ private:
+  // Of the durations in ns: exact below 16, above that 16 buckets for each
+  // power of two, so a bucket is within 1/16 of its durations.
+  using Histogram = std::array<uint32_t, 960>;
+  struct Series {
+    std::string name;
+    std::string category;
+    Histogram histogram;
+    uint64_t count;
+    int64_t total;
+    int64_t min;
+    int64_t max;
+  };
+  struct Span {
+    uint32_t series;
+    uint32_t thread;
+    int64_t start;
+    int64_t duration;
+  };
+
+  mutable std::mutex m_mutex{};
+  std::vector<Series> m_series{};
+  std::unordered_map<std::string, uint32_t> m_seriesIndex{};
+  std::unordered_map<char const *, uint32_t> m_literalIndex{};
+  std::vector<std::thread::id> m_threads{};
+  // A ring of the latest spans, m_spanCount of them recorded in all.
+  std::vector<Span> m_spans{};
+  uint64_t m_spanCount{0};
+  bool m_trace;
+  int64_t m_origin;
+
+  // With m_mutex held.
+  uint32_t findSeries(std::string const &name, char const *category);
+  void add(uint32_t series, int64_t start, int64_t end);
+};
+#endif
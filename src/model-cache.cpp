@@ -0,0 +1,425 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "model-cache.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+MappedFile::MappedFile(std::string const &file)
+{
+  int const fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Could not open '" + file + "'");
+  }
+  struct stat info;
+  if (0 != fstat(fd, &info) || info.st_size <= 0) {
+    close(fd);
+    throw std::runtime_error("Could not map the empty file '" + file + "'");
+  }
+  m_size = static_cast<size_t>(info.st_size);
+  m_data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (m_data == MAP_FAILED) {
+    m_data = nullptr;
+    throw std::runtime_error("Could not map '" + file + "'");
+  }
+}
+
+MappedFile::~MappedFile()
+{
+  if (m_data != nullptr) {
+    munmap(m_data, m_size);
+  }
+}
+
+char const *MappedFile::data() const
+{
+  return static_cast<char const *>(m_data);
+}
+
+size_t MappedFile::size() const
+{
+  return m_size;
+}
+
+// FNV-1a over 64-bit words, which keeps up with reading the weights.
+static uint64_t const hashPrime = 0x100000001b3ull;
+
+static uint64_t hashFile(uint64_t hash, std::string const &file)
+{
+  MappedFile const mapped(file);
+  char const *data = mapped.data();
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= mapped.size(); i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    hash = (hash ^ word) * hashPrime;
+  }
+  for (; i < mapped.size(); ++i) {
+    hash = (hash ^ static_cast<uint8_t>(data[i])) * hashPrime;
+  }
+  return (hash ^ mapped.size()) * hashPrime;
+}
+
+static uint64_t const hashBasis = 0xcbf29ce484222325ull;
+
+uint64_t hashModelSource(std::string const &cfgFile,
+    std::string const &weightFile)
+{
+  return hashFile(hashFile(hashBasis, cfgFile), weightFile);
+}
+
+uint64_t hashCfgFile(std::string const &cfgFile)
+{
+  return hashFile(hashBasis, cfgFile);
+}
+
+uint64_t hashTuningTarget(std::string const &cpuModel, uint32_t threads)
+{
+  uint64_t hash = hashBasis;
+  for (char c : cpuModel) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * hashPrime;
+  }
+  return (hash ^ threads) * hashPrime;
+}
+
+std::string modelCacheFile(std::string const &weightFile,
+    uint64_t tuningHash)
+{
+  char key[17];
+  snprintf(key, sizeof(key), "%016llx",
+      static_cast<unsigned long long>(tuningHash));
+  return weightFile + "." + key + ".cache";
+}
+
+std::string fallbackCacheFile(std::string const &file)
+{
+  char const *xdgCache = getenv("XDG_CACHE_HOME");
+  char const *home = getenv("HOME");
+  std::string directory;
+  if (xdgCache != nullptr && xdgCache[0] != '\0') {
+    directory = xdgCache;
+  } else if (home != nullptr && home[0] != '\0') {
+    directory = std::string(home) + "/.cache";
+  } else {
+    return "";
+  }
+  mkdir(directory.c_str(), 0755);
+  directory += "/opendlv-perception-detect-yolo";
+  mkdir(directory.c_str(), 0755);
+  size_t const slash = file.rfind('/');
+  return directory + "/"
+    + (slash == std::string::npos ? file : file.substr(slash + 1));
+}
+
+namespace {
+
+// The cache starts with this header, followed by one record per layer
+// (its geometry, small parameters and where its packed and Winograd
+// weights are, with their blocking) and, from blobOffset, those weights of
+// each convolution, every blob 64-byte aligned for the kernels. Values are
+// in host byte order.
+struct CacheHeader {
+  char magic[8];
+  uint64_t sourceHash;
+  uint64_t tuningHash;
+  uint32_t width;
+  uint32_t height;
+  uint32_t channels;
+  uint32_t layerCount;
+  uint64_t blobOffset;
+  uint64_t fileSize;
+};
+
+}
+
+static char const cacheMagic[8] = {'Y', 'O', 'L', 'O', 'M', 'C', '0', '3'};
+static uint64_t const cacheAlignment = 64;
+
+static uint64_t alignCache(uint64_t offset)
+{
+  return (offset + cacheAlignment - 1) / cacheAlignment * cacheAlignment;
+}
+
+template <typename T>
+static void put(std::vector<char> &out, T const &value)
+{
+  char const *bytes = reinterpret_cast<char const *>(&value);
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+static void putVector(std::vector<char> &out, std::vector<T> const &values)
+{
+  put(out, static_cast<uint32_t>(values.size()));
+  char const *bytes = reinterpret_cast<char const *>(values.data());
+  out.insert(out.end(), bytes, bytes + values.size() * sizeof(T));
+}
+
+template <typename T>
+static bool take(MappedFile const &file, size_t &offset, T &value)
+{
+  if (offset + sizeof(T) > file.size()) {
+    return false;
+  }
+  memcpy(&value, file.data() + offset, sizeof(T));
+  offset += sizeof(T);
+  return true;
+}
+
+template <typename T>
+static bool takeVector(MappedFile const &file, size_t &offset,
+    std::vector<T> &values)
+{
+  uint32_t count;
+  if (!take(file, offset, count)
+      || offset + count * sizeof(T) > file.size()) {
+    return false;
+  }
+  values.resize(count);
+  memcpy(values.data(), file.data() + offset, count * sizeof(T));
+  offset += count * sizeof(T);
+  return true;
+}
+
+static bool takeBlocking(MappedFile const &file, size_t &offset,
+    GemmBlocking &blocking)
+{
+  return take(file, offset, blocking.mc) && take(file, offset, blocking.kc)
+    && take(file, offset, blocking.nc) && blocking.mc >= gemmTileRows
+    && blocking.kc > 0 && blocking.nc > 0;
+}
+
+static void putBlocking(std::vector<char> &out, GemmBlocking const &blocking)
+{
+  put(out, blocking.mc);
+  put(out, blocking.kc);
+  put(out, blocking.nc);
+}
+
+std::unique_ptr<YoloNetwork> readModelCache(std::string const &cacheFile,
+    uint64_t sourceHash, uint64_t tuningHash)
+{
+  struct stat info;
+  if (0 != stat(cacheFile.c_str(), &info)) {
+    return nullptr;
+  }
+  std::shared_ptr<MappedFile const> mapping;
+  try {
+    mapping = std::make_shared<MappedFile const>(cacheFile);
+  } catch (std::runtime_error const &) {
+    return nullptr;
+  }
+
+  CacheHeader header;
+  size_t offset{0};
+  if (!take(*mapping, offset, header)
+      || 0 != memcmp(header.magic, cacheMagic, sizeof(cacheMagic))
+      || header.sourceHash != sourceHash
+      || header.tuningHash != tuningHash
+      || header.fileSize != mapping->size()) {
+    return nullptr;
+  }
+
+  std::vector<Layer> layers(header.layerCount);
+  for (auto &l : layers) {
+    uint32_t type;
+    uint32_t batchNormalize;
+    uint32_t activation;
+    uint64_t packedOffset;
+    uint64_t packedCount;
+    uint64_t winogradOffset;
+    uint64_t winogradCount;
+    if (!take(*mapping, offset, type) || !take(*mapping, offset, l.c)
+        || !take(*mapping, offset, l.h) || !take(*mapping, offset, l.w)
+        || !take(*mapping, offset, l.outC) || !take(*mapping, offset, l.outH)
+        || !take(*mapping, offset, l.outW) || !take(*mapping, offset, l.size)
+        || !take(*mapping, offset, l.stride) || !take(*mapping, offset, l.pad)
+        || !take(*mapping, offset, batchNormalize)
+        || !take(*mapping, offset, activation)
+        || !take(*mapping, offset, l.classes)
+        || !takeVector(*mapping, offset, l.biases)
+        || !takeVector(*mapping, offset, l.inputs)
+        || !takeVector(*mapping, offset, l.anchors)
+        || !takeVector(*mapping, offset, l.mask)
+        || !take(*mapping, offset, l.packed.m)
+        || !take(*mapping, offset, l.packed.k)
+        || !takeBlocking(*mapping, offset, l.packed.blocking)
+        || !take(*mapping, offset, packedOffset)
+        || !take(*mapping, offset, packedCount)
+        || !take(*mapping, offset, l.winograd.m)
+        || !take(*mapping, offset, l.winograd.c)
+        || !takeBlocking(*mapping, offset, l.winograd.blocking)
+        || !take(*mapping, offset, winogradOffset)
+        || !take(*mapping, offset, winogradCount)
+        || type > static_cast<uint32_t>(LayerType::Yolo)
+        || activation > static_cast<uint32_t>(Activation::Leaky)
+        || packedCount != packedSize(l.packed.m, l.packed.k)
+        || header.blobOffset + packedOffset + packedCount * sizeof(float)
+          > mapping->size()
+        || winogradCount != (l.winograd.m != 0
+          ? winogradSize(l.winograd.m, l.winograd.c) : 0)
+        || header.blobOffset + winogradOffset + winogradCount * sizeof(float)
+          > mapping->size()) {
+      return nullptr;
+    }
+    l.type = static_cast<LayerType>(type);
+    l.batchNormalize = (batchNormalize != 0);
+    l.activation = static_cast<Activation>(activation);
+    l.packed.mapped = reinterpret_cast<float const *>(mapping->data()
+        + header.blobOffset + packedOffset);
+    if (winogradCount != 0) {
+      l.winograd.mapped = reinterpret_cast<float const *>(mapping->data()
+          + header.blobOffset + winogradOffset);
+    }
+  }
+  if (offset > header.blobOffset) {
+    return nullptr;
+  }
+  return std::unique_ptr<YoloNetwork>(new YoloNetwork(header.width,
+        header.height, header.channels, std::move(layers), mapping));
+}
+
+bool writeModelCache(std::string const &cacheFile, uint64_t sourceHash,
+    uint64_t tuningHash, YoloNetwork const &network)
+{
+  std::vector<char> records;
+  uint64_t blobSize{0};
+  for (auto const &l : network.layers()) {
+    uint64_t const packedCount = packedSize(l.packed.m, l.packed.k);
+    uint64_t const winogradCount = (l.winograd.m != 0)
+      ? winogradSize(l.winograd.m, l.winograd.c) : 0;
+    put(records, static_cast<uint32_t>(l.type));
+    put(records, l.c);
+    put(records, l.h);
+    put(records, l.w);
+    put(records, l.outC);
+    put(records, l.outH);
+    put(records, l.outW);
+    put(records, l.size);
+    put(records, l.stride);
+    put(records, l.pad);
+    put(records, static_cast<uint32_t>(l.batchNormalize));
+    put(records, static_cast<uint32_t>(l.activation));
+    put(records, l.classes);
+    putVector(records, l.biases);
+    putVector(records, l.inputs);
+    putVector(records, l.anchors);
+    putVector(records, l.mask);
+    put(records, l.packed.m);
+    put(records, l.packed.k);
+    putBlocking(records, l.packed.blocking);
+    put(records, blobSize);
+    put(records, packedCount);
+    blobSize = alignCache(blobSize + packedCount * sizeof(float));
+    put(records, l.winograd.m);
+    put(records, l.winograd.c);
+    putBlocking(records, l.winograd.blocking);
+    put(records, blobSize);
+    put(records, winogradCount);
+    blobSize = alignCache(blobSize + winogradCount * sizeof(float));
+  }
+
+  CacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+  header.sourceHash = sourceHash;
+  header.tuningHash = tuningHash;
+  header.width = network.width();
+  header.height = network.height();
+  header.channels = network.channels();
+  header.layerCount = static_cast<uint32_t>(network.layers().size());
+  header.blobOffset = alignCache(sizeof(header) + records.size());
+  header.fileSize = header.blobOffset + blobSize;
+
+  std::string const temporary = cacheFile + ".tmp"
+    + std::to_string(getpid());
+  {
+    std::ofstream out(temporary, std::ios::binary);
+    std::vector<char> const padding(cacheAlignment, 0);
+    auto pad = [&out, &padding](uint64_t bytes) {
+      out.write(padding.data(), static_cast<std::streamsize>(
+            alignCache(bytes) - bytes));
+    };
+    out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    out.write(records.data(), static_cast<std::streamsize>(records.size()));
+    pad(sizeof(header) + records.size());
+    for (auto const &l : network.layers()) {
+      uint64_t const bytes = packedSize(l.packed.m, l.packed.k)
+        * sizeof(float);
+      out.write(reinterpret_cast<char const *>(l.packed.data()),
+          static_cast<std::streamsize>(bytes));
+      pad(bytes);
+      if (l.winograd.m != 0) {
+        uint64_t const winogradBytes = winogradSize(l.winograd.m,
+            l.winograd.c) * sizeof(float);
+        out.write(reinterpret_cast<char const *>(l.winograd.data()),
+            static_cast<std::streamsize>(winogradBytes));
+        pad(winogradBytes);
+      }
+    }
+    out.flush();
+    if (!out) {
+      std::remove(temporary.c_str());
+      return false;
+    }
+  }
+  if (0 != std::rename(temporary.c_str(), cacheFile.c_str())) {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<YoloNetwork> findModelCache(std::string const &weightFile,
+    uint64_t sourceHash, uint64_t tuningHash)
+{
+  std::string const cacheFile = modelCacheFile(weightFile, tuningHash);
+  std::unique_ptr<YoloNetwork> cached = readModelCache(cacheFile,
+      sourceHash, tuningHash);
+  std::string const fallback = fallbackCacheFile(cacheFile);
+  if (!cached && !fallback.empty()) {
+    cached = readModelCache(fallback, sourceHash, tuningHash);
+  }
+  return cached;
+}
+
+void storeModelCache(std::string const &weightFile, uint64_t sourceHash,
+    uint64_t tuningHash, YoloNetwork const &network)
+{
+  std::string const cacheFile = modelCacheFile(weightFile, tuningHash);
+  if (writeModelCache(cacheFile, sourceHash, tuningHash, network)) {
+    return;
+  }
+  std::string const fallback = fallbackCacheFile(cacheFile);
+  if (fallback.empty()
+      || !writeModelCache(fallback, sourceHash, tuningHash, network)) {
+    std::clog << "Could not write the model cache '" << cacheFile << "'."
+      << std::endl;
+  }
+}
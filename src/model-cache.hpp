@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODEL_CACHE
+#define MODEL_CACHE
+
+#include "yolo-network.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A whole file mapped read-only, unmapped on destruction. Throws
+// std::runtime_error if the file cannot be mapped.
+class MappedFile {
+ public:
+  explicit MappedFile(std::string const &file);
+  ~MappedFile();
+  MappedFile(MappedFile const &) = delete;
+  MappedFile &operator=(MappedFile const &) = delete;
+
+  char const *data() const;
+  size_t size() const;
+
+ private:
+  void *m_data{nullptr};
+  size_t m_size{0};
+};
+
+// Hash of the contents of a cfg and a weights file.
+uint64_t hashModelSource(std::string const &cfgFile,
+    std::string const &weightFile);
+
+// Hash of the contents of a cfg file alone.
+uint64_t hashCfgFile(std::string const &cfgFile);
+
+// Hash of the CPU model and thread count a network is tuned for, which
+// keys its model cache.
+uint64_t hashTuningTarget(std::string const &cpuModel, uint32_t threads);
+
+// The model cache of a weights file for a tuning hash, next to it. Each
+// tuning hash has a file of its own, so loaders of differently tuned
+// networks of the same weights do not replace each other's cache.
+std::string modelCacheFile(std::string const &weightFile,
+    uint64_t tuningHash);
+
+// Where a cache file that cannot be written next to its source goes
+// instead: the same name in opendlv-perception-detect-yolo under
+// $XDG_CACHE_HOME or ~/.cache, which is created. Empty if neither
+// $XDG_CACHE_HOME nor $HOME is set.
+std::string fallbackCacheFile(std::string const &file);
+
+// The network stored in a model cache, with its packed and Winograd weights
+// left in the mapped file, or null if the cache is missing or is not of the
+// given source and tuning hash or this version.
+std::unique_ptr<YoloNetwork> readModelCache(std::string const &cacheFile,
+    uint64_t sourceHash, uint64_t tuningHash);
+
+// Store a network with its weights loaded, as readModelCache maps it. The
+// file is written under a temporary name and renamed into place, so a
+// crash never leaves a partial cache. Returns false if it could not be
+// written.
+bool writeModelCache(std::string const &cacheFile, uint64_t sourceHash,
+    uint64_t tuningHash, YoloNetwork const &network);
+
+// As readModelCache and writeModelCache on the model cache of a weights
+// file and tuning hash, next to it or else in its fallbackCacheFile.
+// Storing logs to std::clog if neither can be written.
+std::unique_ptr<YoloNetwork> findModelCache(std::string const &weightFile,
+    uint64_t sourceHash, uint64_t tuningHash);
+void storeModelCache(std::string const &weightFile, uint64_t sourceHash,
+    uint64_t tuningHash, YoloNetwork const &network);
+#endif
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "native-detector.hpp"
+#include "conv-tuning.hpp"
+#include "inference-profile.hpp"
+#include "model-cache.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// Box overlap above which the less probable box of a class is suppressed,
+// darknet Detector's value.
+static float const nmsThreshold = 0.4f;
+
+NativeDetector::NativeDetector(std::string const &cfgFile,
+    std::string const &weightFile, uint32_t threads,
+    std::string const &rangesFile, bool retune):
+  m_pool(threads > 0 ? threads : 1, true),
+  m_network(loadTunedYoloNetwork(cfgFile, weightFile, m_pool, retune))
+{
+  if (!rangesFile.empty()) {
+    m_network.quantize(readInputRanges(rangesFile,
+          m_network.layers().size()));
+  }
+}
+
+uint32_t NativeDetector::netWidth() const
+{
+  return m_network.width();
+}
+
+uint32_t NativeDetector::netHeight() const
+{
+  return m_network.height();
+}
+
+std::vector<bbox_t> NativeDetector::detect(image_t const &img,
+    float threshold, bool)
+{
+  if (static_cast<uint32_t>(img.w) != m_network.width()
+      || static_cast<uint32_t>(img.h) != m_network.height()
+      || static_cast<uint32_t>(img.c) != m_network.channels()) {
+    throw std::runtime_error("Image does not match the network input size");
+  }
+  m_network.forward(img.data, m_pool, nullptr, profile());
+
+  int64_t const decodeStart = profileClock();
+  uint32_t classes{0};
+  for (auto const &l : m_network.layers()) {
+    if (l.type == LayerType::Yolo) {
+      classes = std::max(classes, l.classes);
+    }
+  }
+  m_candidates.clear(classes);
+  for (auto const &l : m_network.layers()) {
+    if (l.type == LayerType::Yolo) {
+      decodeYolo(l, m_network.width(), m_network.height(), threshold,
+          m_candidates);
+    }
+  }
+  suppressCandidates(m_candidates, nmsThreshold, m_suppression);
+
+  std::vector<bbox_t> boxes;
+  float const w = static_cast<float>(img.w);
+  float const h = static_cast<float>(img.h);
+  for (size_t i = 0; i < m_candidates.size(); ++i) {
+    float const *prob = m_candidates.prob(i);
+    float const *best = std::max_element(prob, prob + classes);
+    if (best == prob + classes || *best <= threshold) {
+      continue;
+    }
+    bbox_t box;
+    float const cw = m_candidates.w[i];
+    float const ch = m_candidates.h[i];
+    box.x = static_cast<unsigned int>(
+        std::max(0.0f, (m_candidates.x[i] - cw / 2) * w));
+    box.y = static_cast<unsigned int>(
+        std::max(0.0f, (m_candidates.y[i] - ch / 2) * h));
+    box.w = static_cast<unsigned int>(cw * w);
+    box.h = static_cast<unsigned int>(ch * h);
+    box.prob = *best;
+    box.obj_id = static_cast<unsigned int>(best - prob);
+    box.track_id = 0;
+    box.frames_counter = 0;
+    box.x_3d = NAN;
+    box.y_3d = NAN;
+    box.z_3d = NAN;
+    boxes.push_back(box);
+  }
+  if (profile() != nullptr) {
+    profile()->record("yolo decode", "yolo", decodeStart, profileClock());
+  }
+  return boxes;
+}
+
+std::vector<bbox_t> NativeDetector::trackingId(std::vector<bbox_t> boxes,
+    bool changeHistory, int32_t framesStory, int32_t maxDist)
+{
+  return m_tracker.track(boxes, changeHistory, framesStory, maxDist);
+}
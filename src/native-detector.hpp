@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NATIVE_DETECTOR
+#define NATIVE_DETECTOR
+
+#include "box-tracker.hpp"
+#include "detector-backend.hpp"
+#include "thread-pool.hpp"
+#include "yolo-decode.hpp"
+#include "yolo-network.hpp"
+
+// Runs the network in-tree on the CPU, without darknet or CUDA, on a pool
+// of the given number of pinned threads. Boxes are decoded and suppressed
+// as darknet's Detector does. Given a file of calibrated activation ranges
+// the network runs quantized to int8. The convolutions run as tuned for
+// this CPU and thread count, measured on first use of the cfg file (or if
+// retune is set) and kept in the tuning file next to it. The network is
+// loaded through the model cache next to the weights.
+class NativeDetector : public DetectorBackend {
+ public:
+  NativeDetector(std::string const &cfgFile, std::string const &weightFile,
+      uint32_t threads, std::string const &rangesFile = "",
+      bool retune = false);
+
+  uint32_t netWidth() const override;
+  uint32_t netHeight() const override;
+  std::vector<bbox_t> detect(image_t const &img, float threshold,
+      bool useMean) override;
+  std::vector<bbox_t> trackingId(std::vector<bbox_t> boxes,
+      bool changeHistory, int32_t framesStory, int32_t maxDist) override;
+
+ private:
+  ThreadPool m_pool;
+  YoloNetwork m_network;
+  BoxTracker m_tracker{};
+  YoloCandidates m_candidates{};
+  SuppressionScratch m_suppression{};
+};
+#endif
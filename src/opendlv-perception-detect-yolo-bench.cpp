@@ -0,0 +1,658 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cluon-complete.hpp"
+#include "argb-resize.hpp"
+#include "conv-gemm.hpp"
+#include "conv-tuning.hpp"
+#include "conv-winograd.hpp"
+#include "detection-merge.hpp"
+#include "detector-backend.hpp"
+#include "frame-acquire.hpp"
+#include "model-cache.hpp"
+#include "thread-pool.hpp"
+#include "yolo-decode.hpp"
+#include "yolo-network.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+static std::string getArgument(std::map<std::string, std::string> &args,
+    std::string const &key, std::string const &fallback)
+{
+  return args.count(key) != 0 ? args[key] : fallback;
+}
+
+static double elapsedUs(Clock::time_point t0)
+{
+  return std::chrono::duration<double, std::micro>(Clock::now() - t0)
+    .count();
+}
+
+// Distinct 64-byte cache lines of the source frame holding the given
+// pixels, i.e. what the memory system has to deliver for them.
+static uint64_t cacheLines(std::vector<int32_t> const &rows,
+    std::vector<int32_t> const &columns, uint32_t wSrc)
+{
+  uint64_t lines{0};
+  for (int32_t y : rows) {
+    int64_t last{-1};
+    for (int32_t x : columns) {
+      int64_t const line = (static_cast<int64_t>(y) * wSrc + x) * 4 / 64;
+      if (line != last) {
+        lines++;
+        last = line;
+      }
+    }
+  }
+  return lines;
+}
+
+static double median(std::vector<double> values)
+{
+  std::nth_element(values.begin(), values.begin() + values.size() / 2,
+      values.end());
+  return values[values.size() / 2];
+}
+
+// Bytes moved per frame to get the sampled pixels out of the shared frame
+// for every resize and acquire mode, and the time the copy takes (the time
+// the shared memory lock would be held). Before each run the frame is
+// written anew, as the producer does, so no mode finds it cached from the
+// run before. Times are medians.
+static void benchFetch(uint32_t width, uint32_t height, uint32_t netWidth,
+    uint32_t netHeight, uint32_t iterations)
+{
+  std::vector<char> shared(width * height * 4);
+  std::vector<char> staging(shared.size());
+  std::vector<float> net(netWidth * netHeight * 3);
+  ResizePlan const plan = makeResizePlan(width, height, netWidth, netHeight);
+  ResizeRowCache cache;
+
+  std::cout << "Frame " << width << "x" << height << " into " << netWidth
+    << "x" << netHeight << ", " << shared.size() << " bytes per frame"
+    << std::endl;
+  std::cout << std::left << std::setw(10) << "resize" << std::setw(10)
+    << "acquire" << std::right << std::setw(12) << "copied" << std::setw(12)
+    << "lines" << std::setw(12) << "touched" << std::setw(12) << "lock us"
+    << std::setw(12) << "resize us" << std::setw(12) << "vs snapshot"
+    << std::endl;
+
+  for (ResizeMode mode : {ResizeMode::Nearest, ResizeMode::Bilinear,
+      ResizeMode::Separable, ResizeMode::Area}) {
+    std::vector<RowSpan> const rows = resizeSourceRows(plan, mode);
+    SparseFetch const fetch = makeSparseFetch(plan, mode);
+    uint64_t const sampledLines = cacheLines(fetch.rows, fetch.columns,
+        width);
+
+    double snapshotLockUs{0.0};
+    for (std::string const acquire : {"snapshot", "direct", "sparse"}) {
+      uint64_t copied{0};
+      uint64_t lines{0};
+      std::vector<double> lockUs;
+      std::vector<double> resizeUs;
+      for (uint32_t n = 0; n < iterations; ++n) {
+        for (auto &c : shared) {
+          c = static_cast<char>(rand());
+        }
+        Clock::time_point const t0 = Clock::now();
+        if (acquire == "direct") {
+          resizeArgbToYoloImg(shared.data(), net.data(), plan, mode, cache,
+              0, netHeight);
+          lockUs.push_back(elapsedUs(t0));
+          resizeUs.push_back(lockUs.back());
+          lines = sampledLines;
+        } else if (acquire == "snapshot") {
+          copied = 0;
+          for (auto const &span : rows) {
+            uint32_t const offset = span.begin * width * 4;
+            memcpy(staging.data() + offset, shared.data() + offset,
+                span.count * width * 4);
+            copied += span.count * width * 4;
+          }
+          lockUs.push_back(elapsedUs(t0));
+          Clock::time_point const t1 = Clock::now();
+          resizeArgbToYoloImg(staging.data(), net.data(), plan, mode, cache,
+              0, netHeight);
+          resizeUs.push_back(elapsedUs(t1));
+          lines = copied / 64;
+        } else {
+          gatherSparse(shared.data(), staging.data(), width, fetch);
+          lockUs.push_back(elapsedUs(t0));
+          Clock::time_point const t1 = Clock::now();
+          resizeArgbToYoloImg(staging.data(), net.data(), fetch.plan, mode,
+              cache, 0, netHeight);
+          resizeUs.push_back(elapsedUs(t1));
+          copied = fetch.rows.size() * fetch.columns.size() * 4;
+          lines = sampledLines;
+        }
+      }
+      double const lock = median(lockUs);
+      if (acquire == "snapshot") {
+        snapshotLockUs = lock;
+      }
+      std::cout << std::left << std::setw(10) << resizeModeName(mode)
+        << std::setw(10) << acquire << std::right << std::setw(12) << copied
+        << std::setw(12) << lines << std::setw(12) << lines * 64
+        << std::setw(12) << std::fixed << std::setprecision(1) << lock
+        << std::setw(12) << median(resizeUs) << std::setw(11)
+        << std::setprecision(0) << 100.0 * lock / snapshotLockUs << "%"
+        << std::endl;
+    }
+  }
+  std::cout << "copied: bytes written to the private buffer, lines/touched: "
+    << "source cache lines read and their bytes, lock us: time the shared "
+    << "memory would be locked, vs snapshot: that time relative to the "
+    << "snapshot mode" << std::endl;
+}
+
+// Network inputs of the ARGB frames recorded back to back in a file (as
+// copied from the shared memory), or of one synthetic frame.
+static std::vector<std::vector<float>> loadFrames(std::string const &file,
+    uint32_t width, uint32_t height, uint32_t netWidth, uint32_t netHeight)
+{
+  std::vector<std::vector<char>> frames;
+  if (file.empty()) {
+    frames.emplace_back(width * height * 4);
+    for (auto &c : frames.back()) {
+      c = static_cast<char>(rand());
+    }
+  } else {
+    frames = readRecordedFrames(file, width, height);
+  }
+
+  ResizePlan const plan = makeResizePlan(width, height, netWidth, netHeight);
+  ResizeRowCache cache;
+  std::vector<std::vector<float>> inputs;
+  for (auto const &frame : frames) {
+    inputs.emplace_back(netWidth * netHeight * 3);
+    resizeArgbToYoloImg(frame.data(), inputs.back().data(), plan,
+        ResizeMode::Bilinear, cache, 0, netHeight);
+  }
+  return inputs;
+}
+
+// Frames per second of the native detector per thread count and, if this
+// build has darknet, how well its boxes match darknet's.
+static int32_t benchNetwork(std::string const &cfgFile,
+    std::string const &weightFile, std::string const &framesFile,
+    uint32_t width, uint32_t height, uint32_t maxThreads,
+    uint32_t iterations)
+{
+  std::vector<image_t> images;
+  std::vector<std::vector<float>> inputs;
+  std::vector<std::vector<bbox_t>> nativeBoxes;
+  double singleThreadMs{0.0};
+
+  try {
+    ActivationPlan const plan = YoloNetwork(cfgFile).activationPlan();
+    std::cout << "Activation memory " << std::fixed << std::setprecision(1)
+      << plan.size * sizeof(float) / 1e6 << " MB (one buffer per layer: "
+      << plan.unplannedSize * sizeof(float) / 1e6 << " MB)" << std::endl;
+  } catch (std::exception const &e) {
+    std::cerr << "Could not load the network: " << e.what() << "."
+      << std::endl;
+    return 1;
+  }
+  std::cout << "GEMM kernel " << gemmKernelName() << std::endl;
+  std::cout << std::setw(8) << "threads" << std::setw(12) << "ms/frame"
+    << std::setw(10) << "fps" << std::setw(10) << "speedup" << std::endl;
+  std::vector<uint32_t> threadCounts;
+  for (uint32_t t = 1; t < maxThreads; t *= 2) {
+    threadCounts.push_back(t);
+  }
+  threadCounts.push_back(maxThreads);
+
+  for (uint32_t threads : threadCounts) {
+    std::unique_ptr<DetectorBackend> detector;
+    try {
+      detector = makeDetectorBackend("native", cfgFile, weightFile, threads);
+    } catch (std::exception const &e) {
+      std::cerr << "Could not load the network: " << e.what() << "."
+        << std::endl;
+      return 1;
+    }
+    if (images.empty()) {
+      try {
+        inputs = loadFrames(framesFile, width, height, detector->netWidth(),
+            detector->netHeight());
+      } catch (std::exception const &e) {
+        std::cerr << e.what() << "." << std::endl;
+        return 1;
+      }
+      for (auto &input : inputs) {
+        images.push_back(image_t{static_cast<int>(detector->netHeight()),
+            static_cast<int>(detector->netWidth()), 3, input.data()});
+      }
+      if (images.empty()) {
+        std::cerr << "No frames in '" << framesFile << "'." << std::endl;
+        return 1;
+      }
+    }
+
+    nativeBoxes.clear();
+    for (auto const &image : images) {
+      nativeBoxes.push_back(detector->detect(image, 0.5f, false));
+    }
+    Clock::time_point const t0 = Clock::now();
+    for (uint32_t n = 0; n < iterations; ++n) {
+      detector->detect(images[n % images.size()], 0.5f, false);
+    }
+    double const ms = elapsedUs(t0) / 1000.0 / iterations;
+    if (threads == 1) {
+      singleThreadMs = ms;
+    }
+    std::cout << std::setw(8) << threads << std::fixed << std::setprecision(1)
+      << std::setw(12) << ms << std::setw(10) << 1000.0 / ms << std::setw(10)
+      << std::setprecision(2) << singleThreadMs / ms << std::endl;
+  }
+
+  auto const names = detectorBackendNames();
+  if (std::find(names.begin(), names.end(), "darknet") == names.end()) {
+    std::cout << "Built without darknet, detections not compared."
+      << std::endl;
+    return 0;
+  }
+  std::unique_ptr<DetectorBackend> darknet = makeDetectorBackend("darknet",
+      cfgFile, weightFile, 1);
+  DetectionAgreement agreement;
+  for (uint32_t i = 0; i < images.size(); ++i) {
+    compareDetections(darknet->detect(images[i], 0.5f, false),
+        nativeBoxes[i], 0.9f, 0.02f, agreement);
+  }
+  std::cout << "Matched " << agreement.matched << " of "
+    << agreement.reference << " darknet boxes over " << images.size()
+    << " frame(s) (IoU > 0.9 and probability within 0.02), mean IoU "
+    << (agreement.matched > 0 ? agreement.overlapSum / agreement.matched
+        : 0.0) << ", max probability difference " << agreement.maxProbDiff
+    << std::endl;
+  return 0;
+}
+
+static float randomUnit()
+{
+  return static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+}
+
+// GEMM against Winograd on every 3 x 3, stride 1 convolution of the cfg
+// files (comma separated), with random weights and inputs of the layer
+// shapes, and which of the two the detector picks.
+static int32_t benchLayers(std::string const &cfgFiles, uint32_t threads,
+    uint32_t iterations)
+{
+  ThreadPool pool(threads, false);
+  std::vector<GemmScratch> gemmScratch;
+  std::vector<WinogradScratch> winogradScratch;
+  std::cout << "GEMM kernel " << gemmKernelName() << ", " << threads
+    << " thread(s)" << std::endl;
+
+  std::stringstream list(cfgFiles);
+  std::string cfgFile;
+  while (std::getline(list, cfgFile, ',')) {
+    std::vector<Layer> layers;
+    try {
+      layers = YoloNetwork(cfgFile).layers();
+    } catch (std::exception const &e) {
+      std::cerr << "Could not load the network: " << e.what() << "."
+        << std::endl;
+      return 1;
+    }
+    std::cout << cfgFile << std::endl;
+    std::cout << std::setw(6) << "layer" << std::setw(8) << "input"
+      << std::setw(12) << "size" << std::setw(9) << "filters"
+      << std::setw(10) << "gemm ms" << std::setw(12) << "winograd ms"
+      << std::setw(9) << "speedup" << std::setw(11) << "rel error"
+      << std::setw(10) << "picked" << std::endl;
+    double gemmTotal{0.0};
+    double pickedTotal{0.0};
+    for (size_t i = 0; i < layers.size(); ++i) {
+      Layer const &l = layers[i];
+      if (l.type != LayerType::Convolutional || l.size != 3 || l.stride != 1
+          || l.pad != 1) {
+        continue;
+      }
+      ConvShape const shape{l.c, l.h, l.w, l.size, l.stride, l.pad, l.outH,
+        l.outW};
+      uint32_t const k = l.c * 9;
+      // Scaled as trained weights roughly are, to keep outputs near one.
+      float const scale = 2.0f / std::sqrt(static_cast<float>(k));
+      std::vector<float> weights(l.outC * k);
+      for (auto &w : weights) {
+        w = (randomUnit() - 0.5f) * scale;
+      }
+      std::vector<float> bias(l.outC, 0.1f);
+      std::vector<float> input(l.c * l.h * l.w);
+      for (auto &v : input) {
+        v = randomUnit();
+      }
+      PackedWeights const packed = packWeights(weights.data(), l.outC, k,
+          GemmBlocking());
+      WinogradWeights const winograd = transformWeights(weights.data(),
+          l.outC, l.c, winogradBlocking(shape, l.outC));
+      GemmEpilogue epilogue;
+      epilogue.bias = bias.data();
+      epilogue.leaky = (l.activation == Activation::Leaky);
+      std::vector<float> gemmOutput(l.outputSize());
+      std::vector<float> winogradOutput(l.outputSize());
+
+      convolutionGemm(packed, input.data(), shape, epilogue,
+          gemmOutput.data(), pool, gemmScratch);
+      Clock::time_point t0 = Clock::now();
+      for (uint32_t n = 0; n < iterations; ++n) {
+        convolutionGemm(packed, input.data(), shape, epilogue,
+            gemmOutput.data(), pool, gemmScratch);
+      }
+      double const gemmMs = elapsedUs(t0) / 1000.0 / iterations;
+      convolutionWinograd(winograd, input.data(), shape, epilogue,
+          winogradOutput.data(), pool, winogradScratch);
+      t0 = Clock::now();
+      for (uint32_t n = 0; n < iterations; ++n) {
+        convolutionWinograd(winograd, input.data(), shape, epilogue,
+            winogradOutput.data(), pool, winogradScratch);
+      }
+      double const winogradMs = elapsedUs(t0) / 1000.0 / iterations;
+
+      float maxError{0.0f};
+      float maxOutput{0.0f};
+      for (uint32_t j = 0; j < l.outputSize(); ++j) {
+        maxError = std::max(maxError,
+            std::abs(gemmOutput[j] - winogradOutput[j]));
+        maxOutput = std::max(maxOutput, std::abs(gemmOutput[j]));
+      }
+      bool const picked = winogradSuits(shape, l.outC);
+      gemmTotal += gemmMs;
+      pickedTotal += picked ? winogradMs : gemmMs;
+      std::cout << std::setw(6) << i << std::setw(8) << l.c << std::setw(12)
+        << (std::to_string(l.w) + "x" + std::to_string(l.h)) << std::setw(9)
+        << l.outC << std::fixed << std::setprecision(2) << std::setw(10)
+        << gemmMs << std::setw(12) << winogradMs << std::setw(9)
+        << gemmMs / winogradMs << std::scientific << std::setprecision(1)
+        << std::setw(11) << maxError / std::max(maxOutput, FLT_MIN)
+        << std::setw(10) << (picked ? "winograd" : "gemm") << std::endl;
+    }
+    std::cout << "Total " << std::fixed << std::setprecision(1) << gemmTotal
+      << " ms with GEMM only, " << pickedTotal << " ms as picked"
+      << std::endl;
+  }
+  return 0;
+}
+
+// Time to load the native detector and to its first detection, without
+// (cold) and with (warm) the model cache. The files themselves are in the
+// page cache either way after the first run.
+static int32_t benchStartup(std::string const &cfgFile,
+    std::string const &weightFile, uint32_t threads, uint32_t iterations)
+{
+  std::string const cacheFile = modelCacheFile(weightFile,
+      hashTuningTarget(cpuModelName(), threads > 0 ? threads : 1));
+  std::string const fallbackFile = fallbackCacheFile(cacheFile);
+  std::vector<float> input;
+  std::cout << std::setw(8) << "start" << std::setw(12) << "load ms"
+    << std::setw(20) << "first detection ms" << std::endl;
+  for (bool warm : {false, true}) {
+    double loadMs{0.0};
+    double firstMs{0.0};
+    for (uint32_t n = 0; n < iterations; ++n) {
+      if (!warm) {
+        std::remove(cacheFile.c_str());
+        std::remove(fallbackFile.c_str());
+      }
+      Clock::time_point const t0 = Clock::now();
+      std::unique_ptr<DetectorBackend> detector;
+      try {
+        detector = makeDetectorBackend("native", cfgFile, weightFile,
+            threads);
+      } catch (std::exception const &e) {
+        std::cerr << "Could not load the network: " << e.what() << "."
+          << std::endl;
+        return 1;
+      }
+      loadMs += elapsedUs(t0) / 1000.0;
+      input.resize(detector->netWidth() * detector->netHeight() * 3, 0.5f);
+      detector->detect(image_t{static_cast<int>(detector->netHeight()),
+          static_cast<int>(detector->netWidth()), 3, input.data()}, 0.5f,
+          false);
+      firstMs += elapsedUs(t0) / 1000.0;
+    }
+    std::cout << std::setw(8) << (warm ? "warm" : "cold") << std::fixed
+      << std::setprecision(1) << std::setw(12) << loadMs / iterations
+      << std::setw(20) << firstMs / iterations << std::endl;
+  }
+  return 0;
+}
+
+// Candidates of a cone-dense frame, as decoded before suppression: cones
+// spread over the ground in front of the camera, each found by a cluster
+// of one to six jittered boxes of its class, some also scoring another
+// class.
+static void makeConeCandidates(uint32_t count, uint32_t classes,
+    YoloCandidates &candidates)
+{
+  // Focal length in image widths, camera height and cone height in m.
+  float const focal{0.8f};
+  float const cameraHeight{0.9f};
+  float const coneHeight{0.33f};
+  candidates.clear(classes);
+  while (candidates.size() < count) {
+    float const lateral = 30.0f * (randomUnit() - 0.5f);
+    float const distance = 2.0f + 38.0f * randomUnit();
+    float const x = 0.5f + focal * lateral / distance;
+    float const y = 0.35f + focal * cameraHeight / distance;
+    float const h = focal * coneHeight / distance;
+    if (x < 0.0f || x > 1.0f || y > 1.0f) {
+      continue;
+    }
+    uint32_t const k = static_cast<uint32_t>(rand()) % classes;
+    uint32_t const boxes = 1 + static_cast<uint32_t>(rand()) % 6;
+    for (uint32_t b = 0; b < boxes && candidates.size() < count; ++b) {
+      float const jitter = 0.1f * (randomUnit() - 0.5f);
+      candidates.x.push_back(x + 0.6f * h * jitter);
+      candidates.y.push_back(y - h / 2.0f + h * jitter);
+      candidates.w.push_back(0.6f * h * (1.0f + 2.0f * jitter));
+      candidates.h.push_back(h * (1.0f - 2.0f * jitter));
+      for (uint32_t j = 0; j < classes; ++j) {
+        float const prob = (j == k || randomUnit() < 0.1f)
+          ? 0.25f + 0.75f * randomUnit() : 0.0f;
+        candidates.probs.push_back(prob);
+      }
+    }
+  }
+}
+
+// Darknet's suppression: per class, every box against every less probable
+// one.
+static void suppressPairwise(YoloCandidates &candidates, float nmsThreshold)
+{
+  std::vector<uint32_t> order(candidates.size());
+  for (uint32_t k = 0; k < candidates.classes; ++k) {
+    for (uint32_t i = 0; i < order.size(); ++i) {
+      order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(),
+        [&candidates, k](uint32_t a, uint32_t b) {
+          return candidates.prob(a)[k] > candidates.prob(b)[k];
+        });
+    for (uint32_t i = 0; i < order.size(); ++i) {
+      uint32_t const a = order[i];
+      if (!(candidates.prob(a)[k] > 0.0f)) {
+        continue;
+      }
+      for (uint32_t j = i + 1; j < order.size(); ++j) {
+        uint32_t const b = order[j];
+        float const w = std::min(candidates.x[a] + candidates.w[a] / 2.0f,
+            candidates.x[b] + candidates.w[b] / 2.0f)
+          - std::max(candidates.x[a] - candidates.w[a] / 2.0f,
+              candidates.x[b] - candidates.w[b] / 2.0f);
+        float const h = std::min(candidates.y[a] + candidates.h[a] / 2.0f,
+            candidates.y[b] + candidates.h[b] / 2.0f)
+          - std::max(candidates.y[a] - candidates.h[a] / 2.0f,
+              candidates.y[b] - candidates.h[b] / 2.0f);
+        if (w <= 0.0f || h <= 0.0f) {
+          continue;
+        }
+        float const intersection = w * h;
+        if (intersection / (candidates.w[a] * candidates.h[a]
+              + candidates.w[b] * candidates.h[b] - intersection) > nmsThreshold) {
+          candidates.prob(b)[k] = 0.0f;
+        }
+      }
+    }
+  }
+}
+
+// Darknet's pairwise suppression against the grid-bucketed one on
+// synthetic cone-dense candidate sets, and whether they keep the same
+// boxes.
+static int32_t benchNms(uint32_t iterations)
+{
+  uint32_t const classes{4};
+  float const nmsThreshold{0.4f};
+  std::cout << std::setw(8) << "boxes" << std::setw(8) << "kept"
+    << std::setw(14) << "pairwise us" << std::setw(10) << "grid us"
+    << std::setw(10) << "speedup" << std::setw(8) << "same" << std::endl;
+  int32_t result{0};
+  for (uint32_t count : {50u, 100u, 200u, 500u, 1000u, 2000u, 5000u}) {
+    YoloCandidates source;
+    makeConeCandidates(count, classes, source);
+    YoloCandidates pairwise = source;
+    YoloCandidates grid = source;
+    SuppressionScratch scratch;
+
+    double pairwiseUs{0.0};
+    double gridUs{0.0};
+    for (uint32_t n = 0; n < iterations; ++n) {
+      pairwise.probs = source.probs;
+      Clock::time_point const t0 = Clock::now();
+      suppressPairwise(pairwise, nmsThreshold);
+      pairwiseUs += elapsedUs(t0);
+
+      grid.probs = source.probs;
+      Clock::time_point const t1 = Clock::now();
+      suppressCandidates(grid, nmsThreshold, scratch);
+      gridUs += elapsedUs(t1);
+    }
+    uint32_t kept{0};
+    for (float prob : grid.probs) {
+      kept += prob > 0.0f ? 1 : 0;
+    }
+    bool const same = grid.probs == pairwise.probs;
+    if (!same) {
+      result = 1;
+    }
+    std::cout << std::setw(8) << count << std::setw(8) << kept << std::fixed
+      << std::setprecision(1) << std::setw(14) << pairwiseUs / iterations
+      << std::setw(10) << gridUs / iterations << std::setw(10)
+      << std::setprecision(2) << pairwiseUs / gridUs << std::setw(8)
+      << (same ? "yes" : "no") << std::endl;
+  }
+  std::cout << "kept: class probabilities left after suppression, same: "
+    << "whether both keep the same ones" << std::endl;
+  return result;
+}
+
+int32_t main(int32_t argc, char **argv) {
+  auto args = cluon::getCommandlineArguments(argc, argv);
+  if (args.count("help") != 0) {
+    std::cerr << argv[0] << " runs microbenchmarks of the detection "
+      << "pipeline on synthetic data." << std::endl;
+    std::cerr << "Usage:   " << argv[0] << " [--bench=fetch]" << std::endl;
+    std::cerr << "     --bench: fetch (bytes and time to get the sampled "
+      << "pixels out of the shared frame), network (native detector "
+      << "frames per second per thread count), layers (GEMM against "
+      << "Winograd per 3x3 convolution), startup (time to the first "
+      << "detection without and with the model cache) or nms (pairwise "
+      << "against grid-bucketed suppression of 50 to 5000 boxes)"
+      << std::endl;
+    std::cerr << "     --width, --height: frame size (default: 1920x1080)"
+      << std::endl;
+    std::cerr << "     --cfg-file, --weight-file: network (network, "
+      << "startup); cfg files, comma separated, for layers (default: "
+      << "custom.cfg,formula_3_classes.cfg)" << std::endl;
+    std::cerr << "     --frames: file, or directory of files, of recorded "
+      << "ARGB frames of the frame size, back to back (network, default: a "
+      << "synthetic frame)" << std::endl;
+    std::cerr << "     --threads: highest thread count (network, default: "
+      << "all cores), or thread count (layers, startup)" << std::endl;
+    std::cerr << "     --net-width, --net-height: network input size "
+      << "(default: 640x640)" << std::endl;
+    std::cerr << "     --iterations: runs to average (default: 20)"
+      << std::endl;
+    return 1;
+  }
+
+  std::string const bench{getArgument(args, "bench", "fetch")};
+  uint32_t const iterations{static_cast<uint32_t>(
+      std::stoi(getArgument(args, "iterations", "20")))};
+  if (bench == "fetch") {
+    benchFetch(static_cast<uint32_t>(
+          std::stoi(getArgument(args, "width", "1920"))),
+        static_cast<uint32_t>(std::stoi(getArgument(args, "height", "1080"))),
+        static_cast<uint32_t>(
+          std::stoi(getArgument(args, "net-width", "640"))),
+        static_cast<uint32_t>(
+          std::stoi(getArgument(args, "net-height", "640"))),
+        iterations);
+  } else if (bench == "network") {
+    return benchNetwork(getArgument(args, "cfg-file", "custom.cfg"),
+        getArgument(args, "weight-file", "custom.weights"),
+        getArgument(args, "frames", ""),
+        static_cast<uint32_t>(std::stoi(getArgument(args, "width", "1920"))),
+        static_cast<uint32_t>(
+          std::stoi(getArgument(args, "height", "1080"))),
+        static_cast<uint32_t>(std::stoi(getArgument(args, "threads",
+              std::to_string(std::max(1u,
+                  std::thread::hardware_concurrency()))))),
+        iterations);
+  } else if (bench == "layers") {
+    return benchLayers(getArgument(args, "cfg-file",
+          "custom.cfg,formula_3_classes.cfg"),
+        static_cast<uint32_t>(std::stoi(getArgument(args, "threads",
+              std::to_string(std::max(1u,
+                  std::thread::hardware_concurrency()))))),
+        iterations);
+  } else if (bench == "startup") {
+    return benchStartup(getArgument(args, "cfg-file", "custom.cfg"),
+        getArgument(args, "weight-file", "custom.weights"),
+        static_cast<uint32_t>(std::stoi(getArgument(args, "threads",
+              std::to_string(std::max(1u,
+                  std::thread::hardware_concurrency()))))),
+        iterations);
+  } else if (bench == "nms") {
+    return benchNms(iterations);
+  } else {
+    std::cerr << argv[0] << ": Unknown benchmark '" << bench << "'."
+      << std::endl;
+    return 1;
+  }
+  return 0;
+}
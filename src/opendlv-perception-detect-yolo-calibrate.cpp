@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cluon-complete.hpp"
+#include "argb-resize.hpp"
+#include "conv-int8.hpp"
+#include "conv-tuning.hpp"
+#include "detection-merge.hpp"
+#include "frame-acquire.hpp"
+#include "model-cache.hpp"
+#include "native-detector.hpp"
+#include "thread-pool.hpp"
+#include "yolo-network.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+static std::string getArgument(std::map<std::string, std::string> &args,
+    std::string const &key, std::string const &fallback)
+{
+  return args.count(key) != 0 ? args[key] : fallback;
+}
+
+// Run every frame through a detector, returning the milliseconds per frame.
+static double detectAll(DetectorBackend &detector,
+    std::vector<image_t> const &images, float threshold,
+    std::vector<std::vector<bbox_t>> &boxes)
+{
+  boxes.clear();
+  Clock::time_point const t0 = Clock::now();
+  for (auto const &image : images) {
+    boxes.push_back(detector.detect(image, threshold, false));
+  }
+  return std::chrono::duration<double, std::milli>(Clock::now() - t0)
+    .count() / static_cast<double>(images.size());
+}
+
+int32_t main(int32_t argc, char **argv) {
+  auto args = cluon::getCommandlineArguments(argc, argv);
+  if (args.count("help") != 0 || args.count("frames") == 0) {
+    std::cerr << argv[0] << " calibrates the int8 mode of the native "
+      << "detector: it records the range of every convolution's input over "
+      << "recorded frames, writes them next to the weights and compares "
+      << "the int8 detector to the float one on the same frames."
+      << std::endl;
+    std::cerr << "Usage:   " << argv[0] << " --frames=<file or directory> "
+      << "[--cfg-file=custom.cfg] [--weight-file=custom.weights] "
+      << "[--width=1920] [--height=1080]" << std::endl;
+    std::cerr << "     --frames: file, or directory of files, of ARGB "
+      << "frames recorded back to back as in the shared memory" << std::endl;
+    std::cerr << "     --width, --height: frame size (default: 1920x1080)"
+      << std::endl;
+    std::cerr << "     --resize: nearest, bilinear, separable or area, as "
+      << "given to the detector (default: nearest)" << std::endl;
+    std::cerr << "     --threads: threads running the network (default: "
+      << "all cores)" << std::endl;
+    std::cerr << "     --threshold: detection probability of the compared "
+      << "boxes (default: 0.5)" << std::endl;
+    std::cerr << "     --output: ranges file (default: the weights file "
+      << "name with .int8 appended, where the native-int8 backend reads it)"
+      << std::endl;
+    return 1;
+  }
+
+  std::string const cfgFile{getArgument(args, "cfg-file", "custom.cfg")};
+  std::string const weightFile{
+    getArgument(args, "weight-file", "custom.weights")};
+  std::string const output{
+    getArgument(args, "output", inputRangesFile(weightFile))};
+  uint32_t const width{static_cast<uint32_t>(
+      std::stoi(getArgument(args, "width", "1920")))};
+  uint32_t const height{static_cast<uint32_t>(
+      std::stoi(getArgument(args, "height", "1080")))};
+  uint32_t const threads{static_cast<uint32_t>(std::stoi(getArgument(args,
+          "threads", std::to_string(std::max(1u,
+              std::thread::hardware_concurrency())))))};
+  float const threshold{std::stof(getArgument(args, "threshold", "0.5"))};
+  ResizeMode resizeMode{ResizeMode::Nearest};
+  if (args.count("resize") != 0
+      && !parseResizeMode(args["resize"], resizeMode)) {
+    std::cerr << argv[0] << ": Unknown resize mode '" << args["resize"]
+      << "'." << std::endl;
+    return 1;
+  }
+
+  try {
+    std::vector<std::vector<char>> const frames =
+      readRecordedFrames(args["frames"], width, height);
+    if (frames.empty()) {
+      std::cerr << argv[0] << ": No frames in '" << args["frames"] << "'."
+        << std::endl;
+      return 1;
+    }
+
+    // Loaded as the float detectors below load it, so all three share its
+    // model cache.
+    ThreadPool pool(threads, true);
+    YoloNetwork network = loadTunedYoloNetwork(cfgFile, weightFile, pool,
+        false);
+    ResizePlan const plan = makeResizePlan(width, height, network.width(),
+        network.height());
+    std::vector<ResizeRowCache> caches;
+    std::vector<std::vector<float>> inputs;
+    std::vector<float> ranges;
+    for (auto const &frame : frames) {
+      inputs.emplace_back(network.width() * network.height() * 3);
+      resizeArgbToYoloImg(frame.data(), inputs.back().data(), plan,
+          resizeMode, pool, caches);
+      network.forward(inputs.back().data(), pool, &ranges);
+    }
+    writeInputRanges(output, ranges);
+    std::cout << "Wrote the input ranges of " << frames.size()
+      << " frame(s) to " << output << std::endl;
+
+    std::vector<image_t> images;
+    for (auto &input : inputs) {
+      images.push_back(image_t{static_cast<int>(network.height()),
+          static_cast<int>(network.width()), 3, input.data()});
+    }
+    std::vector<std::vector<bbox_t>> floatBoxes;
+    std::vector<std::vector<bbox_t>> int8Boxes;
+    double floatMs{0.0};
+    double int8Ms{0.0};
+    {
+      NativeDetector detector(cfgFile, weightFile, threads);
+      detectAll(detector, images, threshold, floatBoxes);
+      floatMs = detectAll(detector, images, threshold, floatBoxes);
+    }
+    {
+      NativeDetector detector(cfgFile, weightFile, threads, output);
+      detectAll(detector, images, threshold, int8Boxes);
+      int8Ms = detectAll(detector, images, threshold, int8Boxes);
+    }
+
+    DetectionAgreement agreement;
+    for (size_t i = 0; i < images.size(); ++i) {
+      compareDetections(floatBoxes[i], int8Boxes[i], 0.7f, 0.1f, agreement);
+    }
+    std::cout << std::fixed << std::setprecision(1) << "float " << floatMs
+      << " ms/frame, int8 (" << int8KernelName() << ") " << int8Ms
+      << " ms/frame on " << threads << " thread(s)" << std::endl;
+    std::cout << std::setprecision(3) << "int8 matched " << agreement.matched
+      << " of " << agreement.reference << " float boxes (IoU > 0.7 and "
+      << "probability within 0.1), mean IoU " << (agreement.matched > 0
+          ? agreement.overlapSum / agreement.matched : 0.0)
+      << ", max probability difference " << agreement.maxProbDiff
+      << std::endl;
+  } catch (std::exception const &e) {
+    std::cerr << argv[0] << ": " << e.what() << "." << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -15,66 +15,30 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <thread>
 
 #include <X11/Xlib.h>
 
-#include <yolo_v2_class.hpp>
-
 #include "cluon-complete.hpp"
 #include "opendlv-standard-message-set.hpp"
+#include "argb-resize.hpp"
 #include "birdview-perception.hpp"
-
-static uint8_t getPixelExtendArgb(char *img, uint32_t w, uint32_t h, int32_t x,
-    int32_t y, uint32_t c)
-{
-    if (x < 0 || x >= static_cast<int32_t>(w) || y < 0
-        || y >= static_cast<int32_t>(h)) {
-      return 0.0f;
-    }
-    return static_cast<uint8_t>(img[y * w * 4 + x * 4 + c]);
-}
-
-static float bilinearInterpolationArgb(char *img, uint32_t w, uint32_t h,
-    float x, float y, uint32_t c)
-{
-  uint32_t ix = static_cast<uint32_t>(floorf(x));
-  uint32_t iy = static_cast<uint32_t>(floorf(y));
-
-  float dx = x - ix;
-  float dy = y - iy;
-
-  return (1 - dy) * (1 - dx) * getPixelExtendArgb(img, w, h, ix, iy, c)
-    + dy * (1 - dx) * getPixelExtendArgb(img, w, h, ix, iy + 1, c)
-    + (1 - dy) * dx * getPixelExtendArgb(img, w, h, ix + 1, iy, c)
-    + dy * dx * getPixelExtendArgb(img, w, h, ix + 1, iy + 1, c);
-}
-
-static void resizeArgbToYoloImg(char *imgSrc, float *imgDst, uint32_t wSrc,
-    uint32_t hSrc, uint32_t wDst, uint32_t hDst, float wRatio, float hRatio,
-    bool interpolate)
-{
-  for (uint32_t c = 0; c < 3; ++c) {
-    for (uint32_t j = 0; j < hDst; ++j) {
-      for (uint32_t i = 0; i < wDst; ++i) {
-        float v;
-        if (interpolate) {
-          v = bilinearInterpolationArgb(imgSrc, wSrc, hSrc, i * wRatio,
-              j * hRatio, 2 - c);
-        } else {
-          v = getPixelExtendArgb(imgSrc, wSrc, hSrc,
-            static_cast<uint32_t>(i * wRatio),
-            static_cast<uint32_t>(j * hRatio), 2 - c);
-        }
-        imgDst[c * wDst * hDst + j * wDst + i] = v / 255.0f;
-      }
-    }
-  }
-}
+#include "box-propagator.hpp"
+#include "deadline-controller.hpp"
+#include "detection-merge.hpp"
+#include "detector-backend.hpp"
+#include "frame-acquire.hpp"
+#include "frame-schedule.hpp"
+#include "inference-profile.hpp"
+#include "spsc-queue.hpp"
+#include "thread-pool.hpp"
 
 static void drawBoxArgb(char *img, uint32_t width, uint32_t i0, uint32_t j0,
     uint32_t w, uint32_t h, uint8_t r, uint8_t g, uint8_t b)
@@ -154,11 +118,83 @@ int32_t main(int32_t argc, char **argv) {
     std::cerr << "     --height: the height of the images " << std::endl;
     std::cerr << "     --camera: on car: '0', in office: '1' " << std::endl;
     std::cerr << "     --id: sender id of output messages" << std::endl;
+    std::cerr << "     --backend: detector running the network, one of";
+    for (auto const &backendName : detectorBackendNames()) {
+      std::cerr << " " << backendName;
+    }
+    std::cerr << " (default: " << detectorBackendNames()[0] << ")"
+      << std::endl;
+    std::cerr << "     --threshold: objectness and class probability a "
+      << "detection needs (default: 0.5)" << std::endl;
+    std::cerr << "     --inference-threads: threads running the native "
+      << "detector, pinned to their own cores (default: all cores)"
+      << std::endl;
+    std::cerr << "     --retune: measure the convolutions of the native "
+      << "detector again instead of using the tuning file next to the cfg "
+      << "file" << std::endl;
+    std::cerr << "     --resize: nearest, bilinear, separable (bilinear in "
+      << "two fixed-point passes) or area (block mean) scaling into the "
+      << "network input (default: nearest)" << std::endl;
+    std::cerr << "     --preprocess-threads: threads resizing the frame, "
+      << "pinned to the cores after those of the native detector if any are "
+      << "left (default: 1)" << std::endl;
+    std::cerr << "     --acquire: snapshot (copy the sampled rows and release "
+      << "the shared memory at once), sparse (copy only the sampled pixels, "
+      << "which only locks it shorter at a large downscale, see the fetch "
+      << "bench) or direct (resize while holding the lock) (default: "
+      << "snapshot)" << std::endl;
+    std::cerr << "     --schedule: next (wait for the first frame published "
+      << "once there is room for one) or latest (take the newest frame not "
+      << "yet taken at once) (default: next)" << std::endl;
+    std::cerr << "     --stats-every: print the processed and dropped frames "
+      << "and their ages every n seconds, 0 to disable (default: 10)"
+      << std::endl;
+    std::cerr << "     --deadline-ms: latency budget of a frame from its "
+      << "sample time to publication; while it is missed the frame is run "
+      << "cheaper, step by step: nearest resize, no depth lookup, no "
+      << "far-field pass, detection half as often (default: none)"
+      << std::endl;
+    std::cerr << "     --detect-every: run the network on every n-th frame "
+      << "and carry the tracked boxes over to the frames in between with a "
+      << "constant-velocity Kalman filter (default: 1)" << std::endl;
+    std::cerr << "     --align: also correct the carried boxes by matching "
+      << "the patch each was detected in against the frame at hand"
+      << std::endl;
+    std::cerr << "     --letterbox: keep the aspect ratio and pad the "
+      << "network input instead of stretching the frame" << std::endl;
+    std::cerr << "     --roi-top: first frame row given to the network, or "
+      << "'horizon' to derive it from --camera-height and --camera-pitch "
+      << "(default: 0)" << std::endl;
+    std::cerr << "     --roi-bottom: frame row below the last one given to "
+      << "the network (default: height)" << std::endl;
+    std::cerr << "     --roi-margin: rows kept above the horizon (default: "
+      << "height / 20)" << std::endl;
+    std::cerr << "     --camera-height: camera height above the ground in m"
+      << std::endl;
+    std::cerr << "     --camera-pitch: downward camera tilt in degrees "
+      << "(default: 0)" << std::endl;
+    std::cerr << "     --far-every: run a second pass on a crop around the "
+      << "vanishing point every n-th frame, 0 to disable (default: 0)"
+      << std::endl;
+    std::cerr << "     --far-width, --far-height: size of the far-field crop "
+      << "in frame pixels (default: network input size)" << std::endl;
+    std::cerr << "     --profile: time every stage of the frame and every "
+      << "layer of the network (or darknet as a whole) and print the min, "
+      << "mean and p99 of each on exit" << std::endl;
+    std::cerr << "     --profile-trace: also write the spans to this file as "
+      << "Chrome trace-event JSON (implies --profile)" << std::endl;
     std::cerr << "     --verbose: prints diagnostics data to screen"
       << std::endl;
     std::cerr << "Example: " << argv[0] << " --cfg-file=yolo.cfg "
       << "--weight-file=yolo.weight --width=1280 --height=720 --camera=0 [--name=video0] "
-      << "[--name-depth=video0-depth] [--id=0] [--verbose]" << std::endl;
+      << "[--name-depth=video0-depth] [--id=0] [--backend=native] "
+      << "[--threshold=0.5] "
+      << "[--resize=nearest] "
+      << "[--preprocess-threads=1] [--acquire=snapshot] [--schedule=latest] "
+      << "[--deadline-ms=60] [--detect-every=3 --align] [--letterbox] "
+      << "[--roi-top=horizon --camera-height=0.9] [--far-every=2] "
+      << "[--profile-trace=trace.json] [--verbose]"
+      << std::endl;
   } else
   {
     std::string const name{(commandlineArguments["name"].size() != 0) ?
@@ -176,19 +212,133 @@ int32_t main(int32_t argc, char **argv) {
     uint32_t const id{(commandlineArguments["id"].size() != 0) ?
       static_cast<uint32_t>(std::stoi(commandlineArguments["id"])) : 0};
     bool const verbose{commandlineArguments.count("verbose") != 0};
+    bool const letterbox{commandlineArguments.count("letterbox") != 0};
+    float const threshold{(commandlineArguments["threshold"].size() != 0) ?
+      std::stof(commandlineArguments["threshold"]) : 0.5f};
+    if (!(threshold >= 0.0f && threshold < 1.0f)) {
+      std::cerr << argv[0] << ": The threshold must be in [0, 1)."
+        << std::endl;
+      return retCode;
+    }
+
+    ResizeMode resizeMode{ResizeMode::Nearest};
+    if (commandlineArguments["resize"].size() != 0
+        && !parseResizeMode(commandlineArguments["resize"], resizeMode)) {
+      std::cerr << argv[0] << ": Unknown resize mode '"
+        << commandlineArguments["resize"] << "'." << std::endl;
+      return retCode;
+    }
+    AcquireMode acquireMode{AcquireMode::Snapshot};
+    if (commandlineArguments["acquire"].size() != 0
+        && !parseAcquireMode(commandlineArguments["acquire"], acquireMode)) {
+      std::cerr << argv[0] << ": Unknown acquire mode '"
+        << commandlineArguments["acquire"] << "'." << std::endl;
+      return retCode;
+    }
+    ScheduleMode scheduleMode{ScheduleMode::Next};
+    if (commandlineArguments["schedule"].size() != 0
+        && !parseScheduleMode(commandlineArguments["schedule"],
+          scheduleMode)) {
+      std::cerr << argv[0] << ": Unknown schedule mode '"
+        << commandlineArguments["schedule"] << "'." << std::endl;
+      return retCode;
+    }
+    uint32_t const statsEvery{
+      (commandlineArguments["stats-every"].size() != 0) ?
+      static_cast<uint32_t>(std::stoi(commandlineArguments["stats-every"])) :
+      10};
+    int64_t const deadlineUs{(commandlineArguments["deadline-ms"].size() != 0)
+      ? static_cast<int64_t>(
+          std::stod(commandlineArguments["deadline-ms"]) * 1000.0) : 0};
+    uint32_t const detectEvery{
+      (commandlineArguments["detect-every"].size() != 0) ?
+      static_cast<uint32_t>(std::stoi(commandlineArguments["detect-every"])) :
+      1};
+    if (detectEvery == 0) {
+      std::cerr << argv[0] << ": --detect-every must be at least 1."
+        << std::endl;
+      return retCode;
+    }
+    bool const align{commandlineArguments.count("align") != 0};
+    uint32_t const preprocessThreads{
+      (commandlineArguments["preprocess-threads"].size() != 0) ?
+      static_cast<uint32_t>(
+          std::stoi(commandlineArguments["preprocess-threads"])) : 1};
 
     float const halfWidth{static_cast<float>(width) / 2.0f};
 
     //Set up camera parameters
     cameraPara camPara = setupCameraPara(height,camera);
+    if (commandlineArguments["camera-height"].size() != 0) {
+      camPara.height_m = std::stod(commandlineArguments["camera-height"]);
+    }
+    if (commandlineArguments["camera-pitch"].size() != 0) {
+      camPara.pitch_rad = std::stod(commandlineArguments["camera-pitch"])
+        * M_PI / 180.0;
+    }
+
+    // Rows of the frame given to the network. Cones stand on the ground, so
+    // nothing above the horizon needs to be resized or run through it.
+    SourceRect roi{0, 0, width, height};
+    if (commandlineArguments["roi-top"] == "horizon") {
+      if (commandlineArguments["camera-height"].size() == 0) {
+        std::cerr << argv[0] << ": --roi-top=horizon needs --camera-height."
+          << std::endl;
+        return retCode;
+      }
+      // Closest cone the top row has to leave room for.
+      double const roiMinDistance_m = 1.0;
+      uint32_t const margin{(commandlineArguments["roi-margin"].size() != 0)
+        ? static_cast<uint32_t>(std::stoi(commandlineArguments["roi-margin"]))
+        : height / 20};
+      uint32_t const horizon = horizonRow(camPara, roiMinDistance_m);
+      roi.y = horizon > margin ? horizon - margin : 0;
+    } else if (commandlineArguments["roi-top"].size() != 0) {
+      roi.y = static_cast<uint32_t>(std::stoi(commandlineArguments["roi-top"]));
+    }
+    uint32_t const roiBottom{(commandlineArguments["roi-bottom"].size() != 0)
+      ? static_cast<uint32_t>(std::stoi(commandlineArguments["roi-bottom"]))
+      : height};
+    if (roiBottom > height || roi.y >= roiBottom) {
+      std::cerr << argv[0] << ": Invalid region of interest, rows " << roi.y
+        << " to " << roiBottom << " of " << height << "." << std::endl;
+      return retCode;
+    }
+    roi.h = roiBottom - roi.y;
+
+    uint32_t const farEvery{(commandlineArguments["far-every"].size() != 0)
+      ? static_cast<uint32_t>(std::stoi(commandlineArguments["far-every"]))
+      : 0};
 
     Display* display{nullptr};
     Visual* visual{nullptr};
     Window window{0};
     XImage* ximage{nullptr};
 
-    Detector detector(commandlineArguments["cfg-file"],
-        commandlineArguments["weight-file"]);
+    std::string const backend{
+      (commandlineArguments["backend"].size() != 0) ?
+      commandlineArguments["backend"] : detectorBackendNames()[0]};
+    std::string const traceFile{commandlineArguments["profile-trace"]};
+    std::unique_ptr<InferenceProfile> profile;
+    if (commandlineArguments.count("profile") != 0 || !traceFile.empty()) {
+      profile.reset(new InferenceProfile(!traceFile.empty()));
+    }
+    uint32_t const inferenceThreads{
+      (commandlineArguments["inference-threads"].size() != 0) ?
+      static_cast<uint32_t>(
+          std::stoi(commandlineArguments["inference-threads"])) :
+      std::max(1u, std::thread::hardware_concurrency())};
+    std::unique_ptr<DetectorBackend> detector;
+    try {
+      detector = makeDetectorBackend(backend,
+          commandlineArguments["cfg-file"],
+          commandlineArguments["weight-file"], inferenceThreads,
+          commandlineArguments.count("retune") != 0);
+    } catch (std::exception const &e) {
+      std::cerr << argv[0] << ": " << e.what() << "." << std::endl;
+      return retCode;
+    }
+    detector->setProfile(profile.get());
 
     std::cout << "Connecting to shared memory " << nameArgb << std::endl;
     std::unique_ptr<cluon::SharedMemory> shmArgb{
@@ -220,15 +370,105 @@ int32_t main(int32_t argc, char **argv) {
         << " bytes)." << std::endl;
     }
 
-    image_t yoloImg;
-    yoloImg.w = detector.get_net_width();
-    yoloImg.h = detector.get_net_height();
-    yoloImg.c = 3;
-    yoloImg.data = new float[yoloImg.w * yoloImg.h * yoloImg.c];
-
-    char *verboseImg{nullptr};
-    if (verbose) {
-      verboseImg = new char[width * height * 4];
+    uint32_t const netWidth{detector->netWidth()};
+    uint32_t const netHeight{detector->netHeight()};
+    auto networkImage = [netWidth, netHeight](std::vector<float> &data) {
+      image_t img;
+      img.w = static_cast<int>(netWidth);
+      img.h = static_cast<int>(netHeight);
+      img.c = 3;
+      img.data = data.data();
+      return img;
+    };
+    ResizePlan resizePlan = letterbox
+      ? makeLetterboxPlan(width, height, roi, netWidth, netHeight)
+      : makeResizePlan(width, height, roi, netWidth, netHeight);
+
+    // Distant cones shrink to a few pixels in the downscaled frame, so a
+    // crop centred on the vanishing point is run through the network at
+    // (by default) full resolution as well.
+    SourceRect farRoi{0, 0, width, height};
+    if (farEvery != 0) {
+      uint32_t const farWidth{(commandlineArguments["far-width"].size() != 0)
+        ? static_cast<uint32_t>(std::stoi(commandlineArguments["far-width"]))
+        : netWidth};
+      uint32_t const farHeight{
+        (commandlineArguments["far-height"].size() != 0)
+        ? static_cast<uint32_t>(std::stoi(commandlineArguments["far-height"]))
+        : netHeight};
+      farRoi.w = std::min(farWidth, width);
+      farRoi.h = std::min(farHeight, height);
+      double const vanishingRow = camPara.cy
+        - camPara.focLength_pix * std::tan(camPara.pitch_rad);
+      auto farOrigin = [](double centre, uint32_t size, uint32_t frameSize) {
+        double const origin = centre - size / 2.0;
+        return origin <= 0.0 ? 0 : std::min(static_cast<uint32_t>(origin),
+            frameSize - size);
+      };
+      farRoi.x = farOrigin(camPara.cx, farRoi.w, width);
+      farRoi.y = farOrigin(vanishingRow, farRoi.h, height);
+    }
+    ResizePlan farPlan;
+    if (farEvery != 0) {
+      farPlan = letterbox
+        ? makeLetterboxPlan(width, height, farRoi, netWidth, netHeight)
+        : makeResizePlan(width, height, farRoi, netWidth, netHeight);
+    }
+    // Box overlap above which the far-field and full-frame detections of a
+    // class are taken as the same object, as in darknet's own suppression.
+    float const farMaxOverlap{0.45f};
+
+    // The frame is acquired and resized on the main thread, run through the
+    // network on a second and published (and drawn) on a third, so frame
+    // N + 1 is resized while frame N is inferred. The stages pass indices
+    // of preallocated frames over queues of one, and a frame is only
+    // acquired once the network has room for it, so no frame waits behind
+    // more than one other. One frame per stage and per queue is enough for
+    // only the queues to hold a stage back.
+    struct PipelineFrame {
+      std::vector<float> yoloData{};
+      std::vector<float> farData{};
+      std::vector<char> verboseData{};
+      bool farPass{false};
+      int64_t acquiredUs{0};
+      int64_t sampleUs{0};
+      uint64_t dropped{0};
+      int64_t resizeUs{0};
+      int64_t lockHoldUs{0};
+      int64_t detectUs{0};
+      uint32_t farFound{0};
+      // Degradations in effect when it was acquired, and whether it is run
+      // through the network or gets the tracked boxes carried over to it.
+      uint32_t level{0};
+      bool detect{true};
+      std::vector<bbox_t> boxes{};
+    };
+    uint32_t const frameSlots{5};
+    std::vector<PipelineFrame> frames(frameSlots);
+    for (auto &frame : frames) {
+      frame.yoloData.resize(netWidth * netHeight * 3);
+      if (letterbox) {
+        fillLetterboxPadding(frame.yoloData.data(), resizePlan);
+      }
+      if (farEvery != 0) {
+        frame.farData.resize(netWidth * netHeight * 3);
+        if (letterbox) {
+          fillLetterboxPadding(frame.farData.data(), farPlan);
+        }
+      }
+      if (verbose) {
+        frame.verboseData.resize(width * height * 4);
+      }
+    }
+    SpscQueue<uint32_t> freeFrames(frameSlots);
+    SpscQueue<uint32_t> toInfer(1);
+    // With the latest schedule every frame is acquired, and one the network
+    // has not started on yet is replaced by the next.
+    LatestMailbox<uint32_t> latestToInfer;
+    bool const latestWins{scheduleMode == ScheduleMode::Latest};
+    SpscQueue<uint32_t> toPost(1);
+    for (uint32_t i = 0; i < frameSlots; ++i) {
+      freeFrames.tryPush(i);
     }
 
     if (verbose) {
@@ -236,154 +476,486 @@ int32_t main(int32_t argc, char **argv) {
       visual = DefaultVisual(display, 0);
       window = XCreateSimpleWindow(display, RootWindow(display, 0), 0, 0,
           width, height, 1, 0, 0);
-      shmArgb->lock();
-      {
-        ximage = XCreateImage(display, visual, 24, ZPixmap, 0, verboseImg,
-            width, height, 32, 0);
-      }
-      shmArgb->unlock();
+      // Pointed at the frame being shown before each put.
+      ximage = XCreateImage(display, visual, 24, ZPixmap, 0,
+          frames[0].verboseData.data(), width, height, 32, 0);
 
       XMapWindow(display, window);
     }
 
-    float const widthRatio = static_cast<float>(width) / yoloImg.w;
-    float const heightRatio = static_cast<float>(height) / yoloImg.h;
-
-    cluon::OD4Session od4{static_cast<uint16_t>(
-        std::stoi(commandlineArguments["cid"]))};
-
-    uint64_t frameCount{0};
-    while (od4.isRunning())
-    {
-      cluon::data::TimeStamp t0 = cluon::time::now();
-      shmArgb->wait();
-      shmArgb->lock();
-
-      if (verbose) {
-        memcpy(verboseImg, shmArgb->data(), shmArgb->size());
+    // Resizing runs at the same time as inference, so its workers are
+    // pinned to the cores after those of the native detector, and not at all
+    // if the detector has them all.
+    ThreadPool preprocessPool(preprocessThreads > 0 ? preprocessThreads : 1,
+        true, backend != "darknet" && inferenceThreads > 0
+        ? inferenceThreads - 1 : 0);
+    std::vector<ResizeRowCache> resizeRowCaches;
+    // The display needs the whole frame, otherwise only the sampled rows
+    // are copied out of the shared memory.
+    std::vector<RowSpan> sampledRows;
+    std::vector<RowSpan> farRows;
+    if (!verbose) {
+      sampledRows = resizeSourceRows(resizePlan, resizeMode);
+      if (farEvery != 0) {
+        farRows = resizeSourceRows(farPlan, resizeMode);
       }
-      resizeArgbToYoloImg(shmArgb->data(), yoloImg.data, width, height,
-          yoloImg.w, yoloImg.h, widthRatio, heightRatio, false);
+    }
 
-      shmArgb->unlock();
+    // The steps that make a difference with these options. The sparse
+    // frame only holds the pixels of the configured resize, and the rows
+    // of the nearest resize are snapshot as well in case it is taken.
+    std::vector<Degradation> degradations;
+    if (deadlineUs > 0) {
+      if (resizeMode != ResizeMode::Nearest
+          && acquireMode != AcquireMode::Sparse) {
+        degradations.push_back(Degradation::NearestResize);
+        if (!verbose) {
+          sampledRows = mergeRowSpans(sampledRows,
+              resizeSourceRows(resizePlan, ResizeMode::Nearest));
+          if (farEvery != 0) {
+            farRows = mergeRowSpans(farRows,
+                resizeSourceRows(farPlan, ResizeMode::Nearest));
+          }
+        }
+      }
+      if (hasXyzData) {
+        degradations.push_back(Degradation::SkipDepth);
+      }
+      if (farEvery != 0) {
+        degradations.push_back(Degradation::SkipFarField);
+      }
+      degradations.push_back(Degradation::HalveDetection);
+    }
+    // A frame with a far-field pass is resized into the network input as
+    // well, from the same snapshot.
+    if (!verbose && farEvery != 0) {
+      farRows = mergeRowSpans(sampledRows, farRows);
+    }
+    DeadlineController deadline(deadlineUs, degradations);
+    SparseFetch sparseFetch;
+    if (acquireMode == AcquireMode::Sparse) {
+      sparseFetch = makeSparseFetch(resizePlan, resizeMode);
+    }
+    FrameSnapshot frameSnapshot(static_cast<uint32_t>(shmArgb->size()),
+        width * 4);
+    FrameClock frameClock(nameArgb);
+    if (verbose) {
+      std::clog << argv[0] << ": Using the " << backend << " detector, "
+        << resizeModeName(resizeMode)
+        << " resize with the " << resizeKernelName() << " kernel on "
+        << preprocessPool.threadCount() << " thread(s), "
+        << acquireModeName(acquireMode) << " frame acquisition, "
+        << scheduleModeName(scheduleMode) << " frame scheduling, frame "
+        << "rows " << roi.y << " to " << roi.y + roi.h << " into image area "
+        << resizePlan.wDst << "x" << resizePlan.hDst << " at ("
+        << resizePlan.xPad << ", " << resizePlan.yPad << ")." << std::endl;
+      if (farEvery != 0) {
+        std::clog << argv[0] << ": Far-field pass every " << farEvery
+          << " frame(s) on " << farRoi.w << "x" << farRoi.h << " at ("
+          << farRoi.x << ", " << farRoi.y << ")." << std::endl;
+      }
+      if (detectEvery > 1) {
+        std::clog << argv[0] << ": Detection every " << detectEvery
+          << " frame(s), " << (align ? "aligned" : "predicted")
+          << " boxes in between." << std::endl;
+      }
+      if (deadlineUs > 0) {
+        std::clog << argv[0] << ": Deadline of " << deadlineUs / 1000.0
+          << " ms, degrading by";
+        for (auto step : degradations) {
+          std::clog << (step == degradations.front() ? " " : ", ")
+            << degradationName(step);
+        }
+        std::clog << "." << std::endl;
+      }
+    }
 
-      std::vector<bbox_t> temp = detector.detect(yoloImg, 0.5f, true);
+    cluon::OD4Session od4{static_cast<uint16_t>(
+        std::stoi(commandlineArguments["cid"]))};
 
-      for (auto &detection : temp) {
-        detection.x = static_cast<uint32_t>(widthRatio * detection.x);
-        detection.w = static_cast<uint32_t>(widthRatio * detection.w);
-        detection.y = static_cast<uint32_t>(heightRatio * detection.y);
-        detection.h = static_cast<uint32_t>(heightRatio * detection.h);
+    // Stages of the frame in the profile, around the spans of the detector.
+    auto profileStage = [&profile](char const *stage, int64_t &start) {
+      int64_t const end = profileClock();
+      if (profile) {
+        profile->record(stage, "frame", start, end);
       }
+      start = end;
+    };
+
+    std::thread inferenceThread([&]() {
+      uint32_t slot{0};
+      BoxPropagator propagator(width, height, align ? &resizePlan : nullptr);
+      while (latestWins ? latestToInfer.take(slot) : toInfer.pop(slot)) {
+        PipelineFrame &frame = frames[slot];
+        int64_t stageStart = profileClock();
+        int64_t const detectStart{stageStart};
+        frame.farFound = 0;
+        if (!frame.detect) {
+          frame.boxes = propagator.predict(frame.sampleUs,
+              align ? frame.yoloData.data() : nullptr);
+          frame.detectUs = 0;
+          profileStage("propagate", stageStart);
+          toPost.push(slot);
+          continue;
+        }
+        std::vector<bbox_t> temp = detector->detect(
+            networkImage(frame.yoloData), threshold, true);
+        profileStage("detect", stageStart);
 
-      temp = detector.tracking_id(temp, true, 5, 40);
-      std::vector<bboxConf_t> detections;
-      for (auto &detection : temp) { detections.push_back(detection); }
+        for (auto &detection : temp) {
+          projectToSource(resizePlan, detection.x, detection.y, detection.w,
+              detection.h);
+        }
 
-      if (hasXyzData) {
-        shmXyz->wait();
-        shmXyz->lock();
-        shmDepthConf->lock();
-        {
-          char *depthData = shmXyz->data();
-          char* depthConfData = shmDepthConf->data();
-          for (auto &detection : detections) {
-            getDepthData((float*)depthConfData, (float*)depthData, detection, width, verbose);
+        if (frame.farPass) {
+          // Not averaged with the full-frame predictions of earlier frames.
+          std::vector<bbox_t> farDetections = detector->detect(
+              networkImage(frame.farData), threshold, false);
+          for (auto &detection : farDetections) {
+            projectToSource(farPlan, detection.x, detection.y, detection.w,
+                detection.h);
           }
+          dropCroppedBoxes(farDetections, farRoi, width, height);
+          frame.farFound = static_cast<uint32_t>(farDetections.size());
+          temp = mergeDetections(temp, farDetections, farMaxOverlap);
+          profileStage("far-field detect", stageStart);
         }
-        shmDepthConf->unlock();
-        shmXyz->unlock();
-      }
 
-
-      if (verbose) {
-        float fps = 1000000.0f /
-          (cluon::time::toMicroseconds(cluon::time::now())
-            - cluon::time::toMicroseconds(t0));
-        std::cout << "\n====================================================\n";
-        std::cout << "Frames per second: " << fps << ", found objects "
-          << detections.size() << std::endl;
+        frame.boxes = detector->trackingId(temp, true, 5, 40);
+        propagator.correct(frame.boxes, frame.sampleUs,
+            frame.yoloData.data());
+        profileStage("track", stageStart);
+        frame.detectUs = (stageStart - detectStart) / 1000;
+        toPost.push(slot);
       }
+      toPost.close();
+    });
+
+    std::thread postThread([&]() {
+      uint64_t frameCount{0};
+      uint64_t postCount{0};
+      int64_t resizeTotalUs{0};
+      int64_t lockHoldTotalUs{0};
+      int64_t lastPublishUs{0};
+      FrameStats frameStats;
+      int64_t statsStartUs{cluon::time::toMicroseconds(cluon::time::now())};
+      uint32_t slot{0};
+      while (toPost.pop(slot)) {
+        PipelineFrame &frame = frames[slot];
+        int64_t stageStart = profileClock();
+        int64_t const postStart{stageStart};
+        resizeTotalUs += frame.resizeUs;
+        lockHoldTotalUs += frame.lockHoldUs;
+        postCount++;
+
+        std::vector<bboxConf_t> detections;
+        for (auto &detection : frame.boxes) { detections.push_back(detection); }
+
+        if (hasXyzData
+            && !deadline.degraded(frame.level, Degradation::SkipDepth)) {
+          shmXyz->wait();
+          shmXyz->lock();
+          shmDepthConf->lock();
+          {
+            char *depthData = shmXyz->data();
+            char* depthConfData = shmDepthConf->data();
+            for (auto &detection : detections) {
+              getDepthData((float*)depthConfData, (float*)depthData, detection, width, verbose);
+            }
+          }
+          shmDepthConf->unlock();
+          shmXyz->unlock();
+        }
+        profileStage("depth", stageStart);
+        int64_t const depthEnd{stageStart};
+
+        if (verbose) {
+          int64_t const nowUs = cluon::time::toMicroseconds(cluon::time::now());
+          float fps = 1000000.0f / static_cast<float>(nowUs
+              - (lastPublishUs != 0 ? lastPublishUs : frame.acquiredUs));
+          lastPublishUs = nowUs;
+          std::cout << "\n====================================================\n";
+          std::cout << "Frames per second: " << fps << ", latency "
+            << (nowUs - frame.acquiredUs) / 1000.0f << " ms, found objects "
+            << detections.size() << std::endl;
+          std::cout << "Sample age: "
+            << (nowUs - frame.sampleUs) / 1000.0f << " ms, dropped " << frame.dropped << " frame(s) before it"
+            << std::endl;
+          if (deadlineUs > 0) {
+            std::cout << "Degradations: " << frame.level << " of "
+              << degradations.size() << (frame.detect ? "" : ", propagated boxes")
+              << std::endl;
+          }
+          std::cout << "Resize (" << resizeModeName(resizeMode) << "): "
+            << frame.resizeUs / 1000.0f << " ms, mean "
+            << resizeTotalUs / 1000.0f / postCount << " ms" << std::endl;
+          std::cout << "ARGB lock held (" << acquireModeName(acquireMode)
+            << "): " << frame.lockHoldUs / 1000.0f << " ms, mean "
+            << lockHoldTotalUs / 1000.0f / postCount << " ms" << std::endl;
+          if (frame.farPass) {
+            std::cout << "Far-field pass: " << frame.farFound << " objects"
+              << std::endl;
+          }
+        }
 
-      if (detections.size() > 0)
-      {
-        cluon::data::TimeStamp ts{cluon::time::now()};
+        if (detections.size() > 0)
+        {
+          cluon::data::TimeStamp ts{cluon::time::now()};
 
-        opendlv::logic::perception::ObjectFrameStart startMsg;
-        startMsg.objectFrameId(frameCount);
-        od4.send(startMsg, ts, id);
+          opendlv::logic::perception::ObjectFrameStart startMsg;
+          startMsg.objectFrameId(frameCount);
+          od4.send(startMsg, ts, id);
 
-        uint32_t n = 0;
-        for (auto &detection : detections)
-        {
-          uint32_t const objectId = n++ * 1000 + detection.track_id;
-          opendlv::logic::perception::ObjectPosition conePos;
-          opendlv::logic::perception::ObjectType coneType;
-
-          coneType.type(static_cast<uint32_t>(detection.obj_id));
-          coneType.objectId(objectId);
-          od4.send(coneType, ts, id);
-
-          conePos = getDistance(camPara, detection, verbose);
-          conePos.objectId(objectId);
-          od4.send(conePos, ts, id);
-
-          opendlv::logic::perception::ObjectDirection coneDirection;
-          coneDirection.objectId(objectId);
-          coneDirection.azimuthAngle(halfWidth - (detection.x +
-            static_cast<float>(detection.w) / 2.0f));
-          coneDirection.zenithAngle(static_cast<float>(height) - detection.y);
-          od4.send(coneDirection, ts, id);
-
-          opendlv::logic::perception::ObjectAngularBlob coneAngularBlob;
-          coneAngularBlob.objectId(objectId);
-          coneAngularBlob.width(detection.w);
-          coneAngularBlob.height(detection.h);
-          od4.send(coneAngularBlob, ts, id);
-
-          if (verbose)
+          uint32_t n = 0;
+          for (auto &detection : detections)
           {
-            std::string coneName[4] = {"Yellow", "Blue  ", "Red   ", "BigRed"};
-            std::cout << "  ...object-id=" << objectId << " i=" << detection.x
-              << ", j=" << detection.y << ", w=" << detection.w << ", h="
-              << detection.h << ", prob=" << detection.prob << ", Color="
-              << coneName[detection.obj_id] << ", tack id=" << detection.track_id
-              << ", frame=" << frameCount << ", x="
-              << detection.z_3d << ", y=" << -detection.x_3d << ", z="
-              << detection.y_3d << " Cone(x,y) = " << conePos.x()<<" , "<< conePos.y() << std::endl;
-
-            std::array<std::array<uint8_t, 3>, 8> colors{{
-              {{255, 255, 0}},
-              {{0, 0, 255}},
-              {{255, 0, 0}},
-              {{0, 255, 0}},
-              {{255, 0, 255}},
-              {{0, 255, 255}},
-              {{255, 255, 255}},
-              {{0, 0, 0}}
-            }};
-
-            uint32_t const k = detection.obj_id % colors.size();
-            drawBoxArgb(verboseImg, width, detection.x, detection.y,
-                detection.w, detection.h, colors[k][0], colors[k][1],
-                colors[k][2]);
-
+            uint32_t const objectId = n++ * 1000 + detection.track_id;
+            opendlv::logic::perception::ObjectPosition conePos;
+            opendlv::logic::perception::ObjectType coneType;
+
+            coneType.type(static_cast<uint32_t>(detection.obj_id));
+            coneType.objectId(objectId);
+            od4.send(coneType, ts, id);
+
+            conePos = getDistance(camPara, detection, verbose);
+            conePos.objectId(objectId);
+            od4.send(conePos, ts, id);
+
+            opendlv::logic::perception::ObjectDirection coneDirection;
+            coneDirection.objectId(objectId);
+            coneDirection.azimuthAngle(halfWidth - (detection.x +
+              static_cast<float>(detection.w) / 2.0f));
+            coneDirection.zenithAngle(static_cast<float>(height) - detection.y);
+            od4.send(coneDirection, ts, id);
+
+            opendlv::logic::perception::ObjectAngularBlob coneAngularBlob;
+            coneAngularBlob.objectId(objectId);
+            coneAngularBlob.width(detection.w);
+            coneAngularBlob.height(detection.h);
+            od4.send(coneAngularBlob, ts, id);
+
+            if (verbose)
+            {
+              std::string coneName[4] = {"Yellow", "Blue  ", "Red   ", "BigRed"};
+              std::cout << "  ...object-id=" << objectId << " i=" << detection.x
+                << ", j=" << detection.y << ", w=" << detection.w << ", h="
+                << detection.h << ", prob=" << detection.prob << ", Color="
+                << coneName[detection.obj_id] << ", tack id=" << detection.track_id
+                << ", frame=" << frameCount << ", x="
+                << detection.z_3d << ", y=" << -detection.x_3d << ", z="
+                << detection.y_3d << " Cone(x,y) = " << conePos.x()<<" , "<< conePos.y() << std::endl;
+
+              std::array<std::array<uint8_t, 3>, 8> colors{{
+                {{255, 255, 0}},
+                {{0, 0, 255}},
+                {{255, 0, 0}},
+                {{0, 255, 0}},
+                {{255, 0, 255}},
+                {{0, 255, 255}},
+                {{255, 255, 255}},
+                {{0, 0, 0}}
+              }};
+
+              uint32_t const k = detection.obj_id % colors.size();
+              drawBoxArgb(frame.verboseData.data(), width, detection.x,
+                  detection.y, detection.w, detection.h, colors[k][0],
+                  colors[k][1], colors[k][2]);
+
+            }
           }
+          opendlv::logic::perception::ObjectFrameEnd endMsg;
+          endMsg.objectFrameId(frameCount);
+          od4.send(endMsg, cluon::time::now(), id);
+          frameCount++;
+        }
+        if(verbose)
+        {
+          ximage->data = frame.verboseData.data();
+          XPutImage(display, window, DefaultGC(display, 0), ximage, 0, 0, 0, 0,
+                    width, height);
+        }
+        profileStage("publish", stageStart);
+
+        int64_t const publishedUs{
+          cluon::time::toMicroseconds(cluon::time::now())};
+        frameStats.add(frame.dropped, publishedUs - frame.sampleUs);
+        std::string reason;
+        if (deadlineUs > 0 && deadline.update(frame.level,
+              FrameTiming{publishedUs - frame.sampleUs, frame.resizeUs,
+              frame.detectUs, (depthEnd - postStart) / 1000,
+              (stageStart - depthEnd) / 1000}, reason)) {
+          std::clog << argv[0] << ": " << reason << "." << std::endl;
         }
-        opendlv::logic::perception::ObjectFrameEnd endMsg;
-        endMsg.objectFrameId(frameCount);
-        od4.send(endMsg, cluon::time::now(), id);
-        frameCount++;
+        if (statsEvery != 0
+            && publishedUs - statsStartUs >= int64_t{statsEvery} * 1000000) {
+          frameStats.print(std::clog);
+          frameStats.clear();
+          statsStartUs = publishedUs;
+        }
+        freeFrames.push(slot);
       }
-      if(verbose)
-      {
-        XPutImage(display, window, DefaultGC(display, 0), ximage, 0, 0, 0, 0,
-                  width, height);
+      if (statsEvery != 0 && frameStats.frames() != 0) {
+        frameStats.print(std::clog);
       }
-    }
+    });
+
+    uint64_t resizeCount{0};
+    uint64_t replacedCount{0};
+    uint64_t replacedDrops{0};
+    uint64_t lastTaken{0};
+    int64_t lastStampUs{0};
+    uint32_t slot{0};
+    bool haveSlot{false};
+    while (od4.isRunning())
+    {
+      int64_t stageStart = profileClock();
+      if (!haveSlot && !freeFrames.pop(slot)) {
+        break;
+      }
+      haveSlot = true;
+      if (!latestWins && !toInfer.waitForRoom()) {
+        break;
+      }
+      profileStage("pipeline wait", stageStart);
+      // Frames published since the last one taken are dropped, waiting for
+      // the next one or not.
+      FrameTick tick{0, 0};
+      if (!frameClock.waitNewer(latestWins
+            ? lastTaken : frameClock.latest().sequence, tick)) {
+        break;
+      }
+      profileStage("frame wait", stageStart);
+
+      PipelineFrame &frame = frames[slot];
+      frame.acquiredUs = cluon::time::toMicroseconds(cluon::time::now());
+      frame.dropped = (lastTaken == 0 ? 0 : tick.sequence - lastTaken - 1)
+        + replacedDrops;
+      replacedDrops = 0;
+      lastTaken = tick.sequence;
+      int64_t stampUs{0};
+      // A replaced frame's detection (or far-field pass) is due on the next
+      // one instead, which is every far-every-th detection. A frame that is
+      // not detected is only resized to align the boxes carried over to it.
+      uint64_t const frameIndex{resizeCount - replacedCount};
+      frame.level = deadline.level();
+      uint64_t const detectInterval{uint64_t{detectEvery}
+        * (deadline.degraded(frame.level, Degradation::HalveDetection)
+            ? 2 : 1)};
+      frame.detect = frameIndex % detectInterval == 0;
+      frame.farPass = farEvery != 0 && frame.detect
+        && (frameIndex / detectInterval) % farEvery == 0
+        && !deadline.degraded(frame.level, Degradation::SkipFarField);
+      ResizeMode const frameResizeMode{
+        deadline.degraded(frame.level, Degradation::NearestResize)
+        ? ResizeMode::Nearest : resizeMode};
+      float *yoloImg = frame.detect || align ? frame.yoloData.data()
+        : nullptr;
+      float *farImg = frame.farData.data();
+      char *verboseImg = verbose ? frame.verboseData.data() : nullptr;
+      bool const farPass{frame.farPass};
+      int64_t resizeUs{0};
+      int64_t lockHoldUs{0};
+      if (acquireMode == AcquireMode::Sparse && !farPass) {
+        char *argb = frameSnapshot.acquire(*shmArgb, sparseFetch,
+            verboseImg);
+        lockHoldUs = frameSnapshot.lockHoldUs();
+        stampUs = frameSnapshot.sampleTimeUs();
+
+        cluon::data::TimeStamp const resizeStart = cluon::time::now();
+        if (yoloImg != nullptr) {
+          resizeArgbToYoloImg(argb, yoloImg, sparseFetch.plan,
+              resizeMode, preprocessPool, resizeRowCaches);
+        }
+        resizeUs = cluon::time::toMicroseconds(cluon::time::now())
+          - cluon::time::toMicroseconds(resizeStart);
+      } else if (acquireMode != AcquireMode::Direct) {
+        // The sparse frame only holds what the full-frame pass samples, so
+        // frames with a far-field pass are snapshot instead.
+        char *argb = frameSnapshot.acquire(*shmArgb,
+            farPass ? farRows : sampledRows);
+        lockHoldUs = frameSnapshot.lockHoldUs();
+        stampUs = frameSnapshot.sampleTimeUs();
+
+        cluon::data::TimeStamp const resizeStart = cluon::time::now();
+        if (yoloImg != nullptr) {
+          resizeArgbToYoloImg(argb, yoloImg, resizePlan, frameResizeMode,
+              preprocessPool, resizeRowCaches);
+        }
+        if (farPass) {
+          resizeArgbToYoloImg(argb, farImg, farPlan, frameResizeMode,
+              preprocessPool, resizeRowCaches);
+        }
+        resizeUs = cluon::time::toMicroseconds(cluon::time::now())
+          - cluon::time::toMicroseconds(resizeStart);
 
-    delete[] yoloImg.data;
-    delete[] verboseImg;
+        if (verbose) {
+          memcpy(verboseImg, argb, width * height * 4);
+        }
+      } else {
+        shmArgb->lock();
+        cluon::data::TimeStamp const lockStart = cluon::time::now();
+        stampUs = cluon::time::toMicroseconds(shmArgb->getTimeStamp().second);
+        if (verbose) {
+          memcpy(verboseImg, shmArgb->data(), shmArgb->size());
+        }
+        cluon::data::TimeStamp const resizeStart = cluon::time::now();
+        if (yoloImg != nullptr) {
+          resizeArgbToYoloImg(shmArgb->data(), yoloImg, resizePlan,
+              frameResizeMode, preprocessPool, resizeRowCaches);
+        }
+        if (farPass) {
+          resizeArgbToYoloImg(shmArgb->data(), farImg, farPlan,
+              frameResizeMode, preprocessPool, resizeRowCaches);
+        }
+        cluon::data::TimeStamp const resizeEnd = cluon::time::now();
+        resizeUs = cluon::time::toMicroseconds(resizeEnd)
+          - cluon::time::toMicroseconds(resizeStart);
+        lockHoldUs = cluon::time::toMicroseconds(resizeEnd)
+          - cluon::time::toMicroseconds(lockStart);
+        shmArgb->unlock();
+      }
+      frame.resizeUs = resizeUs;
+      frame.lockHoldUs = lockHoldUs;
+      // A producer that does not stamp its frames leaves the stamp as it
+      // was, and a replay may keep the recorded one, so the age is then
+      // counted from the notification.
+      bool const stamped{stampUs > lastStampUs
+        && tick.notifiedUs - stampUs < 1000000};
+      frame.sampleUs = stamped ? stampUs : tick.notifiedUs;
+      lastStampUs = std::max(lastStampUs, stampUs);
+      resizeCount++;
+      profileStage("acquire + resize", stageStart);
+      if (latestWins) {
+        uint32_t replaced{0};
+        haveSlot = latestToInfer.put(slot, replaced);
+        if (haveSlot) {
+          replacedDrops = frames[replaced].dropped + 1;
+          replacedCount++;
+          slot = replaced;
+        }
+      } else {
+        haveSlot = false;
+        toInfer.push(slot);
+      }
+    }
+    // The frames already acquired are still run through and published.
+    toInfer.close();
+    latestToInfer.close();
+    inferenceThread.join();
+    postThread.join();
+
+    if (profile) {
+      profile->printTable(std::cout);
+      if (!traceFile.empty()) {
+        try {
+          profile->writeTrace(traceFile);
+          std::clog << argv[0] << ": Wrote the profile trace to '"
+            << traceFile << "'." << std::endl;
+        } catch (std::exception const &e) {
+          std::cerr << argv[0] << ": " << e.what() << "." << std::endl;
+        }
+      }
+    }
 
     retCode = 0;
   }
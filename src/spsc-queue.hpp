@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPSC_QUEUE
+#define SPSC_QUEUE
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+// A bounded queue from one producer thread to one consumer thread, of
+// preallocated slots. Pushing and popping is lock-free; only a side that
+// finds the queue full (or empty) and waits takes the mutex, and the other
+// side then wakes it. Once closed, pushes fail and pops drain what is left.
+template <typename T>
+class SpscQueue {
+ public:
+  explicit SpscQueue(uint32_t capacity);
+  SpscQueue(SpscQueue const &) = delete;
+  SpscQueue &operator=(SpscQueue const &) = delete;
+
+  bool tryPush(T const &item);
+  bool tryPop(T &item);
+
+  // Wait for room for an item, false if the queue is closed.
+  bool waitForRoom();
+
+  // Push or pop, waiting for room or an item. Pushing fails once the queue
+  // is closed, popping once it is closed and empty.
+  bool push(T const &item);
+  bool pop(T &item);
+
+  // Fail pushes and wake both sides.
+  void close();
+
+ private:
+  std::vector<T> m_slots;
+  uint64_t const m_capacity;
+  // Counts of pushed and popped items, on their own cache lines as each is
+  // written by one side and polled by the other.
+  alignas(64) std::atomic<uint64_t> m_pushed{0};
+  alignas(64) std::atomic<uint64_t> m_popped{0};
+  alignas(64) std::atomic<uint32_t> m_waiting{0};
+  std::atomic<bool> m_closed{false};
+  std::mutex m_mutex{};
+  std::condition_variable m_wake{};
+
+  bool hasRoom() const;
+  bool hasItem() const;
+  void wake();
+  template <typename Ready>
+  void wait(Ready ready);
+};
+
+template <typename T>
+SpscQueue<T>::SpscQueue(uint32_t capacity):
+  m_slots(capacity > 0 ? capacity : 1),
+  m_capacity(capacity > 0 ? capacity : 1)
+{
+}
+
+template <typename T>
+bool SpscQueue<T>::hasRoom() const
+{
+  return m_pushed.load() - m_popped.load() < m_capacity;
+}
+
+template <typename T>
+bool SpscQueue<T>::hasItem() const
+{
+  return m_pushed.load() != m_popped.load();
+}
+
+// A side about to wait announces it before checking the queue once more,
+// and the other side checks for waiters after updating its count, so one
+// of the two sees the other (both are sequentially consistent).
+template <typename T>
+void SpscQueue<T>::wake()
+{
+  if (m_waiting.load() != 0) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_wake.notify_all();
+  }
+}
+
+template <typename T>
+template <typename Ready>
+void SpscQueue<T>::wait(Ready ready)
+{
+  if (ready() || m_closed.load()) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_waiting.fetch_add(1);
+  m_wake.wait(lock, [this, &ready]() {
+      return ready() || m_closed.load();
+    });
+  m_waiting.fetch_sub(1);
+}
+
+template <typename T>
+bool SpscQueue<T>::tryPush(T const &item)
+{
+  if (m_closed.load() || !hasRoom()) {
+    return false;
+  }
+  uint64_t const pushed = m_pushed.load(std::memory_order_relaxed);
+  m_slots[pushed % m_capacity] = item;
+  m_pushed.store(pushed + 1);
+  wake();
+  return true;
+}
+
+template <typename T>
+bool SpscQueue<T>::tryPop(T &item)
+{
+  if (!hasItem()) {
+    return false;
+  }
+  uint64_t const popped = m_popped.load(std::memory_order_relaxed);
+  item = m_slots[popped % m_capacity];
+  m_popped.store(popped + 1);
+  wake();
+  return true;
+}
+
+template <typename T>
+bool SpscQueue<T>::waitForRoom()
+{
+  wait([this]() { return hasRoom(); });
+  return !m_closed.load();
+}
+
+template <typename T>
+bool SpscQueue<T>::push(T const &item)
+{
+  return waitForRoom() && tryPush(item);
+}
+
+template <typename T>
+bool SpscQueue<T>::pop(T &item)
+{
+  while (!tryPop(item)) {
+    if (m_closed.load() && !hasItem()) {
+      return false;
+    }
+    wait([this]() { return hasItem(); });
+  }
+  return true;
+}
+
+template <typename T>
+void SpscQueue<T>::close()
+{
+  m_closed.store(true);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_wake.notify_all();
+}
+
+// A mailbox of one item from one producer thread to one consumer thread,
+// where an item put before the last one was taken replaces it and is given
+// back to the producer. Item values must leave the largest one of the type
+// free, which marks the mailbox empty.
+template <typename T>
+class LatestMailbox {
+ public:
+  LatestMailbox();
+  LatestMailbox(LatestMailbox const &) = delete;
+  LatestMailbox &operator=(LatestMailbox const &) = delete;
+
+  // Put an item, true (and the item) if it replaced one not yet taken.
+  bool put(T item, T &replaced);
+
+  // Take the item, waiting for one; false once closed and empty.
+  bool take(T &item);
+
+  // Wake the consumer, which takes what is left and then fails.
+  void close();
+
+ private:
+  static T empty() { return std::numeric_limits<T>::max(); }
+
+  alignas(64) std::atomic<T> m_item;
+  std::atomic<uint32_t> m_waiting{0};
+  std::atomic<bool> m_closed{false};
+  std::mutex m_mutex{};
+  std::condition_variable m_wake{};
+};
+
+template <typename T>
+LatestMailbox<T>::LatestMailbox():
+  m_item(empty())
+{
+}
+
+// As in the queue, the producer checks for a waiting consumer after
+// putting and the consumer announces itself before checking once more.
+template <typename T>
+bool LatestMailbox<T>::put(T item, T &replaced)
+{
+  replaced = m_item.exchange(item);
+  if (m_waiting.load() != 0) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_wake.notify_all();
+  }
+  return replaced != empty();
+}
+
+template <typename T>
+bool LatestMailbox<T>::take(T &item)
+{
+  item = m_item.exchange(empty());
+  while (item == empty()) {
+    if (m_closed.load()) {
+      item = m_item.exchange(empty());
+      return item != empty();
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_waiting.fetch_add(1);
+    m_wake.wait(lock, [this]() {
+        return m_item.load() != empty() || m_closed.load();
+      });
+    m_waiting.fetch_sub(1);
+    item = m_item.exchange(empty());
+  }
+  return true;
+}
+
+template <typename T>
+void LatestMailbox<T>::close()
+{
+  m_closed.store(true);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_wake.notify_all();
+}
+#endif
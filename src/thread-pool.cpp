@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thread-pool.hpp"
+
+#include <iostream>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Pin a worker to the n-th CPU the process may run on from firstCpu on,
+// skipping the first one which is left to the calling (main) thread. A
+// worker is left unpinned if no CPU is left from firstCpu on.
+static void pinToCpu(std::thread &thread, uint32_t n, uint32_t firstCpu)
+{
+#if defined(__linux__)
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (0 != sched_getaffinity(0, sizeof(allowed), &allowed)) {
+    return;
+  }
+  uint32_t const count = static_cast<uint32_t>(CPU_COUNT(&allowed));
+  if (count < 2 + firstCpu) {
+    return;
+  }
+  uint32_t const target = 1 + firstCpu + n % (count - 1 - firstCpu);
+  uint32_t seen = 0;
+  for (uint32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &allowed) && seen++ == target) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpu, &set);
+      if (0 != pthread_setaffinity_np(thread.native_handle(), sizeof(set),
+            &set)) {
+        std::cerr << "Could not pin worker thread to CPU " << cpu
+          << std::endl;
+      }
+      return;
+    }
+  }
+#else
+  (void) thread;
+  (void) n;
+  (void) firstCpu;
+#endif
+}
+
+ThreadPool::ThreadPool(uint32_t threadCount, bool pin, uint32_t firstCpu)
+{
+  for (uint32_t i = 1; i < threadCount; ++i) {
+    m_workers.emplace_back(&ThreadPool::work, this, i);
+    if (pin) {
+      pinToCpu(m_workers.back(), i - 1, firstCpu);
+    }
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  for (auto &worker : m_workers) {
+    worker.join();
+  }
+}
+
+uint32_t ThreadPool::threadCount() const
+{
+  return static_cast<uint32_t>(m_workers.size()) + 1;
+}
+
+void ThreadPool::run(uint32_t count,
+    std::function<void(uint32_t, uint32_t)> const &task)
+{
+  if (m_workers.empty() || count < 2) {
+    for (uint32_t i = 0; i < count; ++i) {
+      task(i, 0);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_task = &task;
+    m_count = count;
+    m_next = 0;
+    m_active = static_cast<uint32_t>(m_workers.size());
+    m_generation++;
+  }
+  m_wake.notify_all();
+
+  drain(0);
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_done.wait(lock, [this]() { return m_active == 0; });
+  m_task = nullptr;
+}
+
+void ThreadPool::drain(uint32_t thread)
+{
+  for (uint32_t i = m_next++; i < m_count; i = m_next++) {
+    (*m_task)(i, thread);
+  }
+}
+
+void ThreadPool::work(uint32_t thread)
+{
+  uint64_t generation{0};
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [this, generation]() {
+          return m_stop || m_generation != generation;
+        });
+      if (m_stop) {
+        return;
+      }
+      generation = m_generation;
+    }
+
+    drain(thread);
+
+    bool last;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      last = (--m_active == 0);
+    }
+    if (last) {
+      m_done.notify_one();
+    }
+  }
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREAD_POOL
+#define THREAD_POOL
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads for data-parallel work inside the frame loop.
+// The threads are created once, so no thread is started per frame. The
+// calling thread takes part in every run, hence a pool of N threads owns
+// N - 1 workers. Workers can be pinned to their own cores, from the
+// firstCpu-th of those left by the main thread on, so that pools running at
+// the same time can be given disjoint cores.
+class ThreadPool {
+ public:
+  ThreadPool(uint32_t threadCount, bool pin, uint32_t firstCpu = 0);
+  ~ThreadPool();
+  ThreadPool(ThreadPool const &) = delete;
+  ThreadPool &operator=(ThreadPool const &) = delete;
+
+  // Number of threads taking part in a run, including the caller.
+  uint32_t threadCount() const;
+
+  // Call task(index, thread) for every index in [0, count) and return when
+  // all calls are done. thread is in [0, threadCount()) and unique among
+  // concurrently running calls, e.g. for per-thread scratch buffers.
+  void run(uint32_t count,
+      std::function<void(uint32_t, uint32_t)> const &task);
+
+ private:
+  void work(uint32_t thread);
+  void drain(uint32_t thread);
+
+  std::vector<std::thread> m_workers{};
+  std::mutex m_mutex{};
+  std::condition_variable m_wake{};
+  std::condition_variable m_done{};
+  std::function<void(uint32_t, uint32_t)> const *m_task{nullptr};
+  uint32_t m_count{0};
+  std::atomic<uint32_t> m_next{0};
+  uint32_t m_active{0};
+  uint64_t m_generation{0};
+  bool m_stop{false};
+};
+#endif
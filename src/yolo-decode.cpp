@@ -0,0 +1,414 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "yolo-decode.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define YOLO_DECODE_X86
+#endif
+
+void YoloCandidates::clear(uint32_t classCount)
+{
+  x.clear();
+  y.clear();
+  w.clear();
+  h.clear();
+  probs.clear();
+  classes = classCount;
+}
+
+float logitThreshold(float probability)
+{
+  if (probability <= 0.0f) {
+    return -INFINITY;
+  }
+  if (probability >= 1.0f) {
+    return INFINITY;
+  }
+  return std::log(probability / (1.0f - probability));
+}
+
+static float logistic(float x)
+{
+  return 1.0f / (1.0f + std::exp(-x));
+}
+
+// The cells of a plane of logits above the cut, in order. Few cells pass,
+// so four are compared at a time and the mask of those that pass gives
+// their indices.
+static uint32_t cellsAbove(float const *logits, uint32_t size, float cut,
+    uint32_t *cells)
+{
+  uint32_t count{0};
+  uint32_t i{0};
+#ifdef YOLO_DECODE_X86
+  __m128 const cutV = _mm_set1_ps(cut);
+  for (; i + 4 <= size; i += 4) {
+    uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(
+          _mm_cmpgt_ps(_mm_loadu_ps(logits + i), cutV)));
+    while (mask != 0) {
+      cells[count++] = i + static_cast<uint32_t>(__builtin_ctz(mask));
+      mask &= mask - 1;
+    }
+  }
+#endif
+  for (; i < size; ++i) {
+    cells[count] = i;
+    count += logits[i] > cut;
+  }
+  return count;
+}
+
+void decodeYolo(Layer const &l, uint32_t netWidth, uint32_t netHeight,
+    float threshold, YoloCandidates &candidates)
+{
+  uint32_t const size = l.outH * l.outW;
+  uint32_t const anchors = static_cast<uint32_t>(l.mask.size());
+  float const cut = logitThreshold(threshold);
+  uint32_t const entrySize = size * (l.classes + 5);
+  candidates.cells.resize(anchors * size);
+  std::vector<uint32_t> found(anchors);
+  std::vector<uint32_t> next(anchors, 0);
+  for (uint32_t n = 0; n < anchors; ++n) {
+    found[n] = cellsAbove(l.output + n * entrySize + 4 * size, size, cut,
+        candidates.cells.data() + n * size);
+  }
+
+  // Merged back into darknet's order, by cell then anchor, which breaks the
+  // ties of the suppression.
+  while (true) {
+    uint32_t n = anchors;
+    uint32_t i = size;
+    for (uint32_t m = 0; m < anchors; ++m) {
+      if (next[m] < found[m] && candidates.cells[m * size + next[m]] < i) {
+        n = m;
+        i = candidates.cells[m * size + next[m]];
+      }
+    }
+    if (n == anchors) {
+      break;
+    }
+    ++next[n];
+
+    float const *entry = l.output + n * entrySize;
+    uint32_t const anchor = l.mask[n];
+    uint32_t const col = i % l.outW;
+    uint32_t const row = i / l.outW;
+    candidates.x.push_back(
+        (static_cast<float>(col) + logistic(entry[i])) / l.outW);
+    candidates.y.push_back(
+        (static_cast<float>(row) + logistic(entry[size + i])) / l.outH);
+    candidates.w.push_back(
+        std::exp(entry[2 * size + i]) * l.anchors[2 * anchor] / netWidth);
+    candidates.h.push_back(std::exp(entry[3 * size + i])
+        * l.anchors[2 * anchor + 1] / netHeight);
+    float const objectness = logistic(entry[4 * size + i]);
+    for (uint32_t j = 0; j < candidates.classes; ++j) {
+      float const prob = j < l.classes
+        ? objectness * logistic(entry[(5 + j) * size + i]) : 0.0f;
+      candidates.probs.push_back(prob > threshold ? prob : 0.0f);
+    }
+  }
+}
+
+// Size levels of the suppression grids, each for boxes up to twice as
+// large as the one below, and cells per side of a grid at most.
+static uint32_t const suppressionLevels = 16;
+static uint32_t const maxGridSide = 128;
+
+namespace {
+
+// A grid over the centres of the members of one size level, with cells at
+// least as large as those members, so a box meets only members centred
+// in the cells around it. Its cells follow those of the levels below.
+struct SuppressionGrid {
+  uint32_t count;
+  float maxW;
+  float maxH;
+  float cx0;
+  float cy0;
+  float cx1;
+  float cy1;
+  float cellW;
+  float cellH;
+  uint32_t columns;
+  uint32_t rows;
+  uint32_t firstCell;
+
+  uint32_t column(float cx) const
+  {
+    return cellOf((cx - cx0) / cellW, columns);
+  }
+  uint32_t row(float cy) const
+  {
+    return cellOf((cy - cy0) / cellH, rows);
+  }
+  uint32_t cell(float cx, float cy) const
+  {
+    return firstCell + row(cy) * columns + column(cx);
+  }
+
+  // Also for the boxes of overflowed logits, at infinity or NaN.
+  static uint32_t cellOf(float c, uint32_t cells)
+  {
+    return !(c > 0.0f) ? 0 : c >= static_cast<float>(cells) ? cells - 1
+      : static_cast<uint32_t>(c);
+  }
+};
+
+enum SuppressionState : uint8_t {
+  Unresolved,
+  Kept,
+  Suppressed
+};
+
+}
+
+static float centre(float lo, float hi)
+{
+  return lo + (hi - lo) / 2.0f;
+}
+
+// Cells per side for centres spread over extent, no smaller than size and
+// not many more than the members need.
+static uint32_t gridSide(float extent, float size, uint32_t count)
+{
+  float const n = std::floor(extent / size);
+  uint32_t const limit = std::min(maxGridSide, 2 * count);
+  return !(n > 1.0f) ? 1 : n >= static_cast<float>(limit) ? limit
+    : static_cast<uint32_t>(n);
+}
+
+// Give every member a size level, the smallest boxes on level 0, and
+// bucket the members by level and the cell of their centre.
+static uint32_t bucketMembers(SuppressionScratch &s,
+    SuppressionGrid (&grids)[suppressionLevels])
+{
+  uint32_t const count = static_cast<uint32_t>(s.members.size());
+  float smallest{FLT_MAX};
+  for (uint32_t m = 0; m < count; ++m) {
+    smallest = std::min(smallest,
+        std::max(s.x1[m] - s.x0[m], s.y1[m] - s.y0[m]));
+  }
+  smallest = std::max(smallest, FLT_MIN);
+
+  for (auto &grid : grids) {
+    grid = SuppressionGrid{0, 0.0f, 0.0f, FLT_MAX, FLT_MAX, -FLT_MAX,
+      -FLT_MAX, 1.0f, 1.0f, 1, 1, 0};
+  }
+  s.level.resize(count);
+  for (uint32_t m = 0; m < count; ++m) {
+    float const w = s.x1[m] - s.x0[m];
+    float const h = s.y1[m] - s.y0[m];
+    uint32_t const level = SuppressionGrid::cellOf(
+        std::log2(std::max(w, h) / smallest), suppressionLevels);
+    SuppressionGrid &grid = grids[level];
+    s.level[m] = level;
+    ++grid.count;
+    grid.maxW = std::max(grid.maxW, w);
+    grid.maxH = std::max(grid.maxH, h);
+    grid.cx0 = std::min(grid.cx0, centre(s.x0[m], s.x1[m]));
+    grid.cy0 = std::min(grid.cy0, centre(s.y0[m], s.y1[m]));
+    grid.cx1 = std::max(grid.cx1, centre(s.x0[m], s.x1[m]));
+    grid.cy1 = std::max(grid.cy1, centre(s.y0[m], s.y1[m]));
+  }
+
+  uint32_t cells{0};
+  for (auto &grid : grids) {
+    if (grid.count == 0) {
+      continue;
+    }
+    grid.columns = gridSide(grid.cx1 - grid.cx0, grid.maxW, grid.count);
+    grid.rows = gridSide(grid.cy1 - grid.cy0, grid.maxH, grid.count);
+    grid.cellW = std::max((grid.cx1 - grid.cx0)
+        / static_cast<float>(grid.columns), FLT_MIN);
+    grid.cellH = std::max((grid.cy1 - grid.cy0)
+        / static_cast<float>(grid.rows), FLT_MIN);
+    grid.firstCell = cells;
+    cells += grid.columns * grid.rows;
+  }
+
+  s.cellStart.assign(cells + 1, 0);
+  for (uint32_t m = 0; m < count; ++m) {
+    ++s.cellStart[grids[s.level[m]].cell(centre(s.x0[m], s.x1[m]),
+        centre(s.y0[m], s.y1[m])) + 1];
+  }
+  for (uint32_t c = 1; c <= cells; ++c) {
+    s.cellStart[c] += s.cellStart[c - 1];
+  }
+  s.cellMembers.resize(count);
+  for (uint32_t m = 0; m < count; ++m) {
+    uint32_t const c = grids[s.level[m]].cell(centre(s.x0[m], s.x1[m]),
+        centre(s.y0[m], s.y1[m]));
+    s.cellMembers[s.cellStart[c]++] = m;
+  }
+  // Filling moved every start to the next one.
+  for (uint32_t c = cells; c > 0; --c) {
+    s.cellStart[c] = s.cellStart[c - 1];
+  }
+  s.cellStart[0] = 0;
+  return cells;
+}
+
+// List for each member the more probable members (the earlier one of
+// equals) overlapping it. Every member looks for the members of its own
+// and larger levels around it, so each pair is met once.
+static void findDominators(float nmsThreshold, SuppressionScratch &s)
+{
+  SuppressionGrid grids[suppressionLevels];
+  bucketMembers(s, grids);
+  uint32_t const count = static_cast<uint32_t>(s.members.size());
+  s.overlaps.clear();
+  for (uint32_t m = 0; m < count; ++m) {
+    for (uint32_t level = s.level[m]; level < suppressionLevels; ++level) {
+      SuppressionGrid const &grid = grids[level];
+      if (grid.count == 0) {
+        continue;
+      }
+      // Centres of the boxes of the level that can meet this one, half
+      // their size out at most, with some slack for rounding.
+      float const reachW = grid.maxW * 0.51f + FLT_EPSILON;
+      float const reachH = grid.maxH * 0.51f + FLT_EPSILON;
+      uint32_t const c0 = grid.column(s.x0[m] - reachW);
+      uint32_t const c1 = grid.column(s.x1[m] + reachW);
+      uint32_t const r1 = grid.row(s.y1[m] + reachH);
+      for (uint32_t r = grid.row(s.y0[m] - reachH); r <= r1; ++r) {
+        uint32_t const row = grid.firstCell + r * grid.columns;
+        for (uint32_t e = s.cellStart[row + c0]; e < s.cellStart[row + c1 + 1];
+            ++e) {
+          uint32_t const n = s.cellMembers[e];
+          if (level == s.level[m] && n <= m) {
+            continue;
+          }
+          float const w = std::min(s.x1[m], s.x1[n])
+            - std::max(s.x0[m], s.x0[n]);
+          float const h = std::min(s.y1[m], s.y1[n])
+            - std::max(s.y0[m], s.y0[n]);
+          if (w <= 0.0f || h <= 0.0f) {
+            continue;
+          }
+          float const intersection = w * h;
+          if (intersection / (s.area[m] + s.area[n] - intersection)
+              > nmsThreshold) {
+            bool const mFirst = s.prob[m] > s.prob[n]
+              || (!(s.prob[n] > s.prob[m]) && m < n);
+            s.overlaps.push_back(mFirst ? n : m);
+            s.overlaps.push_back(mFirst ? m : n);
+          }
+        }
+      }
+    }
+  }
+
+  s.dominatorStart.assign(count + 1, 0);
+  for (size_t p = 0; p < s.overlaps.size(); p += 2) {
+    ++s.dominatorStart[s.overlaps[p] + 1];
+  }
+  for (uint32_t m = 1; m <= count; ++m) {
+    s.dominatorStart[m] += s.dominatorStart[m - 1];
+  }
+  s.dominators.resize(s.overlaps.size() / 2);
+  for (size_t p = 0; p < s.overlaps.size(); p += 2) {
+    s.dominators[s.dominatorStart[s.overlaps[p]]++] = s.overlaps[p + 1];
+  }
+  for (uint32_t m = count; m > 0; --m) {
+    s.dominatorStart[m] = s.dominatorStart[m - 1];
+  }
+  s.dominatorStart[0] = 0;
+}
+
+// A member is kept if none of its dominators is; starting from each
+// unresolved member, its dominators are resolved first (depth first, on an
+// explicit stack of member and next dominator).
+static void resolveSuppression(SuppressionScratch &s)
+{
+  uint32_t const count = static_cast<uint32_t>(s.members.size());
+  s.state.assign(count, Unresolved);
+  for (uint32_t m = 0; m < count; ++m) {
+    if (s.state[m] != Unresolved) {
+      continue;
+    }
+    s.stack.clear();
+    s.stack.push_back(m);
+    s.stack.push_back(s.dominatorStart[m]);
+    while (!s.stack.empty()) {
+      uint32_t const n = s.stack[s.stack.size() - 2];
+      uint32_t &next = s.stack.back();
+      if (next == s.dominatorStart[n + 1]) {
+        s.state[n] = Kept;
+      } else {
+        uint32_t const d = s.dominators[next];
+        if (s.state[d] == Suppressed) {
+          ++next;
+          continue;
+        }
+        if (s.state[d] == Unresolved) {
+          s.stack.push_back(d);
+          s.stack.push_back(s.dominatorStart[d]);
+          continue;
+        }
+        s.state[n] = Suppressed;
+      }
+      s.stack.resize(s.stack.size() - 2);
+    }
+  }
+}
+
+void suppressCandidates(YoloCandidates &candidates, float nmsThreshold,
+    SuppressionScratch &scratch)
+{
+  SuppressionScratch &s = scratch;
+  uint32_t const count = static_cast<uint32_t>(candidates.size());
+  for (uint32_t k = 0; k < candidates.classes; ++k) {
+    s.members.clear();
+    s.x0.clear();
+    s.y0.clear();
+    s.x1.clear();
+    s.y1.clear();
+    s.area.clear();
+    s.prob.clear();
+    for (uint32_t i = 0; i < count; ++i) {
+      float const p = candidates.prob(i)[k];
+      if (p > 0.0f) {
+        float const w = candidates.w[i];
+        float const h = candidates.h[i];
+        s.members.push_back(i);
+        s.x0.push_back(candidates.x[i] - w / 2.0f);
+        s.y0.push_back(candidates.y[i] - h / 2.0f);
+        s.x1.push_back(candidates.x[i] + w / 2.0f);
+        s.y1.push_back(candidates.y[i] + h / 2.0f);
+        s.area.push_back(w * h);
+        s.prob.push_back(p);
+      }
+    }
+    if (s.members.size() < 2) {
+      continue;
+    }
+    findDominators(nmsThreshold, s);
+    resolveSuppression(s);
+    for (uint32_t m = 0; m < s.members.size(); ++m) {
+      if (s.state[m] == Suppressed) {
+        candidates.prob(s.members[m])[k] = 0.0f;
+      }
+    }
+  }
+}
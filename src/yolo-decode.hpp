@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef YOLO_DECODE
+#define YOLO_DECODE
+
+#include "yolo-network.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Boxes decoded from the yolo layers, centre and size relative to the
+// network input, with the probability of every class, as arrays per field
+// that are reused from frame to frame.
+struct YoloCandidates {
+  std::vector<float> x{};
+  std::vector<float> y{};
+  std::vector<float> w{};
+  std::vector<float> h{};
+  // Per box, classes probabilities in a row, zero for those at or below
+  // the threshold or suppressed.
+  std::vector<float> probs{};
+  uint32_t classes = 0;
+  // Scratch of the grid cells that pass the threshold.
+  std::vector<uint32_t> cells{};
+
+  // Drop the boxes, keeping the buffers, for boxes of classCount classes.
+  void clear(uint32_t classCount);
+
+  size_t size() const
+  {
+    return x.size();
+  }
+  float *prob(size_t box)
+  {
+    return probs.data() + box * classes;
+  }
+  float const *prob(size_t box) const
+  {
+    return probs.data() + box * classes;
+  }
+};
+
+// The buffers of suppressCandidates, reused from frame to frame.
+struct SuppressionScratch {
+  // The boxes of the class at hand (members), and their edges, areas,
+  // probabilities and size levels.
+  std::vector<uint32_t> members{};
+  std::vector<float> x0{};
+  std::vector<float> y0{};
+  std::vector<float> x1{};
+  std::vector<float> y1{};
+  std::vector<float> area{};
+  std::vector<float> prob{};
+  std::vector<uint32_t> level{};
+  // Per grid cell of every level, the members centred in it.
+  std::vector<uint32_t> cellStart{};
+  std::vector<uint32_t> cellMembers{};
+  // Pairs of overlapping members, the less probable one first, and per
+  // member the more probable ones overlapping it.
+  std::vector<uint32_t> overlaps{};
+  std::vector<uint32_t> dominatorStart{};
+  std::vector<uint32_t> dominators{};
+  std::vector<uint8_t> state{};
+  std::vector<uint32_t> stack{};
+};
+
+// The logit of a probability: a logistic output is above the probability
+// exactly when its input is above the logit.
+float logitThreshold(float probability);
+
+// Append the anchors of a yolo layer whose objectness is above the
+// threshold. The layer output holds logits, so the objectness is compared
+// in logit space and the logistic and exponential are only computed for
+// the anchors that pass.
+void decodeYolo(Layer const &l, uint32_t netWidth, uint32_t netHeight,
+    float threshold, YoloCandidates &candidates);
+
+// Per class, clear the class probability of boxes overlapping a more
+// probable one that is kept by more than nmsThreshold (intersection over
+// union), as darknet's greedy suppression does, ties going to the earlier
+// box. Boxes are bucketed by size and by the grid cell of their centre, so
+// each is only compared with the boxes of nearby cells, and which are kept
+// is resolved from the overlaps without sorting.
+void suppressCandidates(YoloCandidates &candidates, float nmsThreshold,
+    SuppressionScratch &scratch);
+#endif
@@ -0,0 +1,596 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "yolo-network.hpp"
+#include "inference-profile.hpp"
+#include "thread-pool.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+struct CfgSection {
+  std::string name;
+  std::map<std::string, std::string> options;
+};
+
+}
+
+// Read a darknet cfg file into its sections. Whitespace is dropped
+// everywhere, as darknet does.
+static std::vector<CfgSection> readCfg(std::string const &cfgFile)
+{
+  std::ifstream in(cfgFile);
+  if (!in) {
+    throw std::runtime_error("Could not open cfg file '" + cfgFile + "'");
+  }
+  std::vector<CfgSection> sections;
+  std::string line;
+  while (std::getline(in, line)) {
+    line.erase(std::remove_if(line.begin(), line.end(), [](char ch) {
+          return std::isspace(static_cast<unsigned char>(ch)) != 0;
+        }), line.end());
+    if (line.empty() || line[0] == '#' || line[0] == ';') {
+      continue;
+    }
+    if (line[0] == '[') {
+      sections.push_back(CfgSection{line.substr(1, line.find(']') - 1), {}});
+      continue;
+    }
+    size_t const eq = line.find('=');
+    if (eq == std::string::npos || sections.empty()) {
+      throw std::runtime_error("Bad line '" + line + "' in cfg file '"
+          + cfgFile + "'");
+    }
+    sections.back().options[line.substr(0, eq)] = line.substr(eq + 1);
+  }
+  if (sections.empty() || (sections[0].name != "net"
+        && sections[0].name != "network")) {
+    throw std::runtime_error("Cfg file '" + cfgFile
+        + "' does not start with [net]");
+  }
+  return sections;
+}
+
+static int32_t optionInt(CfgSection const &section, std::string const &key,
+    int32_t fallback)
+{
+  auto it = section.options.find(key);
+  return it == section.options.end() ? fallback : std::stoi(it->second);
+}
+
+static std::vector<float> optionList(CfgSection const &section,
+    std::string const &key)
+{
+  std::vector<float> values;
+  auto it = section.options.find(key);
+  if (it != section.options.end()) {
+    std::stringstream list(it->second);
+    std::string value;
+    while (std::getline(list, value, ',')) {
+      values.push_back(std::stof(value));
+    }
+  }
+  return values;
+}
+
+static Activation parseActivation(std::string const &name)
+{
+  if (name == "linear") {
+    return Activation::Linear;
+  }
+  if (name == "leaky") {
+    return Activation::Leaky;
+  }
+  throw std::runtime_error("Unsupported activation '" + name + "'");
+}
+
+YoloNetwork::YoloNetwork(std::string const &cfgFile)
+{
+  std::vector<CfgSection> const sections = readCfg(cfgFile);
+  m_width = static_cast<uint32_t>(optionInt(sections[0], "width", 0));
+  m_height = static_cast<uint32_t>(optionInt(sections[0], "height", 0));
+  m_channels = static_cast<uint32_t>(optionInt(sections[0], "channels", 0));
+  if (m_width == 0 || m_height == 0 || m_channels == 0) {
+    throw std::runtime_error("No input size in cfg file '" + cfgFile + "'");
+  }
+
+  uint32_t c = m_channels;
+  uint32_t h = m_height;
+  uint32_t w = m_width;
+  for (uint32_t n = 1; n < sections.size(); ++n) {
+    CfgSection const &section = sections[n];
+    uint32_t const index = n - 1;
+    Layer l;
+    l.c = c;
+    l.h = h;
+    l.w = w;
+    if (section.name == "convolutional" || section.name == "conv") {
+      l.type = LayerType::Convolutional;
+      l.outC = static_cast<uint32_t>(optionInt(section, "filters", 1));
+      l.size = static_cast<uint32_t>(optionInt(section, "size", 1));
+      l.stride = static_cast<uint32_t>(optionInt(section, "stride", 1));
+      l.pad = optionInt(section, "pad", 0) != 0 ? l.size / 2
+        : static_cast<uint32_t>(optionInt(section, "padding", 0));
+      l.batchNormalize = optionInt(section, "batch_normalize", 0) != 0;
+      auto it = section.options.find("activation");
+      l.activation = parseActivation(it == section.options.end()
+          ? "logistic" : it->second);
+      l.outH = (h + 2 * l.pad - l.size) / l.stride + 1;
+      l.outW = (w + 2 * l.pad - l.size) / l.stride + 1;
+    } else if (section.name == "maxpool" || section.name == "max") {
+      l.type = LayerType::Maxpool;
+      l.size = static_cast<uint32_t>(optionInt(section, "size", 1));
+      l.stride = static_cast<uint32_t>(optionInt(section, "stride", 1));
+      l.pad = static_cast<uint32_t>(optionInt(section, "padding",
+            static_cast<int32_t>(l.size) - 1));
+      l.outC = c;
+      l.outH = (h + l.pad - l.size) / l.stride + 1;
+      l.outW = (w + l.pad - l.size) / l.stride + 1;
+    } else if (section.name == "route") {
+      l.type = LayerType::Route;
+      for (float value : optionList(section, "layers")) {
+        int32_t input = static_cast<int32_t>(value);
+        input = input < 0 ? static_cast<int32_t>(index) + input : input;
+        if (input < 0 || input >= static_cast<int32_t>(index)) {
+          throw std::runtime_error("Route to a missing layer in cfg file '"
+              + cfgFile + "'");
+        }
+        Layer const &from = m_layers[static_cast<uint32_t>(input)];
+        if (!l.inputs.empty() && (from.outH != l.outH || from.outW != l.outW)) {
+          throw std::runtime_error("Route of layers of different size in "
+              "cfg file '" + cfgFile + "'");
+        }
+        l.inputs.push_back(static_cast<uint32_t>(input));
+        l.outC += from.outC;
+        l.outH = from.outH;
+        l.outW = from.outW;
+      }
+      if (l.inputs.empty()) {
+        throw std::runtime_error("Route without layers in cfg file '"
+            + cfgFile + "'");
+      }
+    } else if (section.name == "upsample") {
+      l.type = LayerType::Upsample;
+      l.stride = static_cast<uint32_t>(optionInt(section, "stride", 2));
+      l.outC = c;
+      l.outH = h * l.stride;
+      l.outW = w * l.stride;
+    } else if (section.name == "yolo") {
+      l.type = LayerType::Yolo;
+      l.classes = static_cast<uint32_t>(optionInt(section, "classes", 20));
+      l.anchors = optionList(section, "anchors");
+      for (float value : optionList(section, "mask")) {
+        l.mask.push_back(static_cast<uint32_t>(value));
+      }
+      for (uint32_t m : l.mask) {
+        if (2 * m + 1 >= l.anchors.size()) {
+          throw std::runtime_error("Yolo mask without anchor in cfg file '"
+              + cfgFile + "'");
+        }
+      }
+      if (c != l.mask.size() * (l.classes + 5)) {
+        throw std::runtime_error("Yolo layer input does not match its "
+            "classes and mask in cfg file '" + cfgFile + "'");
+      }
+      l.outC = c;
+      l.outH = h;
+      l.outW = w;
+    } else {
+      throw std::runtime_error("Unsupported layer [" + section.name
+          + "] in cfg file '" + cfgFile + "'");
+    }
+    c = l.outC;
+    h = l.outH;
+    w = l.outW;
+    m_layers.push_back(std::move(l));
+  }
+  allocateActivations();
+}
+
+YoloNetwork::YoloNetwork(uint32_t width, uint32_t height, uint32_t channels,
+    std::vector<Layer> layers, std::shared_ptr<MappedFile const> mapping):
+  m_layers(std::move(layers)),
+  m_width(width),
+  m_height(height),
+  m_channels(channels),
+  m_mapping(std::move(mapping))
+{
+  allocateActivations();
+}
+
+// Left uninitialized, as every layer writes all of its output before it
+// is read.
+void YoloNetwork::allocateActivations()
+{
+  m_plan = planActivations(m_layers);
+  void *arena{nullptr};
+  if (0 != posix_memalign(&arena, 64, std::max<uint64_t>(m_plan.size, 1)
+        * sizeof(float))) {
+    throw std::bad_alloc();
+  }
+  m_arena.reset(static_cast<float *>(arena));
+  for (size_t i = 0; i < m_layers.size(); ++i) {
+    m_layers[i].output = m_arena.get() + m_plan.offsets[i];
+    m_layers[i].view = m_plan.views[i];
+  }
+}
+
+static void readFloats(std::ifstream &in, std::vector<float> &values,
+    uint32_t count, std::string const &weightFile)
+{
+  values.resize(count);
+  in.read(reinterpret_cast<char *>(values.data()),
+      static_cast<std::streamsize>(count * sizeof(float)));
+  if (!in) {
+    throw std::runtime_error("Weights file '" + weightFile
+        + "' is too short for the network");
+  }
+}
+
+ConvTuning defaultConvTuning(Layer const &l)
+{
+  ConvShape const shape{l.c, l.h, l.w, l.size, l.stride, l.pad, l.outH,
+    l.outW};
+  ConvTuning tuning;
+  if (winogradSuits(shape, l.outC)) {
+    tuning.algorithm = ConvAlgorithm::Winograd;
+    tuning.blocking = winogradBlocking(shape, l.outC);
+  }
+  return tuning;
+}
+
+void YoloNetwork::loadWeights(std::string const &weightFile,
+    std::vector<ConvTuning> const &tuning)
+{
+  if (!tuning.empty() && tuning.size() != m_layers.size()) {
+    throw std::runtime_error("Tuning does not fit the network");
+  }
+  std::ifstream in(weightFile, std::ios::binary);
+  if (!in) {
+    throw std::runtime_error("Could not open weights file '" + weightFile
+        + "'");
+  }
+  int32_t version[3];
+  in.read(reinterpret_cast<char *>(version), sizeof(version));
+  // Images seen during training, 64-bit since version 0.2.
+  bool const wideSeen = (version[0] * 10 + version[1]) >= 2
+    && version[0] < 1000 && version[1] < 1000;
+  in.ignore(wideSeen ? 8 : 4);
+  if (!in) {
+    throw std::runtime_error("Weights file '" + weightFile
+        + "' has no header");
+  }
+
+  for (size_t index = 0; index < m_layers.size(); ++index) {
+    Layer &l = m_layers[index];
+    if (l.type != LayerType::Convolutional) {
+      continue;
+    }
+    uint32_t const k = l.c * l.size * l.size;
+    std::vector<float> weights;
+    std::vector<float> scales;
+    std::vector<float> rollingMean;
+    std::vector<float> rollingVariance;
+    readFloats(in, l.biases, l.outC, weightFile);
+    if (l.batchNormalize) {
+      readFloats(in, scales, l.outC, weightFile);
+      readFloats(in, rollingMean, l.outC, weightFile);
+      readFloats(in, rollingVariance, l.outC, weightFile);
+    }
+    readFloats(in, weights, l.outC * k, weightFile);
+
+    // (w x - mean) / (sqrt(var) + eps) * scale + bias, with darknet's
+    // epsilon, is (w s) x + (bias - mean s) for s = scale / (sqrt(var) +
+    // eps).
+    if (l.batchNormalize) {
+      for (uint32_t f = 0; f < l.outC; ++f) {
+        float const s = scales[f] / (std::sqrt(rollingVariance[f])
+            + .000001f);
+        for (uint32_t i = 0; i < k; ++i) {
+          weights[f * k + i] *= s;
+        }
+        l.biases[f] -= rollingMean[f] * s;
+      }
+    }
+    // The GEMM weights are kept for Winograd layers too, to quantize.
+    ConvTuning const t = tuning.empty() ? defaultConvTuning(l)
+      : tuning[index];
+    if (t.algorithm == ConvAlgorithm::Winograd) {
+      if (!winogradApplies(ConvShape{l.c, l.h, l.w, l.size, l.stride, l.pad,
+            l.outH, l.outW})) {
+        throw std::runtime_error("Winograd tuned for a convolution it does "
+            "not apply to");
+      }
+      l.packed = packWeights(weights.data(), l.outC, k, GemmBlocking());
+      l.winograd = transformWeights(weights.data(), l.outC, l.c,
+          t.blocking);
+    } else {
+      l.packed = packWeights(weights.data(), l.outC, k, t.blocking);
+    }
+  }
+}
+
+uint32_t YoloNetwork::width() const
+{
+  return m_width;
+}
+
+uint32_t YoloNetwork::height() const
+{
+  return m_height;
+}
+
+uint32_t YoloNetwork::channels() const
+{
+  return m_channels;
+}
+
+std::vector<Layer> const &YoloNetwork::layers() const
+{
+  return m_layers;
+}
+
+ActivationPlan const &YoloNetwork::activationPlan() const
+{
+  return m_plan;
+}
+
+void YoloNetwork::quantize(std::vector<float> const &ranges)
+{
+  for (size_t i = 0; i < m_layers.size(); ++i) {
+    Layer &l = m_layers[i];
+    if (l.type != LayerType::Convolutional
+        || l.activation != Activation::Leaky) {
+      continue;
+    }
+    l.quantized = quantizeWeights(unpackWeights(l.packed).data(), l.outC,
+        l.c * l.size * l.size, ranges[i]);
+    l.packed = PackedWeights();
+    l.winograd = WinogradWeights();
+  }
+  m_spanProfile = nullptr;
+}
+
+std::string inputRangesFile(std::string const &weightFile)
+{
+  return weightFile + ".int8";
+}
+
+void writeInputRanges(std::string const &file,
+    std::vector<float> const &ranges)
+{
+  std::ofstream out(file);
+  if (!out) {
+    throw std::runtime_error("Could not write '" + file + "'");
+  }
+  out << "# layer, largest input magnitude" << std::endl;
+  out.precision(9);
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    if (ranges[i] > 0.0f) {
+      out << i << " " << ranges[i] << std::endl;
+    }
+  }
+}
+
+std::vector<float> readInputRanges(std::string const &file,
+    size_t layerCount)
+{
+  std::ifstream in(file);
+  if (!in) {
+    throw std::runtime_error("Could not open activation ranges '" + file
+        + "'");
+  }
+  std::vector<float> ranges(layerCount, 0.0f);
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream fields(line);
+    size_t layer;
+    float range;
+    if (!(fields >> layer >> range) || layer >= layerCount) {
+      throw std::runtime_error("Activation ranges '" + file
+          + "' do not fit the network");
+    }
+    ranges[layer] = range;
+  }
+  return ranges;
+}
+
+// Convolution as a GEMM over the unrolled input, in float or int8, or
+// with Winograd, with the bias and activation applied as each output tile
+// is stored.
+static void forwardConvolutional(Layer &l, float const *in, ThreadPool &pool,
+    std::vector<GemmScratch> &scratch, std::vector<Int8Scratch> &int8Scratch,
+    std::vector<WinogradScratch> &winogradScratch)
+{
+  ConvShape const shape{l.c, l.h, l.w, l.size, l.stride, l.pad, l.outH,
+    l.outW};
+  GemmEpilogue epilogue;
+  epilogue.bias = l.biases.data();
+  epilogue.leaky = (l.activation == Activation::Leaky);
+  if (!l.quantized.data.empty()) {
+    convolutionInt8(l.quantized, in, shape, epilogue, l.output, pool,
+        int8Scratch);
+  } else if (l.winograd.m != 0) {
+    convolutionWinograd(l.winograd, in, shape, epilogue, l.output, pool,
+        winogradScratch);
+  } else {
+    convolutionGemm(l.packed, in, shape, epilogue, l.output, pool,
+        scratch);
+  }
+}
+
+static void forwardMaxpool(Layer &l, float const *in)
+{
+  int32_t const offset = -static_cast<int32_t>(l.pad / 2);
+  for (uint32_t c = 0; c < l.c; ++c) {
+    float const *plane = in + c * l.h * l.w;
+    float *out = l.output + c * l.outH * l.outW;
+    for (uint32_t oy = 0; oy < l.outH; ++oy) {
+      for (uint32_t ox = 0; ox < l.outW; ++ox) {
+        float best = -FLT_MAX;
+        for (uint32_t ky = 0; ky < l.size; ++ky) {
+          int32_t const y = offset + static_cast<int32_t>(oy * l.stride + ky);
+          if (y < 0 || y >= static_cast<int32_t>(l.h)) {
+            continue;
+          }
+          for (uint32_t kx = 0; kx < l.size; ++kx) {
+            int32_t const x = offset
+              + static_cast<int32_t>(ox * l.stride + kx);
+            if (x >= 0 && x < static_cast<int32_t>(l.w)) {
+              best = std::max(best, plane[y * static_cast<int32_t>(l.w) + x]);
+            }
+          }
+        }
+        out[oy * l.outW + ox] = best;
+      }
+    }
+  }
+}
+
+static void forwardUpsample(Layer &l, float const *in)
+{
+  for (uint32_t c = 0; c < l.c; ++c) {
+    for (uint32_t oy = 0; oy < l.outH; ++oy) {
+      float const *row = in + (c * l.h + oy / l.stride) * l.w;
+      float *out = l.output + (c * l.outH + oy) * l.outW;
+      for (uint32_t ox = 0; ox < l.outW; ++ox) {
+        out[ox] = row[ox / l.stride];
+      }
+    }
+  }
+}
+
+// The box, objectness and class logits of every anchor, squashed later by
+// decodeYolo for the anchors that pass the threshold only.
+static void forwardYolo(Layer &l, float const *in)
+{
+  std::copy(in, in + l.outputSize(), l.output);
+}
+
+static char const *layerCategory(LayerType type)
+{
+  switch (type) {
+    case LayerType::Convolutional:
+      return "conv";
+    case LayerType::Maxpool:
+      return "maxpool";
+    case LayerType::Route:
+      return "route";
+    case LayerType::Upsample:
+      return "upsample";
+    case LayerType::Yolo:
+      return "yolo";
+  }
+  return "layer";
+}
+
+// The index and kind of a layer, with the shape and algorithm of
+// convolutions, such as "04 conv 3x3/1 32>64 winograd".
+static std::string layerSpanName(Layer const &l, size_t i)
+{
+  std::ostringstream name;
+  name << (i < 10 ? "0" : "") << i << " " << layerCategory(l.type);
+  switch (l.type) {
+    case LayerType::Convolutional:
+      name << " " << l.size << "x" << l.size << "/" << l.stride << " " << l.c
+        << ">" << l.outC << (!l.quantized.data.empty() ? " int8"
+            : l.winograd.m != 0 ? " winograd" : " gemm");
+      break;
+    case LayerType::Maxpool:
+      name << " " << l.size << "x" << l.size << "/" << l.stride;
+      break;
+    case LayerType::Route:
+      for (size_t j = 0; j < l.inputs.size(); ++j) {
+        name << (j == 0 ? " " : ",") << l.inputs[j];
+      }
+      break;
+    case LayerType::Upsample:
+      name << " x" << l.stride;
+      break;
+    case LayerType::Yolo:
+      break;
+  }
+  return name.str();
+}
+
+void YoloNetwork::forward(float const *input, ThreadPool &pool,
+    std::vector<float> *ranges, InferenceProfile *profile)
+{
+  if (ranges != nullptr) {
+    ranges->resize(m_layers.size(), 0.0f);
+  }
+  if (profile != nullptr && profile != m_spanProfile) {
+    m_spanSeries.clear();
+    for (size_t i = 0; i < m_layers.size(); ++i) {
+      m_spanSeries.push_back(profile->series(layerSpanName(m_layers[i], i),
+          layerCategory(m_layers[i].type)));
+    }
+    m_spanProfile = profile;
+  }
+  float const *in = input;
+  for (size_t i = 0; i < m_layers.size(); ++i) {
+    Layer &l = m_layers[i];
+    int64_t const start = profile != nullptr ? profileClock() : 0;
+    switch (l.type) {
+      case LayerType::Convolutional:
+        if (ranges != nullptr) {
+          for (uint32_t j = 0; j < l.c * l.h * l.w; ++j) {
+            (*ranges)[i] = std::max((*ranges)[i], std::abs(in[j]));
+          }
+        }
+        forwardConvolutional(l, in, pool, m_scratch, m_int8Scratch,
+            m_winogradScratch);
+        break;
+      case LayerType::Maxpool:
+        forwardMaxpool(l, in);
+        break;
+      case LayerType::Route:
+        if (!l.view) {
+          float *out = l.output;
+          for (uint32_t j : l.inputs) {
+            Layer const &from = m_layers[j];
+            out = std::copy(from.output, from.output + from.outputSize(),
+                out);
+          }
+        }
+        break;
+      case LayerType::Upsample:
+        forwardUpsample(l, in);
+        break;
+      case LayerType::Yolo:
+        forwardYolo(l, in);
+        break;
+    }
+    if (profile != nullptr) {
+      profile->record(m_spanSeries[i], start, profileClock());
+    }
+    in = l.output;
+  }
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef YOLO_NETWORK
+#define YOLO_NETWORK
+
+#include "activation-plan.hpp"
+#include "conv-gemm.hpp"
+#include "conv-int8.hpp"
+#include "conv-winograd.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+class InferenceProfile;
+class MappedFile;
+class ThreadPool;
+
+// The darknet layer types used by the Yolo cfg files of this repository.
+enum class LayerType {
+  Convolutional,
+  Maxpool,
+  Route,
+  Upsample,
+  Yolo
+};
+
+enum class Activation {
+  Linear,
+  Leaky
+};
+
+// One layer and its output, channels x height x width, planar.
+struct Layer {
+  LayerType type = LayerType::Convolutional;
+  uint32_t c = 0;
+  uint32_t h = 0;
+  uint32_t w = 0;
+  uint32_t outC = 0;
+  uint32_t outH = 0;
+  uint32_t outW = 0;
+  // Convolutional (filters is outC) and maxpool.
+  uint32_t size = 1;
+  uint32_t stride = 1;
+  uint32_t pad = 0;
+  bool batchNormalize = false;
+  Activation activation = Activation::Linear;
+  // The weights, in the layout of the GEMM, and biases with batch
+  // normalization folded in, so the layer is a convolution plus bias
+  // followed by the activation. Layers that suit Winograd also have their
+  // weights transformed for it, and run with those. The weights are
+  // quantized to int8 instead once the network is quantized.
+  PackedWeights packed{};
+  WinogradWeights winograd{};
+  std::vector<float> biases{};
+  QuantizedWeights quantized{};
+  // Route: indices of the layers whose outputs are concatenated.
+  std::vector<uint32_t> inputs{};
+  // Yolo: anchor sizes (pairs, in network input pixels) and the ones this
+  // layer predicts.
+  std::vector<float> anchors{};
+  std::vector<uint32_t> mask{};
+  uint32_t classes = 0;
+  // In the network's activation arena. A route that is a view of its
+  // inputs has them there in order already and copies nothing.
+  float *output = nullptr;
+  bool view = false;
+
+  uint32_t outputSize() const
+  {
+    return outC * outH * outW;
+  }
+};
+
+enum class ConvAlgorithm {
+  Gemm,
+  Winograd
+};
+
+// How a convolution runs in float: the algorithm and the blocking of its
+// weights for it (see winogradBlocking for what it means to Winograd).
+struct ConvTuning {
+  ConvAlgorithm algorithm = ConvAlgorithm::Gemm;
+  GemmBlocking blocking{};
+};
+
+// The tuning of a convolution that was not measured: Winograd if it
+// winogradSuits, otherwise the GEMM, at the default blocking of each.
+ConvTuning defaultConvTuning(Layer const &l);
+
+struct ArenaDeleter {
+  void operator()(float *p) const { free(p); }
+};
+
+// A Yolo network read from a darknet cfg and weights file and run on the
+// CPU. Throws std::runtime_error on files it cannot use.
+class YoloNetwork {
+ public:
+  explicit YoloNetwork(std::string const &cfgFile);
+
+  // A network of layers that are already loaded, whose packed weights may
+  // point into the mapping.
+  YoloNetwork(uint32_t width, uint32_t height, uint32_t channels,
+      std::vector<Layer> layers, std::shared_ptr<MappedFile const> mapping);
+  YoloNetwork(YoloNetwork const &) = delete;
+  YoloNetwork &operator=(YoloNetwork const &) = delete;
+  YoloNetwork(YoloNetwork &&) = default;
+  YoloNetwork &operator=(YoloNetwork &&) = default;
+
+  // Read the weights in darknet's format, in layer order, folding batch
+  // normalization into the weights and biases of each convolution. The
+  // weights are packed for the GEMM and, for the convolutions tuned to
+  // Winograd, transformed for it, as tuning (one per layer, or empty for
+  // the default of every layer) says.
+  void loadWeights(std::string const &weightFile,
+      std::vector<ConvTuning> const &tuning = std::vector<ConvTuning>());
+
+  uint32_t width() const;
+  uint32_t height() const;
+  uint32_t channels() const;
+
+  // Run the network on a planar image of the input size, normalized to
+  // [0, 1], spreading every layer over the pool. The results are in the
+  // outputs of the yolo layers, as logits (see decodeYolo); the outputs of
+  // other layers may be overwritten by later ones. If ranges (one per
+  // layer) is given it is widened to the largest magnitude of each
+  // convolution's input. If profile is given every layer is recorded in it
+  // as a span.
+  void forward(float const *input, ThreadPool &pool,
+      std::vector<float> *ranges = nullptr,
+      InferenceProfile *profile = nullptr);
+
+  std::vector<Layer> const &layers() const;
+
+  ActivationPlan const &activationPlan() const;
+
+  // Run the convolutions with leaky activation in int8, for inputs within
+  // ranges (one per layer). The linear convolutions in front of the yolo
+  // layers keep their float weights, as the box regression is the most
+  // sensitive to rounding. The quantized layers no longer use Winograd,
+  // whose transformed inputs would need a wider range.
+  void quantize(std::vector<float> const &ranges);
+
+ private:
+  std::vector<Layer> m_layers{};
+  uint32_t m_width{0};
+  uint32_t m_height{0};
+  uint32_t m_channels{0};
+  std::vector<GemmScratch> m_scratch{};
+  std::vector<Int8Scratch> m_int8Scratch{};
+  std::vector<WinogradScratch> m_winogradScratch{};
+  std::shared_ptr<MappedFile const> m_mapping{};
+  ActivationPlan m_plan{};
+  std::unique_ptr<float, ArenaDeleter> m_arena{};
+  // Series of each layer in m_spanProfile, found once it is first profiled.
+  InferenceProfile *m_spanProfile{nullptr};
+  std::vector<uint32_t> m_spanSeries{};
+
+  void allocateActivations();
+};
+
+// The activation ranges file of a weights file, next to it.
+std::string inputRangesFile(std::string const &weightFile);
+
+// The activation ranges of a calibrated network, as text with one line of
+// layer index and range per convolution. Reading throws
+// std::runtime_error if the file is missing or does not fit layerCount
+// layers.
+void writeInputRanges(std::string const &file,
+    std::vector<float> const &ranges);
+std::vector<float> readInputRanges(std::string const &file,
+    size_t layerCount);
+#endif
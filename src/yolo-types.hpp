@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef YOLO_TYPES
+#define YOLO_TYPES
+
+// The box and image types of darknet's C++ API. Without darknet the same
+// layout is declared here, so every backend and the rest of the pipeline
+// share one type.
+#if defined(HAVE_DARKNET)
+#include <yolo_v2_class.hpp>
+#else
+struct bbox_t {
+  // Top-left corner and size in pixels.
+  unsigned int x, y, w, h;
+  float prob;
+  unsigned int obj_id;
+  // Zero if untracked.
+  unsigned int track_id;
+  unsigned int frames_counter;
+  // Centre of the object in metres, if known.
+  float x_3d, y_3d, z_3d;
+};
+
+struct image_t {
+  int h;
+  int w;
+  // Number of channels, planar.
+  int c;
+  float *data;
+};
+#endif
+#endif